@@ -0,0 +1,127 @@
+//
+// Headless, multi-threaded front end for DocumentScanner.
+//
+#include "BatchScanner.h"
+
+#include <algorithm>
+#include <sstream>
+
+using namespace std;
+namespace fs = std::filesystem;
+
+/************************ CONSTRUCTOR ***************************************/
+BatchScanner::BatchScanner(fs::path outDir, unsigned int nThreads,
+                           DSOptions opts) :
+  outputDir(std::move(outDir)), options(opts)
+{
+  // WORKERS NEVER OPEN WINDOWS
+  options.headless = true;
+  pipeOptions.segmentThreads = nThreads;
+}
+
+/***************************** GETTERS & SETTERS ******************************/
+void BatchScanner::setPipelineOptions(const PipelineOptions& opts)
+{
+  pipeOptions = opts;
+}
+
+const PipelineOptions& BatchScanner::getPipelineOptions() const
+{
+  return pipeOptions;
+}
+
+void BatchScanner::setOutputExtension(const string& ext)
+{
+  outputExt = ext.empty() || ext[0] == '.' ? ext : "." + ext;
+}
+
+// ADD INPUT
+/******************************************************************************/
+void BatchScanner::addInput(const fs::path& path)
+{
+  if (fs::is_directory(path))
+  {
+    vector<fs::path> found;
+    for (const auto& entry : fs::directory_iterator(path))
+      if (entry.is_regular_file() && isImageFile(entry.path()))
+        found.push_back(entry.path());
+    sort(found.begin(), found.end());
+    inputs.insert(inputs.end(), found.begin(), found.end());
+  }
+  else
+    inputs.push_back(path);
+}
+
+size_t BatchScanner::numInputs() const
+{
+  return inputs.size();
+}
+
+// OUTPUT PATH: <outputDir>/<stem>_scanned<ext>
+/******************************************************************************/
+fs::path BatchScanner::outputPathFor(const fs::path& input) const
+{
+  string ext = outputExt.empty() ? input.extension().string() : outputExt;
+  if (ext.empty())
+    ext = ".jpg";
+  return outputDir / (input.stem().string() + "_scanned" + ext);
+}
+
+// "JPEG q85, 183402 bytes, 12.4 ms"
+static string encodeSummary(const EncodeReport& report)
+{
+  ostringstream summary;
+  summary << outputFormatToString(report.format);
+  if (report.quality > 0)
+    summary << " q" << report.quality;
+  summary << ", " << report.bytes << " bytes, " << report.encodeMs << " ms";
+  if (report.overBudget)
+    summary << ", over budget";
+  return summary.str();
+}
+
+// RUN - MACRO
+/******************************************************************************/
+vector<BatchResult> BatchScanner::run()
+{
+  if (inputs.empty())
+    return {};
+  fs::create_directories(outputDir);
+
+  vector<DocumentPipeline::Job> jobs;
+  jobs.reserve(inputs.size());
+  for (const auto& input : inputs)
+    jobs.push_back({input.string(), outputPathFor(input).string()});
+
+  DocumentPipeline pipeline(options, pipeOptions);
+  return pipeline.run(jobs, [this](const BatchResult& result)
+  {
+    lock_guard<mutex> lock(outputMutex);
+    if (result.succeeded && !result.pagePaths.empty())
+    {
+      cout << result.inputPath << " -> " << result.pagePaths.size()
+           << " pages (" << DocumentScanner::detectionEngineToString(
+                              result.detector) << "; "
+           << encodeSummary(result.encode) << ")" << endl;
+      for (const auto& page : result.pagePaths)
+        cout << "  " << page << endl;
+    }
+    else if (result.succeeded)
+      cout << result.inputPath << " -> " << result.outputPath << " ("
+           << DocumentScanner::detectionEngineToString(result.detector)
+           << (result.degraded ? ", degraded: " + result.degradedReason : "")
+           << "; " << encodeSummary(result.encode) << ")" << endl;
+    else
+      cerr << result.inputPath << ": " << result.error << endl;
+  });
+}
+
+// STATIC
+bool BatchScanner::isImageFile(const fs::path& path)
+{
+  string ext = path.extension().string();
+  transform(ext.begin(), ext.end(), ext.begin(),
+            [](unsigned char c) { return tolower(c); });
+  return ext == ".jpg" || ext == ".jpeg" || ext == ".png" ||
+         ext == ".tif" || ext == ".tiff" || ext == ".bmp" || ext == ".webp";
+}
@@ -0,0 +1,55 @@
+//
+// Headless, multi-threaded front end for DocumentScanner.
+//
+
+#ifndef DOCUMENTSCANNER_BATCHSCANNER_H
+#define DOCUMENTSCANNER_BATCHSCANNER_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <filesystem>
+
+#include "DocumentScanner.h"
+#include "DSPipeline.h"
+
+class BatchScanner
+{
+private:
+  std::filesystem::path outputDir;
+  DSOptions options;
+  PipelineOptions pipeOptions;
+  std::string outputExt;
+  std::vector<std::filesystem::path> inputs;
+  std::mutex outputMutex;
+
+  /******************************* PRIVATE METHODS ****************************/
+  std::filesystem::path outputPathFor(const std::filesystem::path& input) const;
+
+public:
+  /****************************** CONSTRUCTORS ********************************/
+  // nThreads: segmentation threads (0 = every hardware thread left over
+  // after the decode, warp and encode stages)
+  explicit BatchScanner(std::filesystem::path outDir,
+                        unsigned int nThreads = 0,
+                        DSOptions opts = DSOptions());
+
+  /**************************** SETTERS & GETTERS *****************************/
+  void setPipelineOptions(const PipelineOptions& opts);
+  [[nodiscard]] const PipelineOptions& getPipelineOptions() const;
+  // Output format by extension (".png", ".ppm", ...); empty keeps each
+  // input's own. ".ppm" / ".pgm" are streamed band by band when
+  // DSOptions::outputBudgetMB is set.
+  void setOutputExtension(const std::string& ext);
+
+  /*************************** PUBLIC METHODS *********************************/
+  // A directory adds every image file directly inside it (sorted by name)
+  void addInput(const std::filesystem::path& path);
+  [[nodiscard]] size_t numInputs() const;
+  std::vector<BatchResult> run();
+
+  /**************************** STATIC METHODS ********************************/
+  static bool isImageFile(const std::filesystem::path& path);
+};
+
+#endif //DOCUMENTSCANNER_BATCHSCANNER_H
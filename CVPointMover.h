@@ -5,6 +5,7 @@
 #ifndef DOCUMENTSCANNER_CVPOINTMOVER_H
 #define DOCUMENTSCANNER_CVPOINTMOVER_H
 
+#include <algorithm>
 #include <utility>
 #include <vector>
 #include <list>
@@ -47,26 +48,96 @@ class CVPointMover_
 private:
   sptr<std::vector<cv::Point_<T>>>  pPoints; // starts from upper left and rotates CW
   sptr<cv::Mat> pCleanMat;
-  sptr<cv::Mat> pDirtyMat;
+  sptr<cv::Mat> pDirtyMat; // rendered editor image, at display resolution
   std::string winName;
-  int pointRadius = 20; // circle of 20 pixels
+  int pointRadius = 12; // circle of 12 display pixels
+  int lineThickness = 2;
+  double fontScale = 0.9;
   LButtonEventStatus btnStatus = LButtonEventStatus::Released;
+  PointLoc activeLoc = UPPER_LEFT;
+  std::list<std::string> messages;
+
+  // DISPLAY PROXY: editing never touches the full-size pCleanMat again
+  int maxDisplaySize = 1280; // long side of the editing proxy
+  double displayScale = 1.0; // display pixels per source pixel
+  cv::Mat displayClean;      // pCleanMat resized to the display
+  std::vector<cv::Point> shownPoints; // marker positions currently rendered
+  bool needsRedraw = false;
 
   /************************** PRIVATE METHODS *********************************/
+  cv::Point toDisplay(const cv::Point_<T>& p) const
+  {
+    return cv::Point(cvRound(p.x * displayScale), cvRound(p.y * displayScale));
+  }
+  cv::Point_<T> toSource(int x, int y) const
+  {
+    x = std::max(0, std::min(x, displayClean.cols - 1));
+    y = std::max(0, std::min(y, displayClean.rows - 1));
+    return cv::Point_<T>(static_cast<T>(x / displayScale),
+                         static_cast<T>(y / displayScale));
+  }
+
+  // BUILD THE DISPLAY PROXY (ONCE PER FULL REDRAW, NEVER WHILE DRAGGING)
+  void prepareDisplay()
+  {
+    int longSide = std::max(pCleanMat->cols, pCleanMat->rows);
+    displayScale = longSide > maxDisplaySize ?
+                   static_cast<double>(maxDisplaySize) / longSide : 1.0;
+    if (displayScale < 1.0)
+      cv::resize(*pCleanMat, displayClean, cv::Size(), displayScale,
+                 displayScale, cv::INTER_AREA);
+    else
+      displayClean = *pCleanMat;
+  }
+
+  // AREA A MARKER (CIRCLE + LABEL) CAN COVER AROUND ITS CENTER
+  int markerMargin() const
+  {
+    int baseline = 0;
+    cv::Size label = cv::getTextSize("0", cv::FONT_HERSHEY_SIMPLEX, fontScale,
+                                     lineThickness, &baseline);
+    return std::max(pointRadius, std::max(label.width, label.height)) +
+           baseline + lineThickness + 2;
+  }
+
+  // RESTORE region FROM THE CLEAN PROXY AND REDRAW WHAT INTERSECTS IT.
+  // Drawing through an ROI header lets OpenCV clip every primitive.
+  void renderRegion(const cv::Rect& region)
+  {
+    cv::Mat roi = (*pDirtyMat)(region);
+    displayClean(region).copyTo(roi);
+    cv::Point offset(-region.x, -region.y);
+    std::vector<cv::Point> pts(4);
+    for (int i = 0; i < 4; ++i)
+      pts[i] = toDisplay(pPoints->at(i)) + offset;
+    for (int i = 0; i < 4; ++i)
+      cv::line(roi, pts[i], pts[(i+1)%4], BLUE, lineThickness);
+    for (int i = 0; i < 4; ++i)
+    {
+      cv::circle(roi, pts[i], pointRadius, BLUE, -1);
+      cv::putText(roi, std::to_string(i), pts[i], cv::FONT_HERSHEY_SIMPLEX,
+                  fontScale, GREEN, lineThickness);
+    }
+    int y_plus = 0;
+    for(auto& message : messages)
+    {
+      putText(roi, message, cv::Point(20, 30 + y_plus) + offset,
+              cv::FONT_HERSHEY_SIMPLEX, 0.8, GREEN, 2);
+      y_plus += 30;
+    }
+  }
+
   // GET DISTANCES BETWEEN MOUSE-CLICK AND EVERY OTHER POINT
   PointLoc getClosestPoint(int x, int y, float& minDist)
   {
     // RETURNS A VALUE FROM PointLoc enum BY DETERMINING CLOSEST POINT
-    // Also 'returns' dist as the minimum distance
+    // Also 'returns' dist as the minimum distance (display pixels)
     std::vector<float> distances(4);
-    distances[UPPER_LEFT]  = sqrt(std::pow(x-pPoints->at(UPPER_LEFT).x,2) +
-                                  std::pow(y-pPoints->at(UPPER_LEFT).y,2));
-    distances[UPPER_RIGHT] = sqrt(std::pow(x-pPoints->at(UPPER_RIGHT).x,2) +
-                                  std::pow(y-pPoints->at(UPPER_RIGHT).y,2));
-    distances[LOWER_RIGHT] = sqrt(std::pow(x-pPoints->at(LOWER_RIGHT).x,2) +
-                                  std::pow(y-pPoints->at(LOWER_RIGHT).y,2));
-    distances[LOWER_LEFT]  = sqrt(std::pow(x-pPoints->at(LOWER_LEFT).x,2) +
-                                  std::pow(y-pPoints->at(LOWER_LEFT).y,2));
+    for (int i = 0; i < 4; ++i)
+    {
+      cv::Point p = toDisplay(pPoints->at(i));
+      distances[i] = sqrt(std::pow(x-p.x,2) + std::pow(y-p.y,2));
+    }
 
     // ACQUIRE WHICH POINT IS CLOSEST TO MOUSE CLICK
     ptrdiff_t closestPtIdx = std::min_element(distances.cbegin(),
@@ -110,11 +181,11 @@ public:
   }
   CVPointMover_& operator=(const CVPointMover_<T>& src)
   {
-    if (!src.pPoints->empty())
+    if (src.pPoints && !src.pPoints->empty())
       pPoints = src.pPoints;
-    if (!src.pCleanMat->empty())
+    if (src.pCleanMat && !src.pCleanMat->empty())
       pCleanMat = src.pCleanMat;
-    if (!src.pDirtyMat->empty())
+    if (src.pDirtyMat)
       pDirtyMat = src.pDirtyMat;
     if(!src.winName.empty())
       winName = src.winName;
@@ -143,69 +214,107 @@ public:
   {
     return winName;
   }
+  void setMaxDisplaySize(int maxDisplaySize)
+  {
+    CVPointMover_::maxDisplaySize = maxDisplaySize;
+  }
   /**************************** PUBLIC METHODS ********************************/
-  // DRAW LINES TO FORM RECTANGLE
-  void drawLines(const std::list<std::string>& messages =
+  // DRAW LINES TO FORM RECTANGLE (FULL REDRAW OF THE DISPLAY PROXY)
+  void drawLines(const std::list<std::string>& msgs =
                         {"Press any 'q' to Extract","Drag circles to correct"})
   {
-    *pDirtyMat = pCleanMat->clone();
-    // PLOT LINES AND CIRCLES
-    for (int i=0; i<4; ++i)
+    if (!pPoints || pPoints->size() < 4 || !pCleanMat || pCleanMat->empty() ||
+        !pDirtyMat)
+      return;
+    messages = msgs;
+    prepareDisplay();
+    pDirtyMat->create(displayClean.size(), displayClean.type());
+    renderRegion(cv::Rect(0, 0, displayClean.cols, displayClean.rows));
+    shownPoints.resize(4);
+    for (int i = 0; i < 4; ++i)
+      shownPoints[i] = toDisplay(pPoints->at(i));
+    needsRedraw = false;
+    imshow(winName, *pDirtyMat);
+  }
+
+  // REDRAW ONLY AROUND THE EDGES THAT MOVED SINCE THE LAST FRAME.
+  // Returns whether anything was shown.
+  bool refresh()
+  {
+    if (!needsRedraw || shownPoints.size() != 4)
+      return false;
+    std::vector<cv::Point> affected;
+    for (int i = 0; i < 4; ++i)
     {
-      cv::line(*pDirtyMat, pPoints->at(i),
-               pPoints->at((i+1)%4), BLUE, 3);
-      cv::circle(*pDirtyMat, pPoints->at(i),
-                 pointRadius, BLUE,-1);
-      int fontScale = 2;
-      int thickness = 3;
-      int pxl = 100;
-      int y_plus = 0;
-      for(auto& message : messages)
+      cv::Point now = toDisplay(pPoints->at(i));
+      if (now == shownPoints[i])
+        continue;
+      // THE MOVED MARKER, OLD AND NEW, PLUS BOTH EDGES HINGED ON IT
+      affected.push_back(shownPoints[i]);
+      affected.push_back(now);
+      for (int n : {(i + 3) % 4, (i + 1) % 4})
       {
-        putText(*pDirtyMat, message, cv::Point(pxl,pxl+y_plus),
-                cv::FONT_HERSHEY_SIMPLEX,1.3, GREEN, 3);
-        y_plus+=60;
+        affected.push_back(shownPoints[n]);
+        affected.push_back(toDisplay(pPoints->at(n)));
       }
-      cv::putText(*pDirtyMat, std::to_string(i), pPoints->at(i),
-                  cv::FONT_HERSHEY_SIMPLEX, fontScale, GREEN, thickness);
-      imshow(winName, *pDirtyMat);
+      shownPoints[i] = now;
+    }
+    needsRedraw = false;
+    if (affected.empty())
+      return false;
+
+    int margin = markerMargin();
+    cv::Rect region = cv::boundingRect(affected);
+    region.x -= margin;
+    region.y -= margin;
+    region.width  += 2 * margin;
+    region.height += 2 * margin;
+    region &= cv::Rect(0, 0, displayClean.cols, displayClean.rows);
+    if (region.empty())
+      return false;
+    renderRegion(region);
+    imshow(winName, *pDirtyMat);
+    return true;
+  }
+
+  // PUMP highgui EVENTS UNTIL quitKey, SHOWING AT MOST ONE FRAME PER frameMs.
+  // Mouse moves arriving within one frame are coalesced into one redraw.
+  void runEventLoop(char quitKey = 'q', int frameMs = 16)
+  {
+    while (true)
+    {
+      int key = cv::waitKey(frameMs);
+      refresh();
+      if (static_cast<char>(key) == quitKey)
+        break;
     }
   }
 
   // MOUSE EVENT WRAPPER
   void mouseEventHandler(int event, int x, int y, int flags, void* data)
   {
-    static sptr<cv::Point_<T> > pActivePoint;
-    static PointLoc pointLoc;
-    static float minDist{};
-
+    float minDist{};
     switch (event)
     {
     case cv::EVENT_LBUTTONDOWN:
       // getClosestPoint returns the closest Point and the distance between the
       // clicked point and the nearest Point
       // Also check if within the bounds of radius
-      pointLoc = getClosestPoint(x,y, minDist);
+      activeLoc = getClosestPoint(x,y, minDist);
       if (minDist <= pointRadius * 5)
-      {
         btnStatus = LButtonEventStatus::Pressed;
-        pActivePoint = std::make_shared<cv::Point_<T>>(pPoints->at(pointLoc));
-      }
       break;
     case cv::EVENT_LBUTTONUP:
       btnStatus = LButtonEventStatus::Released;
-      pActivePoint = nullptr;
       break;
     case cv::EVENT_MOUSEMOVE:
+      // ONLY RECORD THE POSITION; refresh() DRAWS ONCE PER FRAME
       if (btnStatus == LButtonEventStatus::Pressed)
       {
-        cv::Mat tempMat = pCleanMat->clone();
-        pActivePoint->x = x;
-        pActivePoint->y = y;
-        pPoints->at(pointLoc).x = x;
-        pPoints->at(pointLoc).y = y;
-        drawLines();
+        pPoints->at(activeLoc) = toSource(x, y);
+        needsRedraw = true;
       }
+      break;
     default:
       break;
     }
@@ -0,0 +1,451 @@
+//
+// Fused post-warp binarization: illumination flattening, Sauvola threshold
+// and despeckling, packed 1 bit per pixel.
+//
+#include "DSBinarize.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+
+using namespace std;
+using namespace cv;
+
+static const int STRIP_ROWS = 32; // output rows per parallel work item
+// DARKER "BACKGROUNDS" ARE NOT PAPER; DIVIDING BY THEM ONLY AMPLIFIES NOISE
+static const float MIN_BACKGROUND = 24.0f;
+
+static inline int reflect101(int i, int n)
+{
+  return borderInterpolate(i, n, BORDER_REFLECT_101);
+}
+
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+// 16 BYTES -> 4 x 4 FLOATS
+static inline void expandToFloat(const v_uint8& v, v_float32 f[4])
+{
+  v_uint16 lo, hi;
+  v_expand(v, lo, hi);
+  v_uint32 a, b, c, d;
+  v_expand(lo, a, b);
+  v_expand(hi, c, d);
+  f[0] = v_cvt_f32(v_reinterpret_as_s32(a));
+  f[1] = v_cvt_f32(v_reinterpret_as_s32(b));
+  f[2] = v_cvt_f32(v_reinterpret_as_s32(c));
+  f[3] = v_cvt_f32(v_reinterpret_as_s32(d));
+}
+#endif
+
+// GRAY OF ONE PAGE ROW
+/******************************************************************************/
+static void grayRow(const Mat& page, int y, uchar* gray)
+{
+  if (page.channels() == 1)
+    memcpy(gray, page.ptr<uchar>(y), page.cols);
+  else
+  {
+    Mat dst(1, page.cols, CV_8U, gray);
+    cvtColor(page.row(y), dst, COLOR_BGR2GRAY);
+  }
+}
+
+// rowMax = max(rowMax, gray)
+static void maxRow(uchar* rowMax, const uchar* gray, int n)
+{
+  int i = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+  const int step = VTraits<v_uint8>::vlanes();
+  for (; i <= n - step; i += step)
+    v_store(rowMax + i, v_max(vx_load(rowMax + i), vx_load(gray + i)));
+#endif
+  for (; i < n; ++i)
+    rowMax[i] = max(rowMax[i], gray[i]);
+}
+
+// BACKGROUND: 255 / PAPER BRIGHTNESS ON A COARSE GRID
+/******************************************************************************/
+static Mat backgroundGains(const Mat& page, int cell)
+{
+  const int W = page.cols, H = page.rows;
+  const int gw = (W + cell - 1) / cell, gh = (H + cell - 1) / cell;
+  Mat grid(gh, gw, CV_8U);
+  parallel_for_(Range(0, gh), [&](const Range& range)
+  {
+    vector<uchar> gray(W), rowMax(W);
+    for (int gy = range.start; gy < range.end; ++gy)
+    {
+      fill(rowMax.begin(), rowMax.end(), 0);
+      for (int y = gy * cell; y < min(H, (gy + 1) * cell); ++y)
+      {
+        grayRow(page, y, gray.data());
+        maxRow(rowMax.data(), gray.data(), W);
+      }
+      uchar* g = grid.ptr<uchar>(gy);
+      for (int gx = 0; gx < gw; ++gx)
+        g[gx] = *max_element(rowMax.begin() + gx * cell,
+                             rowMax.begin() + min(W, (gx + 1) * cell));
+    }
+  });
+  // A SPECULAR SPECK MUST NOT SET A BLOCK'S PAPER BRIGHTNESS, AND A BLOCK
+  // COVERED BY A HEADING OR A FIGURE TAKES ITS BRIGHTEST NEIGHBOUR'S
+  medianBlur(grid, grid, 3);
+  dilate(grid, grid, getStructuringElement(MORPH_RECT, cv::Size(3, 3)));
+  Mat gains;
+  grid.convertTo(gains, CV_32F);
+  blur(gains, gains, cv::Size(3, 3));
+  for (int gy = 0; gy < gh; ++gy)
+  {
+    float* p = gains.ptr<float>(gy);
+    for (int gx = 0; gx < gw; ++gx)
+      p[gx] = 255.0f / max(p[gx], MIN_BACKGROUND);
+  }
+  return gains;
+}
+
+// flat = gray * gain, saturated
+static void flattenRow(const uchar* gray, const float* gain, int n,
+                       uchar* flat)
+{
+  int x = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+  const int step  = VTraits<v_uint8>::vlanes();
+  const int quart = VTraits<v_float32>::vlanes();
+  for (; x <= n - step; x += step)
+  {
+    v_float32 f[4];
+    expandToFloat(vx_load(gray + x), f);
+    v_int32 q[4];
+    for (int i = 0; i < 4; ++i)
+      q[i] = v_round(v_mul(f[i], vx_load(gain + x + i * quart)));
+    v_store(flat + x, v_pack_u(v_pack(q[0], q[1]), v_pack(q[2], q[3])));
+  }
+#endif
+  for (; x < n; ++x)
+    flat[x] = saturate_cast<uchar>(gray[x] * gain[x]);
+}
+
+// SAUVOLA WINDOW SUMS: colSum += add - sub, colSq += add^2 - sub^2
+/******************************************************************************/
+// Both stay within window * 255 (16 bit) and window * 255^2 (32 bit)
+static void slideWindowSums(ushort* colSum, unsigned* colSq, const uchar* add,
+                            const uchar* sub, int n)
+{
+  int i = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+  const int step  = VTraits<v_uint8>::vlanes();
+  const int half  = VTraits<v_uint16>::vlanes();
+  const int quart = VTraits<v_uint32>::vlanes();
+  for (; i <= n - step; i += step)
+  {
+    v_uint16 addLo, addHi, subLo, subHi;
+    v_expand(vx_load(add + i), addLo, addHi);
+    v_expand(vx_load(sub + i), subLo, subHi);
+    // ADD BEFORE SUBTRACTING: THE 16-BIT OPS SATURATE
+    v_store(colSum + i,
+            v_sub(v_add(vx_load(colSum + i), addLo), subLo));
+    v_store(colSum + i + half,
+            v_sub(v_add(vx_load(colSum + i + half), addHi), subHi));
+    v_uint32 add2[4], sub2[4];
+    v_mul_expand(addLo, addLo, add2[0], add2[1]);
+    v_mul_expand(addHi, addHi, add2[2], add2[3]);
+    v_mul_expand(subLo, subLo, sub2[0], sub2[1]);
+    v_mul_expand(subHi, subHi, sub2[2], sub2[3]);
+    for (int k = 0; k < 4; ++k)
+    {
+      unsigned* p = colSq + i + k * quart;
+      v_store(p, v_sub(v_add(vx_load(p), add2[k]), sub2[k]));
+    }
+  }
+#endif
+  for (; i < n; ++i)
+  {
+    colSum[i] = static_cast<ushort>(colSum[i] + add[i] - sub[i]);
+    colSq[i] += add[i] * add[i] - sub[i] * sub[i];
+  }
+}
+
+// SAUVOLA THRESHOLD OF ONE ROW
+/******************************************************************************/
+// prefSum / prefSq: running sums of the reflect-padded column sums, so the
+// window at x is pref[x + window] - pref[x]. They may wrap; the differences
+// (at most 127^2 * 255^2 < 2^31) don't. bin gets 1 for black.
+static void sauvolaRow(const unsigned* prefSum, const unsigned* prefSq,
+                       const uchar* flat, int n, int window, float k,
+                       float dynamicRange, uchar* bin)
+{
+  const float invArea   = 1.0f / static_cast<float>(window * window);
+  const float oneMinusK = 1.0f - k, kOverR = k / dynamicRange;
+  int x = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+  const int step  = VTraits<v_uint8>::vlanes();
+  const int quart = VTraits<v_float32>::vlanes();
+  const v_float32 vInvArea = vx_setall_f32(invArea);
+  const v_float32 vOneMinusK = vx_setall_f32(oneMinusK);
+  const v_float32 vKOverR = vx_setall_f32(kOverR);
+  const v_float32 zero = vx_setzero_f32();
+  auto windowSum = [window](const unsigned* pref, int i)
+  {
+    return v_cvt_f32(v_reinterpret_as_s32(
+      v_sub(vx_load(pref + i + window), vx_load(pref + i))));
+  };
+  for (; x <= n - step; x += step)
+  {
+    v_float32 f[4];
+    expandToFloat(vx_load(flat + x), f);
+    v_uint32 black[4];
+    for (int i = 0; i < 4; ++i)
+    {
+      int xi = x + i * quart;
+      v_float32 mean = v_mul(windowSum(prefSum, xi), vInvArea);
+      v_float32 var  = v_sub(v_mul(windowSum(prefSq, xi), vInvArea),
+                             v_mul(mean, mean));
+      v_float32 sd   = v_sqrt(v_max(var, zero));
+      v_float32 t    = v_mul(mean, v_add(vOneMinusK, v_mul(sd, vKOverR)));
+      black[i] = v_reinterpret_as_u32(v_ge(t, f[i]));
+    }
+    // ALL-ONES LANES SATURATE TO 0xFF THROUGH BOTH PACKS
+    v_uint8 mask = v_pack(v_pack(black[0], black[1]),
+                          v_pack(black[2], black[3]));
+    v_store(bin + x, v_and(mask, vx_setall_u8(1)));
+  }
+#endif
+  for (; x < n; ++x)
+  {
+    float mean = static_cast<float>(prefSum[x + window] - prefSum[x]) *
+                 invArea;
+    float var  = static_cast<float>(prefSq[x + window] - prefSq[x]) *
+                 invArea - mean * mean;
+    float t    = mean * (oneMinusK + sqrt(max(var, 0.0f)) * kOverR);
+    bin[x] = flat[x] <= t ? 1 : 0;
+  }
+}
+
+// DESPECKLE ONE ROW
+/******************************************************************************/
+// above / row / below are 0/1 rows with a white pixel before and after
+static void despeckleRow(const uchar* above, const uchar* row,
+                         const uchar* below, int n, int minNeighbours,
+                         uchar* out)
+{
+  int x = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+  const int step = VTraits<v_uint8>::vlanes();
+  const v_uint8 zero  = vx_setzero_u8(), one = vx_setall_u8(1);
+  const v_uint8 eight = vx_setall_u8(8);
+  const v_uint8 minN  = vx_setall_u8(saturate_cast<uchar>(minNeighbours));
+  for (; x <= n - step; x += step)
+  {
+    v_uint8 count = v_add(v_add(vx_load(above + x - 1), vx_load(above + x)),
+                          vx_load(above + x + 1));
+    count = v_add(count, v_add(vx_load(row + x - 1), vx_load(row + x + 1)));
+    count = v_add(count, v_add(v_add(vx_load(below + x - 1),
+                                     vx_load(below + x)),
+                               vx_load(below + x + 1)));
+    v_uint8 center = vx_load(row + x);
+    v_uint8 keepBlack = v_and(v_gt(center, zero), v_ge(count, minN));
+    v_uint8 fillWhite = v_and(v_eq(center, zero), v_eq(count, eight));
+    v_store(out + x, v_and(v_or(keepBlack, fillWhite), one));
+  }
+#endif
+  for (; x < n; ++x)
+  {
+    int count = above[x - 1] + above[x] + above[x + 1] + row[x - 1] +
+                row[x + 1] + below[x - 1] + below[x] + below[x + 1];
+    out[x] = row[x] ? (count >= minNeighbours ? 1 : 0) : (count == 8 ? 1 : 0);
+  }
+}
+
+// 0/1 PIXELS -> BITS, MSB FIRST
+static void packRow(const uchar* bin, int n, uchar* bits)
+{
+  int x = 0, j = 0;
+  for (; x <= n - 8; x += 8, ++j)
+    bits[j] = static_cast<uchar>(bin[x] << 7 | bin[x + 1] << 6 |
+                                 bin[x + 2] << 5 | bin[x + 3] << 4 |
+                                 bin[x + 4] << 3 | bin[x + 5] << 2 |
+                                 bin[x + 6] << 1 | bin[x + 7]);
+  if (x < n)
+  {
+    uchar last = 0;
+    for (int b = 0; x + b < n; ++b)
+      last |= static_cast<uchar>(bin[x + b] << (7 - b));
+    bits[j] = last;
+  }
+}
+
+// BINARIZE PAGE
+/******************************************************************************/
+void binarizePage(const Mat& page, BinaryPage& out,
+                  const BinarizeOptions& opts)
+{
+  CV_Assert(page.type() == CV_8UC3 || page.type() == CV_8UC1);
+  CV_Assert(opts.window >= 3 && opts.window <= 127 && opts.window % 2 == 1);
+  const int W = page.cols, H = page.rows, r = opts.window / 2;
+  out.width = W;
+  out.bits.create(H, (W + 7) / 8, CV_8U);
+  if (page.empty())
+    return;
+
+  // BILINEAR LOOKUP INTO THE BACKGROUND GRID, GRID CELLS CENTRED ON BLOCKS
+  const int cell = opts.backgroundCell;
+  Mat gains;
+  vector<int> gx0(W), gx1(W);
+  vector<float> gfx(W);
+  if (cell > 0)
+  {
+    gains = backgroundGains(page, cell);
+    for (int x = 0; x < W; ++x)
+    {
+      float g = min(max((x + 0.5f) / cell - 0.5f, 0.0f),
+                    static_cast<float>(gains.cols - 1));
+      gx0[x] = static_cast<int>(g);
+      gx1[x] = min(gx0[x] + 1, gains.cols - 1);
+      gfx[x] = g - gx0[x];
+    }
+  }
+
+  const int nStrips = (H + STRIP_ROWS - 1) / STRIP_ROWS;
+  parallel_for_(Range(0, nStrips), [&](const Range& range)
+  {
+    vector<uchar> gray(W), flatBuf, binBuf, cleaned(W);
+    vector<float> gain(W), gridRow(gains.cols);
+    vector<ushort> colSum(W + 2 * r);
+    vector<unsigned> colSq(W + 2 * r), prefSum(W + 2 * r + 1),
+                     prefSq(W + 2 * r + 1);
+    const vector<uchar> zeros(W + 2, 0);
+
+    // ONE FLATTENED PAGE ROW
+    auto flatRow = [&](int y, uchar* dst)
+    {
+      if (cell <= 0)
+      {
+        grayRow(page, y, dst);
+        return;
+      }
+      grayRow(page, y, gray.data());
+      float g = min(max((y + 0.5f) / cell - 0.5f, 0.0f),
+                    static_cast<float>(gains.rows - 1));
+      int g0 = static_cast<int>(g), g1 = min(g0 + 1, gains.rows - 1);
+      float fy = g - g0;
+      const float* a = gains.ptr<float>(g0);
+      const float* b = gains.ptr<float>(g1);
+      for (int i = 0; i < gains.cols; ++i)
+        gridRow[i] = a[i] + (b[i] - a[i]) * fy;
+      for (int x = 0; x < W; ++x)
+        gain[x] = gridRow[gx0[x]] +
+                  (gridRow[gx1[x]] - gridRow[gx0[x]]) * gfx[x];
+      flattenRow(gray.data(), gain.data(), W, dst);
+    };
+
+    for (int strip = range.start; strip < range.end; ++strip)
+    {
+      const int y0 = strip * STRIP_ROWS, y1 = min(H, y0 + STRIP_ROWS);
+      // THRESHOLDED ROWS: THE STRIP PLUS ONE ROW EACH SIDE FOR DESPECKLING;
+      // FLATTENED ROWS: THOSE PLUS THE WINDOW'S HALO (RECOMPUTED, AS IN
+      // fusedPreprocess, RATHER THAN SHARED WITH THE NEIGHBOURING STRIPS)
+      const int b0 = max(0, y0 - 1), b1 = min(H, y1 + 1);
+      const int f0 = b0 - r, nFlat = b1 - b0 + 2 * r;
+      flatBuf.resize(static_cast<size_t>(nFlat) * W);
+      for (int i = 0; i < nFlat; ++i)
+        flatRow(reflect101(f0 + i, H), flatBuf.data() + i * W);
+      auto flat = [&](int y) { return flatBuf.data() + (y - f0) * W; };
+      binBuf.assign(static_cast<size_t>(b1 - b0) * (W + 2), 0);
+      auto binRow = [&](int y)
+      {
+        return binBuf.data() + (y - b0) * (W + 2) + 1;
+      };
+
+      // VERTICAL WINDOW AS RUNNING COLUMN SUMS, STORED AFTER A REFLECTED PAD
+      ushort* sums = colSum.data() + r;
+      unsigned* sqs = colSq.data() + r;
+      fill(colSum.begin(), colSum.end(), 0);
+      fill(colSq.begin(), colSq.end(), 0u);
+      for (int k = -r; k <= r; ++k)
+        slideWindowSums(sums, sqs, flat(b0 + k), zeros.data(), W);
+      for (int y = b0; y < b1; ++y)
+      {
+        if (y > b0)
+          slideWindowSums(sums, sqs, flat(y + r), flat(y - r - 1), W);
+        for (int p = 1; p <= r; ++p)
+        {
+          int left = reflect101(-p, W), right = reflect101(W - 1 + p, W);
+          sums[-p] = sums[left];
+          sqs[-p]  = sqs[left];
+          sums[W - 1 + p] = sums[right];
+          sqs[W - 1 + p]  = sqs[right];
+        }
+        // HORIZONTAL WINDOW FROM RUNNING SUMS (UNSIGNED, SO WRAPPING IS SAFE)
+        for (int i = 0; i < W + 2 * r; ++i)
+        {
+          prefSum[i + 1] = prefSum[i] + colSum[i];
+          prefSq[i + 1]  = prefSq[i] + colSq[i];
+        }
+        sauvolaRow(prefSum.data(), prefSq.data(), flat(y), W, opts.window,
+                   opts.k, opts.dynamicRange, binRow(y));
+      }
+
+      // DESPECKLE AND PACK; ROWS OFF THE PAGE ARE WHITE
+      for (int y = y0; y < y1; ++y)
+      {
+        const uchar* row = binRow(y);
+        if (opts.despeckle > 0)
+        {
+          const uchar* above = y > 0 ? binRow(y - 1) : zeros.data() + 1;
+          const uchar* below = y + 1 < H ? binRow(y + 1) : zeros.data() + 1;
+          despeckleRow(above, row, below, W, opts.despeckle, cleaned.data());
+          row = cleaned.data();
+        }
+        packRow(row, W, out.bits.ptr<uchar>(y));
+      }
+    }
+  });
+}
+
+// UNPACK
+/******************************************************************************/
+void unpackBinaryPage(const BinaryPage& page, Mat& bw)
+{
+  bw.create(page.size(), CV_8U);
+  for (int y = 0; y < bw.rows; ++y)
+  {
+    const uchar* bits = page.bits.ptr<uchar>(y);
+    uchar* dst = bw.ptr<uchar>(y);
+    for (int x = 0; x < page.width; ++x)
+      dst[x] = (bits[x >> 3] >> (7 - (x & 7))) & 1 ? 0 : 255;
+  }
+}
+
+// PBM (P4)
+/******************************************************************************/
+bool encodePbm(const BinaryPage& page, vector<uchar>& out)
+{
+  out.clear();
+  if (page.empty())
+    return false;
+  string header = "P4\n" + to_string(page.width) + " " +
+                  to_string(page.bits.rows) + "\n";
+  size_t rowBytes = page.bits.cols;
+  out.reserve(header.size() + rowBytes * page.bits.rows);
+  out.insert(out.end(), header.begin(), header.end());
+  for (int y = 0; y < page.bits.rows; ++y)
+    out.insert(out.end(), page.bits.ptr<uchar>(y),
+               page.bits.ptr<uchar>(y) + rowBytes);
+  return true;
+}
+
+bool writePbm(const string& path, const BinaryPage& page)
+{
+  if (page.empty())
+    return false;
+  ofstream file(path, ios::binary | ios::trunc);
+  file << "P4\n" << page.width << " " << page.bits.rows << "\n";
+  size_t rowBytes = page.bits.cols;
+  for (int y = 0; y < page.bits.rows; ++y)
+    file.write(reinterpret_cast<const char*>(page.bits.ptr<uchar>(y)),
+               static_cast<streamsize>(rowBytes));
+  file.close();
+  return !file.fail();
+}
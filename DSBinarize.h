@@ -0,0 +1,63 @@
+//
+// Fused post-warp binarization: illumination flattening, Sauvola threshold
+// and despeckling, packed 1 bit per pixel.
+//
+
+#ifndef DOCUMENTSCANNER_DSBINARIZE_H
+#define DOCUMENTSCANNER_DSBINARIZE_H
+
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+struct BinarizeOptions
+{
+  // Sauvola: black where flat <= mean * (1 + k * (stddev / dynamicRange - 1))
+  // over a window x window neighbourhood (odd, 3 - 127 px)
+  int window = 31;
+  float k = 0.2f;
+  float dynamicRange = 128.0f;
+  // Illumination flattening: gray is divided by the page background, taken
+  // as the brightest gray of every backgroundCell x backgroundCell block,
+  // cleaned up on that coarse grid and interpolated back. 0 = off.
+  int backgroundCell = 32;
+  // Black pixels with fewer black 8-neighbours than this turn white, and
+  // white pixels with 8 black neighbours turn black. 0 = off.
+  int despeckle = 1;
+};
+
+// A 1-bit page in PBM (P4) layout: bits is rows x ceil(width / 8) CV_8U,
+// most significant bit first, 1 = black, each row padded to a whole byte.
+// A 24th of the memory of the same page in BGR.
+struct BinaryPage
+{
+  cv::Mat bits;
+  int width = 0;
+
+  [[nodiscard]] bool empty() const
+  {
+    return bits.empty();
+  }
+  [[nodiscard]] cv::Size size() const
+  {
+    return {width, bits.rows};
+  }
+};
+
+// One pass over page (CV_8UC3 or CV_8UC1) in strips of rows, in parallel:
+// gray, flattening, the Sauvola window sums, the threshold, despeckling and
+// packing all run on a strip while its rows are in cache. Only the coarse
+// background grid is computed over the whole page first. out.bits is
+// reallocated only when the page size changes.
+void binarizePage(const cv::Mat& page, BinaryPage& out,
+                  const BinarizeOptions& opts = BinarizeOptions());
+
+// 0 (black) / 255 (white) CV_8U, for encoders without a 1-bit input
+void unpackBinaryPage(const BinaryPage& page, cv::Mat& bw);
+
+// P4 PBM, written straight from the packed rows
+bool encodePbm(const BinaryPage& page, std::vector<uchar>& out);
+bool writePbm(const std::string& path, const BinaryPage& page);
+
+#endif //DOCUMENTSCANNER_DSBINARIZE_H
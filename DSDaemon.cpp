@@ -0,0 +1,451 @@
+//
+// Long-lived scanner service over a Unix domain socket, and its client.
+//
+#include "DSDaemon.h"
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <list>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace cv;
+namespace fs = std::filesystem;
+
+static const char REQUEST_MAGIC[4]  = {'D', 'S', 'R', 'Q'};
+static const char RESPONSE_MAGIC[4] = {'D', 'S', 'R', 'S'};
+// LARGER FRAMES ARE A BROKEN OR HOSTILE PEER, NOT A SCAN
+static const uint64_t MAX_FRAME_BYTES = 1ull << 30;
+static const int POLL_MS = 200;
+
+// FRAMING
+/******************************************************************************/
+static bool readAll(int fd, void* data, size_t size)
+{
+  auto* p = static_cast<char*>(data);
+  while (size > 0)
+  {
+    ssize_t n = ::read(fd, p, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+static bool writeAll(int fd, const void* data, size_t size)
+{
+  const auto* p = static_cast<const char*>(data);
+  while (size > 0)
+  {
+    ssize_t n = ::write(fd, p, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+template <typename T>
+static bool readValue(int fd, T& value)
+{
+  return readAll(fd, &value, sizeof(T));
+}
+
+template <typename T>
+static bool writeValue(int fd, const T& value)
+{
+  return writeAll(fd, &value, sizeof(T));
+}
+
+template <typename Len, typename Buffer>
+static bool readBlob(int fd, Buffer& buffer)
+{
+  Len len = 0;
+  if (!readValue(fd, len) || len > MAX_FRAME_BYTES)
+    return false;
+  buffer.resize(len);
+  return len == 0 || readAll(fd, &buffer[0], len);
+}
+
+template <typename Len, typename Buffer>
+static bool writeBlob(int fd, const Buffer& buffer)
+{
+  Len len = static_cast<Len>(buffer.size());
+  return writeValue(fd, len) &&
+         (len == 0 || writeAll(fd, buffer.data(), len));
+}
+
+static bool readRequest(int fd, DaemonRequest& request)
+{
+  char magic[4];
+  return readAll(fd, magic, 4) && memcmp(magic, REQUEST_MAGIC, 4) == 0 &&
+         readValue(fd, request.flags) &&
+         readBlob<uint32_t>(fd, request.ext) &&
+         readBlob<uint64_t>(fd, request.payload);
+}
+
+static bool writeRequest(int fd, const DaemonRequest& request)
+{
+  return writeAll(fd, REQUEST_MAGIC, 4) && writeValue(fd, request.flags) &&
+         writeBlob<uint32_t>(fd, request.ext) &&
+         writeBlob<uint64_t>(fd, request.payload);
+}
+
+static bool readResponse(int fd, DaemonResponse& response)
+{
+  char magic[4];
+  float xy[8];
+  uint8_t degraded = 0;
+  if (!readAll(fd, magic, 4) || memcmp(magic, RESPONSE_MAGIC, 4) != 0 ||
+      !readValue(fd, response.status) || !readValue(fd, degraded) ||
+      !readAll(fd, xy, sizeof(xy)) ||
+      !readValue(fd, response.latencyMs) ||
+      !readBlob<uint32_t>(fd, response.error) ||
+      !readBlob<uint64_t>(fd, response.image))
+    return false;
+  response.degraded = degraded != 0;
+  response.corners.clear();
+  if (response.status == 0)
+    for (int i = 0; i < 8; i += 2)
+      response.corners.emplace_back(xy[i], xy[i + 1]);
+  return true;
+}
+
+static bool writeResponse(int fd, const DaemonResponse& response)
+{
+  float xy[8] = {};
+  for (size_t i = 0; i < response.corners.size() && i < 4; ++i)
+  {
+    xy[2 * i]     = response.corners[i].x;
+    xy[2 * i + 1] = response.corners[i].y;
+  }
+  uint8_t degraded = response.degraded ? 1 : 0;
+  return writeAll(fd, RESPONSE_MAGIC, 4) && writeValue(fd, response.status) &&
+         writeValue(fd, degraded) && writeAll(fd, xy, sizeof(xy)) &&
+         writeValue(fd, response.latencyMs) &&
+         writeBlob<uint32_t>(fd, response.error) &&
+         writeBlob<uint64_t>(fd, response.image);
+}
+
+static bool socketAddress(const string& path, sockaddr_un& addr)
+{
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(addr.sun_path))
+    return false;
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  return true;
+}
+
+/************************ CONSTRUCTOR ***************************************/
+static unsigned int resolveScanners(unsigned int n)
+{
+  return n > 0 ? n : max(1u, thread::hardware_concurrency());
+}
+
+ScannerDaemon::ScannerDaemon(DSOptions opts, DaemonOptions daemonOpts) :
+  options(std::move(opts)), daemonOptions(daemonOpts),
+  freeScanners(resolveScanners(daemonOpts.numScanners))
+{
+  // A DAEMON NEVER OPENS WINDOWS
+  options.headless = true;
+  daemonOptions.numScanners = resolveScanners(daemonOptions.numScanners);
+  for (unsigned int i = 0; i < daemonOptions.numScanners; ++i)
+  {
+    scanners.push_back(make_unique<DocumentScanner>(options));
+    freeScanners.push(scanners.back().get());
+  }
+}
+
+ScannerDaemon::~ScannerDaemon()
+{
+  stop();
+}
+
+/***************************** GETTERS & SETTERS ******************************/
+uint64_t ScannerDaemon::getNumRequests() const
+{
+  return numRequests;
+}
+
+// ONLY THE FLAG: A SIGNAL HANDLER MAY NOT TAKE LOCKS. THE ACCEPT LOOP SEES
+// IT WITHIN POLL_MS AND CLOSES freeScanners
+void ScannerDaemon::stop()
+{
+  stopping = true;
+}
+
+// WARM UP: ONE SYNTHETIC PAGE THROUGH EVERY SCANNER
+/******************************************************************************/
+void ScannerDaemon::warmUpScanners()
+{
+  Mat page(1200, 1600, CV_8UC3, Scalar(60, 60, 60));
+  vector<cv::Point> quad = {
+    cv::Point(300, 150), cv::Point(1250, 220), cv::Point(1300, 1050),
+    cv::Point(250, 1000)
+  };
+  fillConvexPoly(page, quad, Scalar(235, 235, 235));
+  for (auto& ds : scanners)
+  {
+    if (stopping)
+      return;
+    // THE SYNTHETIC PAGE MUST NOT BECOME THE STATION'S GRABCUT MODEL, A
+    // CACHED RESULT OR THE FALLBACK QUAD OF THE FIRST REAL REQUEST
+    ds->setGrabCutModel(nullptr);
+    ds->setResultCache(nullptr);
+    try
+    {
+      ds->reset(page);
+      ds->runDetection();
+      ds->findCorners();
+      ds->performFindHomography();
+    }
+    catch (const exception&)
+    {
+      // A FAILED WARM-UP ONLY MEANS A COLD FIRST REQUEST
+    }
+    ds->clearHistory();
+    ds->setGrabCutModel(options.grabCutModel);
+    ds->setResultCache(options.resultCache);
+  }
+}
+
+// SERVE: ACCEPT LOOP
+/******************************************************************************/
+bool ScannerDaemon::serve(const string& socketPath)
+{
+  // CLEARED BEFORE THE (SLOW) WARM-UP, SO A STOP DURING IT IS KEPT
+  stopping = false;
+  freeScanners.reopen();
+  // A CLIENT HANGING UP MID-REPLY IS A WRITE ERROR, NOT A DEAD DAEMON
+  signal(SIGPIPE, SIG_IGN);
+  sockaddr_un addr{};
+  if (!socketAddress(socketPath, addr))
+    return false;
+  listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listenFd < 0)
+    return false;
+  ::unlink(socketPath.c_str());
+  if (::bind(listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+      ::listen(listenFd, 64) != 0)
+  {
+    ::close(listenFd);
+    listenFd = -1;
+    return false;
+  }
+  if (daemonOptions.warmUp)
+    warmUpScanners();
+
+  struct Connection
+  {
+    thread worker;
+    shared_ptr<atomic<bool>> done;
+  };
+  list<Connection> connections;
+  while (!stopping)
+  {
+    // REAP FINISHED CONNECTIONS SO A LONG-LIVED DAEMON DOESN'T ACCUMULATE
+    for (auto it = connections.begin(); it != connections.end();)
+      if (*it->done)
+      {
+        it->worker.join();
+        it = connections.erase(it);
+      }
+      else
+        ++it;
+
+    pollfd pfd{listenFd, POLLIN, 0};
+    if (::poll(&pfd, 1, POLL_MS) <= 0)
+      continue;
+    int fd = ::accept(listenFd, nullptr, nullptr);
+    if (fd < 0)
+      continue;
+    auto done = make_shared<atomic<bool>>(false);
+    connections.push_back({thread([this, fd, done]() {
+      serveConnection(fd);
+      ::close(fd);
+      *done = true;
+    }), done});
+  }
+
+  // REQUESTS STILL WAITING FOR A SCANNER FAIL INSTEAD OF BLOCKING
+  freeScanners.close();
+  ::close(listenFd);
+  listenFd = -1;
+  ::unlink(socketPath.c_str());
+  for (auto& connection : connections)
+    connection.worker.join();
+  return true;
+}
+
+// SERVE CONNECTION: REQUESTS UNTIL THE CLIENT HANGS UP
+/******************************************************************************/
+void ScannerDaemon::serveConnection(int fd)
+{
+  DaemonRequest request;
+  while (!stopping)
+  {
+    // IDLE CONNECTIONS MUST NOT HOLD UP A SHUTDOWN
+    pollfd pfd{fd, POLLIN, 0};
+    int ready = ::poll(&pfd, 1, POLL_MS);
+    if (ready == 0)
+      continue;
+    if (ready < 0 || !readRequest(fd, request))
+      return;
+    if (request.flags & REQ_SHUTDOWN)
+    {
+      DaemonResponse response;
+      response.status = 0;
+      writeResponse(fd, response);
+      stop();
+      return;
+    }
+    if (!writeResponse(fd, handle(request)))
+      return;
+  }
+}
+
+// RESOLVE PATH: a REQ_PATH payload, only if it lies under pathRoot
+/******************************************************************************/
+// Both sides canonical (symlinks and ".." resolved) before the prefix test,
+// so neither can lead outside the root.
+bool ScannerDaemon::resolvePath(const string& requested, string& resolved) const
+{
+  if (daemonOptions.pathRoot.empty())
+    return false;
+  error_code ec;
+  fs::path root = fs::canonical(daemonOptions.pathRoot, ec);
+  if (ec)
+    return false;
+  fs::path file = fs::canonical(root / requested, ec);
+  if (ec)
+    return false;
+  auto rel = mismatch(root.begin(), root.end(), file.begin(), file.end());
+  if (rel.first != root.end())
+    return false;
+  resolved = file.string();
+  return true;
+}
+
+// HANDLE ONE SCAN REQUEST ON A WARM SCANNER
+/******************************************************************************/
+DaemonResponse ScannerDaemon::handle(const DaemonRequest& request)
+{
+  auto start = chrono::steady_clock::now();
+  uint64_t id = ++numRequests;
+  DaemonResponse response;
+  string source = (request.flags & REQ_PATH) ?
+                  string(request.payload.begin(), request.payload.end()) :
+                  "<" + to_string(request.payload.size()) + " bytes>";
+
+  string degradedReason, path;
+  if ((request.flags & REQ_PATH) && !resolvePath(source, path))
+  {
+    response.status = 1;
+    response.error  = "path not under the daemon's root: " + source;
+    return response;
+  }
+  DocumentScanner* ds = nullptr;
+  if (stopping || !freeScanners.pop(ds))
+  {
+    response.error = "daemon is shutting down";
+    return response;
+  }
+  try
+  {
+    if (request.flags & REQ_PATH)
+      ds->reset(path);
+    else
+      // DECODED STRAIGHT FROM THE REQUEST BUFFER, WHICH OUTLIVES THE SCAN
+      ds->reset(request.payload.data(), request.payload.size());
+    if (!ds->restoreCachedResult())
+    {
+      ds->runDetection();
+      ds->findCorners();
+    }
+    if (!(request.flags & REQ_CORNERS_ONLY))
+    {
+      ds->performFindHomography();
+      if (options.binarize)
+        ds->binarize();
+      if (!ds->encodeFinalImg(response.image,
+                              request.ext.empty() ? ".jpg" : request.ext))
+        throw runtime_error("could not encode " + request.ext);
+    }
+    response.corners  = ds->fullResCorners();
+    response.degraded = ds->isDegraded();
+    degradedReason    = ds->getDegradedReason();
+    response.status   = 0;
+  }
+  catch (const exception& exp)
+  {
+    response.status = 1;
+    response.error  = exp.what();
+  }
+  freeScanners.push(ds);
+
+  response.latencyMs = chrono::duration<double, milli>(
+    chrono::steady_clock::now() - start).count();
+  if (daemonOptions.logRequests)
+  {
+    lock_guard<mutex> lock(logMutex);
+    cout << "#" << id << " " << source << " "
+         << (response.status != 0 ? response.error :
+             response.degraded ? "degraded: " + degradedReason : "ok")
+         << " "
+         << response.latencyMs << " ms" << endl;
+  }
+  return response;
+}
+
+/************************ CLIENT ********************************************/
+ScannerClient::~ScannerClient()
+{
+  close();
+}
+
+bool ScannerClient::connect(const string& socketPath)
+{
+  close();
+  sockaddr_un addr{};
+  if (!socketAddress(socketPath, addr))
+    return false;
+  fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return false;
+  if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+  {
+    close();
+    return false;
+  }
+  return true;
+}
+
+void ScannerClient::close()
+{
+  if (fd >= 0)
+    ::close(fd);
+  fd = -1;
+}
+
+bool ScannerClient::send(const DaemonRequest& request,
+                         DaemonResponse& response)
+{
+  signal(SIGPIPE, SIG_IGN);
+  return fd >= 0 && writeRequest(fd, request) && readResponse(fd, response);
+}
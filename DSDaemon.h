@@ -0,0 +1,128 @@
+//
+// Long-lived scanner service over a Unix domain socket, and its client.
+//
+
+#ifndef DOCUMENTSCANNER_DSDAEMON_H
+#define DOCUMENTSCANNER_DSDAEMON_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "DocumentScanner.h"
+#include "DSPipeline.h"
+
+// WIRE FORMAT (host byte order; the socket never leaves the machine)
+//   request   "DSRQ" u32 flags, u32 extLen, ext, u64 payloadLen, payload
+//   response  "DSRS" i32 status, u8 degraded, f32 corners[8], f64 latencyMs,
+//             u32 errorLen, error, u64 imageLen, image
+// payload is a path (REQ_PATH) or encoded image bytes; ext (".jpg", ".png",
+// ...) picks the response encoding. status 0 is success.
+enum DaemonRequestFlags : uint32_t
+{
+  REQ_PATH         = 1u << 0, // payload is a file path on the daemon's side,
+                              // under DaemonOptions::pathRoot
+  REQ_CORNERS_ONLY = 1u << 1, // skip the warp; corners only
+  REQ_SHUTDOWN     = 1u << 2  // stop accepting; in-flight requests finish
+};
+
+struct DaemonRequest
+{
+  uint32_t flags = 0;
+  std::string ext = ".jpg";
+  std::vector<uchar> payload;
+};
+
+struct DaemonResponse
+{
+  int32_t status = -1;
+  // Corners came from a fallback (DSOptions::latencyBudgetMs ran out)
+  bool degraded = false;
+  // Full-resolution corners, CW from the upper left
+  std::vector<cv::Point2f> corners;
+  // Server-side time from the request being read to the reply being ready
+  double latencyMs = 0.0;
+  std::string error;
+  std::vector<uchar> image;
+};
+
+struct DaemonOptions
+{
+  // Warm scanners (and so concurrent scans); 0 = hardware threads
+  unsigned int numScanners = 0;
+  // Scan a synthetic page on every scanner at startup, so the first real
+  // request pays no OpenCV initialization or first-touch allocation
+  bool warmUp = true;
+  // Print one line per request with its latency
+  bool logRequests = true;
+  // REQ_PATH requests may only read files under this directory (symlinks
+  // resolved); empty refuses every REQ_PATH request, so a client that can
+  // connect cannot make the daemon read arbitrary files
+  std::string pathRoot;
+};
+
+// Every scanner and its pooled buffers stay resident between requests. Each
+// connection is served on its own thread and may send any number of
+// requests; requests on different connections run concurrently, up to
+// numScanners at a time.
+class ScannerDaemon
+{
+private:
+  DSOptions options;
+  DaemonOptions daemonOptions;
+  std::vector<std::unique_ptr<DocumentScanner>> scanners;
+  BoundedQueue<DocumentScanner*> freeScanners;
+  std::atomic<bool> stopping{false};
+  std::atomic<uint64_t> numRequests{0};
+  std::mutex logMutex;
+  int listenFd = -1;
+
+  /******************************* PRIVATE METHODS ****************************/
+  void serveConnection(int fd);
+  DaemonResponse handle(const DaemonRequest& request);
+  bool resolvePath(const std::string& requested, std::string& resolved) const;
+  void warmUpScanners();
+
+public:
+  /****************************** CONSTRUCTORS ********************************/
+  explicit ScannerDaemon(DSOptions opts = DSOptions(),
+                         DaemonOptions daemonOpts = DaemonOptions());
+  ~ScannerDaemon();
+
+  /**************************** SETTERS & GETTERS *****************************/
+  [[nodiscard]] uint64_t getNumRequests() const;
+
+  /*************************** PUBLIC METHODS *********************************/
+  // Listens on socketPath (replacing a stale socket file) until stop() or a
+  // REQ_SHUTDOWN request; returns false if the socket cannot be bound
+  bool serve(const std::string& socketPath);
+  // Safe from any thread or a signal handler. Requests still waiting for a
+  // scanner fail with "daemon is shutting down".
+  void stop();
+};
+
+// Blocking client for one connection; not thread-safe, open one per thread
+class ScannerClient
+{
+private:
+  int fd = -1;
+
+public:
+  /****************************** CONSTRUCTORS ********************************/
+  ScannerClient() = default;
+  ~ScannerClient();
+  ScannerClient(const ScannerClient&) = delete;
+  ScannerClient& operator=(const ScannerClient&) = delete;
+
+  /*************************** PUBLIC METHODS *********************************/
+  bool connect(const std::string& socketPath);
+  void close();
+  // False on a transport error; scan errors come back in response.status
+  bool send(const DaemonRequest& request, DaemonResponse& response);
+};
+
+#endif //DOCUMENTSCANNER_DSDAEMON_H
@@ -0,0 +1,70 @@
+//
+// Per-document latency budget and cancellation token.
+//
+
+#ifndef DOCUMENTSCANNER_DSDEADLINE_H
+#define DOCUMENTSCANNER_DSDEADLINE_H
+
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+
+#include "DSTrace.h"
+
+// Copies share one cancellation flag, so a token handed to another thread
+// (a request handler, a watchdog) can cancel the scan that owns it. Expiry
+// is checked against the wall clock; cancellation is immediate.
+class Deadline
+{
+private:
+  std::shared_ptr<std::atomic<bool>> cancelled =
+    std::make_shared<std::atomic<bool>>(false);
+  int64_t deadlineUs = 0; // 0 = no time limit
+
+public:
+  /****************************** CONSTRUCTORS ********************************/
+  Deadline() = default;
+  // ms <= 0 gives a token without a time limit
+  static Deadline after(double ms)
+  {
+    Deadline d;
+    if (ms > 0.0)
+      d.deadlineUs = StageTracer::wallNowUs() + static_cast<int64_t>(ms * 1000);
+    return d;
+  }
+
+  /**************************** SETTERS & GETTERS *****************************/
+  [[nodiscard]] bool hasLimit() const
+  {
+    return deadlineUs > 0;
+  }
+  [[nodiscard]] bool isCancelled() const
+  {
+    return *cancelled;
+  }
+  // Cancelled, or past the deadline
+  [[nodiscard]] bool expired() const
+  {
+    return *cancelled ||
+           (deadlineUs > 0 && StageTracer::wallNowUs() >= deadlineUs);
+  }
+  // Infinity without a limit, 0 once expired
+  [[nodiscard]] double remainingMs() const
+  {
+    if (*cancelled)
+      return 0.0;
+    if (deadlineUs == 0)
+      return std::numeric_limits<double>::infinity();
+    int64_t left = deadlineUs - StageTracer::wallNowUs();
+    return left > 0 ? left / 1000.0 : 0.0;
+  }
+
+  /*************************** PUBLIC METHODS *********************************/
+  void cancel()
+  {
+    *cancelled = true;
+  }
+};
+
+#endif //DOCUMENTSCANNER_DSDEADLINE_H
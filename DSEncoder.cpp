@@ -0,0 +1,536 @@
+//
+// Page output: JPEG, PNG, WebP and Group-4 TIFF with quality and size-budget
+// controls, and a per-page report of what the encode cost.
+//
+#include "DSEncoder.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+
+#include <opencv2/imgcodecs.hpp>
+
+using namespace std;
+using namespace cv;
+
+// FORMATS
+/******************************************************************************/
+OutputFormat outputFormat(const string& pathOrExt)
+{
+  size_t dot = pathOrExt.find_last_of('.');
+  string ext = dot == string::npos ? pathOrExt : pathOrExt.substr(dot + 1);
+  transform(ext.begin(), ext.end(), ext.begin(),
+            [](unsigned char c) { return tolower(c); });
+  if (ext == "jpg" || ext == "jpeg" || ext == "jpe")
+    return OutputFormat::JPEG;
+  if (ext == "png")
+    return OutputFormat::PNG;
+  if (ext == "webp")
+    return OutputFormat::WEBP;
+  if (ext == "tif" || ext == "tiff")
+    return OutputFormat::TIFF_G4;
+  if (ext == "pbm")
+    return OutputFormat::PBM;
+  return OutputFormat::OTHER;
+}
+
+string outputFormatToString(OutputFormat format)
+{
+  switch (format)
+  {
+  case OutputFormat::JPEG:
+    return "JPEG";
+  case OutputFormat::PNG:
+    return "PNG";
+  case OutputFormat::WEBP:
+    return "WebP";
+  case OutputFormat::TIFF_G4:
+    return "TIFF G4";
+  case OutputFormat::PBM:
+    return "PBM";
+  default:
+    return "Other";
+  }
+}
+
+// CCITT T.6 CODE TABLES (ITU-T T.4 TABLES 2 AND 3), AS WRITTEN IN THE STANDARD
+/******************************************************************************/
+namespace
+{
+const char* const WHITE_TERMINATING[64] = {
+  "00110101", "000111", "0111", "1000", "1011", "1100", "1110", "1111",
+  "10011", "10100", "00111", "01000", "001000", "000011", "110100",
+  "110101", "101010", "101011", "0100111", "0001100", "0001000", "0010111",
+  "0000011", "0000100", "0101000", "0101011", "0010011", "0100100",
+  "0011000", "00000010", "00000011", "00011010", "00011011", "00010010",
+  "00010011", "00010100", "00010101", "00010110", "00010111", "00101000",
+  "00101001", "00101010", "00101011", "00101100", "00101101", "00000100",
+  "00000101", "00001010", "00001011", "01010010", "01010011", "01010100",
+  "01010101", "00100100", "00100101", "01011000", "01011001", "01011010",
+  "01011011", "01001010", "01001011", "00110010", "00110011", "00110100"
+};
+const char* const BLACK_TERMINATING[64] = {
+  "0000110111", "010", "11", "10", "011", "0011", "0010", "00011", "000101",
+  "000100", "0000100", "0000101", "0000111", "00000100", "00000111",
+  "000011000", "0000010111", "0000011000", "0000001000", "00001100111",
+  "00001101000", "00001101100", "00000110111", "00000101000",
+  "00000010111", "00000011000", "000011001010", "000011001011",
+  "000011001100", "000011001101", "000001101000", "000001101001",
+  "000001101010", "000001101011", "000011010010", "000011010011",
+  "000011010100", "000011010101", "000011010110", "000011010111",
+  "000001101100", "000001101101", "000011011010", "000011011011",
+  "000001010100", "000001010101", "000001010110", "000001010111",
+  "000001100100", "000001100101", "000001010010", "000001010011",
+  "000000100100", "000000110111", "000000111000", "000000100111",
+  "000000101000", "000001011000", "000001011001", "000000101011",
+  "000000101100", "000001011010", "000001100110", "000001100111"
+};
+// Runs of 64, 128, ... 1728
+const char* const WHITE_MAKEUP[27] = {
+  "11011", "10010", "010111", "0110111", "00110110", "00110111", "01100100",
+  "01100101", "01101000", "01100111", "011001100", "011001101", "011010010",
+  "011010011", "011010100", "011010101", "011010110", "011010111",
+  "011011000", "011011001", "011011010", "011011011", "010011000",
+  "010011001", "010011010", "011000", "010011011"
+};
+const char* const BLACK_MAKEUP[27] = {
+  "0000001111", "000011001000", "000011001001", "000001011011",
+  "000000110011", "000000110100", "000000110101", "0000001101100",
+  "0000001101101", "0000001001010", "0000001001011", "0000001001100",
+  "0000001001101", "0000001110010", "0000001110011", "0000001110100",
+  "0000001110101", "0000001110110", "0000001110111", "0000001010010",
+  "0000001010011", "0000001010100", "0000001010101", "0000001011010",
+  "0000001011011", "0000001100100", "0000001100101"
+};
+// Runs of 1792, 1856, ... 2560, either colour
+const char* const EXTENDED_MAKEUP[13] = {
+  "00000001000", "00000001100", "00000001101", "000000010010",
+  "000000010011", "000000010100", "000000010101", "000000010110",
+  "000000010111", "000000011100", "000000011101", "000000011110",
+  "000000011111"
+};
+
+struct FaxCode
+{
+  uint16_t bits = 0;
+  int length = 0;
+
+  FaxCode() = default;
+  explicit FaxCode(const char* code)
+  {
+    for (; *code; ++code, ++length)
+      bits = static_cast<uint16_t>((bits << 1) | (*code == '1'));
+  }
+};
+
+// Parsed once, on first use
+struct FaxTables
+{
+  FaxCode terminating[2][64];
+  FaxCode makeup[2][27];
+  FaxCode extended[13];
+  const FaxCode pass{"0001"}, horizontal{"001"}, eol{"000000000001"};
+  // Vertical modes VL3 .. V0 .. VR3, indexed by a1 - b1 + 3
+  const FaxCode vertical[7] = {
+    FaxCode("0000010"), FaxCode("000010"), FaxCode("010"), FaxCode("1"),
+    FaxCode("011"), FaxCode("000011"), FaxCode("0000011")
+  };
+
+  FaxTables()
+  {
+    for (int i = 0; i < 64; ++i)
+    {
+      terminating[0][i] = FaxCode(WHITE_TERMINATING[i]);
+      terminating[1][i] = FaxCode(BLACK_TERMINATING[i]);
+    }
+    for (int i = 0; i < 27; ++i)
+    {
+      makeup[0][i] = FaxCode(WHITE_MAKEUP[i]);
+      makeup[1][i] = FaxCode(BLACK_MAKEUP[i]);
+    }
+    for (int i = 0; i < 13; ++i)
+      extended[i] = FaxCode(EXTENDED_MAKEUP[i]);
+  }
+};
+
+const FaxTables& faxTables()
+{
+  static const FaxTables tables;
+  return tables;
+}
+
+// MSB-first bit stream (TIFF FillOrder 1)
+class BitWriter
+{
+private:
+  vector<uchar>& out;
+  uint32_t acc = 0;
+  int count = 0;
+
+public:
+  explicit BitWriter(vector<uchar>& o) : out(o) {}
+
+  void put(const FaxCode& code)
+  {
+    acc = (acc << code.length) | code.bits;
+    count += code.length;
+    while (count >= 8)
+    {
+      count -= 8;
+      out.push_back(static_cast<uchar>(acc >> count));
+    }
+    acc &= (1u << count) - 1;
+  }
+  // Pads the last byte with zeros
+  void flush()
+  {
+    if (count > 0)
+      out.push_back(static_cast<uchar>(acc << (8 - count)));
+    acc   = 0;
+    count = 0;
+  }
+};
+
+// ONE RUN: 2560 MAKEUPS, ONE MAKEUP, THEN THE TERMINATING CODE
+void putRun(BitWriter& writer, int run, int colour)
+{
+  const FaxTables& t = faxTables();
+  for (; run > 2560; run -= 2560)
+    writer.put(t.extended[12]);
+  if (run >= 64)
+  {
+    int m = run / 64;
+    writer.put(m <= 27 ? t.makeup[colour][m - 1] : t.extended[m - 28]);
+    run -= m * 64;
+  }
+  writer.put(t.terminating[colour][run]);
+}
+
+// Positions where a packed row changes colour, starting from white, then
+// three width sentinels so b1, b2 and a2 can always be looked up
+void rowChanges(const uchar* bits, int width, vector<int>& changes)
+{
+  changes.clear();
+  int colour = 0;
+  for (int x = 0; x < width; ++x)
+  {
+    // WHOLE BYTES OF THE CURRENT COLOUR SKIP AHEAD
+    if ((x & 7) == 0 && x + 8 <= width &&
+        bits[x >> 3] == (colour ? 0xFF : 0x00))
+    {
+      x += 7;
+      continue;
+    }
+    int bit = (bits[x >> 3] >> (7 - (x & 7))) & 1;
+    if (bit != colour)
+    {
+      changes.push_back(x);
+      colour = bit;
+    }
+  }
+  changes.insert(changes.end(), 3, width);
+}
+
+// Index of the first change after a0
+inline size_t firstChangeAfter(const vector<int>& changes, int a0)
+{
+  return upper_bound(changes.begin(), changes.end(), a0) - changes.begin();
+}
+}
+
+// CCITT T.6 ROW CODING
+/******************************************************************************/
+// Each row is coded against the one above it (the first against a white
+// row) by its changing elements: a0 the last coded position, a1 / a2 the
+// next changes on this row, b1 the next change on the reference row to the
+// colour opposite a0's, b2 the one after it.
+static void encodeG4Data(const BinaryPage& page, vector<uchar>& data)
+{
+  const FaxTables& t = faxTables();
+  const int W = page.width;
+  BitWriter writer(data);
+  vector<int> ref, cur;
+  ref.assign(3, W);
+  for (int y = 0; y < page.bits.rows; ++y)
+  {
+    rowChanges(page.bits.ptr<uchar>(y), W, cur);
+    int a0 = -1, colour = 0;
+    while (a0 < W)
+    {
+      size_t i1 = firstChangeAfter(cur, a0);
+      int a1 = cur[i1];
+      // CHANGES TO BLACK HAVE EVEN INDICES, TO WHITE ODD ONES
+      size_t j1 = firstChangeAfter(ref, a0);
+      if (static_cast<int>(j1 & 1) != colour)
+        ++j1;
+      int b1 = ref[j1], b2 = ref[j1 + 1];
+      if (b2 < a1)
+      {
+        writer.put(t.pass);
+        a0 = b2;
+      }
+      else if (abs(a1 - b1) <= 3)
+      {
+        writer.put(t.vertical[a1 - b1 + 3]);
+        a0 = a1;
+        colour ^= 1;
+      }
+      else
+      {
+        int a2 = cur[i1 + 1];
+        writer.put(t.horizontal);
+        putRun(writer, a1 - max(a0, 0), colour);
+        putRun(writer, a2 - a1, colour ^ 1);
+        a0 = a2;
+      }
+    }
+    swap(ref, cur);
+  }
+  // END OF FACSIMILE BLOCK
+  writer.put(t.eol);
+  writer.put(t.eol);
+  writer.flush();
+}
+
+// TIFF CONTAINER: HEADER, THE ONE STRIP, THEN THE IFD
+/******************************************************************************/
+static void putLE(vector<uchar>& out, uint32_t value, int bytes)
+{
+  for (int i = 0; i < bytes; ++i)
+    out.push_back(static_cast<uchar>(value >> (8 * i)));
+}
+
+bool encodeTiffG4(const BinaryPage& page, vector<uchar>& out)
+{
+  out.clear();
+  if (page.empty())
+    return false;
+  out = {'I', 'I', 42, 0, 0, 0, 0, 0};
+  encodeG4Data(page, out);
+  uint32_t stripBytes = static_cast<uint32_t>(out.size() - 8);
+  if (out.size() & 1)
+    out.push_back(0);
+  uint32_t ifdOffset = static_cast<uint32_t>(out.size());
+  for (int i = 0; i < 4; ++i)
+    out[4 + i] = static_cast<uchar>(ifdOffset >> (8 * i));
+
+  const uint16_t SHORT = 3, LONG = 4;
+  struct Tag
+  {
+    uint16_t id, type;
+    uint32_t value;
+  };
+  // SORTED BY TAG, AS TIFF REQUIRES
+  const Tag tags[] = {
+    {256, LONG, static_cast<uint32_t>(page.width)},     // ImageWidth
+    {257, LONG, static_cast<uint32_t>(page.bits.rows)}, // ImageLength
+    {258, SHORT, 1},                                    // BitsPerSample
+    {259, SHORT, 4},                                    // Compression: T.6
+    {262, SHORT, 0},                                    // WhiteIsZero
+    {273, LONG, 8},                                     // StripOffsets
+    {277, SHORT, 1},                                    // SamplesPerPixel
+    {278, LONG, static_cast<uint32_t>(page.bits.rows)}, // RowsPerStrip
+    {279, LONG, stripBytes}                             // StripByteCounts
+  };
+  putLE(out, sizeof(tags) / sizeof(tags[0]), 2);
+  for (const Tag& tag : tags)
+  {
+    putLE(out, tag.id, 2);
+    putLE(out, tag.type, 2);
+    putLE(out, 1, 4);
+    // VALUES SHORTER THAN 4 BYTES ARE LEFT-JUSTIFIED IN THE FIELD
+    putLE(out, tag.value, tag.type == SHORT ? 2 : 4);
+    if (tag.type == SHORT)
+      putLE(out, 0, 2);
+  }
+  putLE(out, 0, 4); // NO NEXT IFD
+  return true;
+}
+
+// LOSSY ENCODE WITH AN OPTIONAL SIZE BUDGET
+/******************************************************************************/
+// The configured quality first; if that is over budget, minQuality, then
+// qualities interpolated in log(bytes) between the best quality known to
+// fit (lo) and the worst known not to (hi) until they are adjacent.
+static bool encodeLossy(const Mat& img, const string& ext, int qualityFlag,
+                        vector<uchar>& out, const EncodeOptions& opts,
+                        EncodeReport& report)
+{
+  vector<uchar> trial;
+  auto encodeAt = [&](int q, vector<uchar>& buf)
+  {
+    ++report.encodes;
+    return imencode(ext, img, buf, {qualityFlag, q});
+  };
+  int hi = clamp(opts.quality, 1, 100);
+  if (!encodeAt(hi, out))
+    return false;
+  report.quality = hi;
+  size_t target = opts.targetBytes;
+  if (target == 0 || out.size() <= target)
+    return true;
+  int lo = clamp(opts.minQuality, 1, hi);
+  if (lo == hi)
+  {
+    report.overBudget = true;
+    return true;
+  }
+  size_t hiBytes = out.size();
+  if (!encodeAt(lo, out))
+    return false;
+  report.quality = lo;
+  if (out.size() > target)
+  {
+    report.overBudget = true;
+    return true;
+  }
+  size_t loBytes = out.size();
+  while (hi - lo > 1 && report.encodes < opts.maxSearchEncodes)
+  {
+    double f = (log(double(target)) - log(double(loBytes))) /
+               max(1e-9, log(double(hiBytes)) - log(double(loBytes)));
+    int q = clamp(lo + static_cast<int>(lround(f * (hi - lo))), lo + 1, hi - 1);
+    if (!encodeAt(q, trial))
+      return false;
+    if (trial.size() <= target)
+    {
+      lo      = q;
+      loBytes = trial.size();
+      out.swap(trial);
+      report.quality = q;
+    }
+    else
+    {
+      hi      = q;
+      hiBytes = trial.size();
+    }
+  }
+  return true;
+}
+
+// ENCODE PAGE
+/******************************************************************************/
+static bool encodeFormat(const Mat& img, const BinaryPage* bits,
+                         const string& ext, vector<uchar>& out,
+                         const EncodeOptions& opts, EncodeReport& report)
+{
+  switch (report.format)
+  {
+  case OutputFormat::JPEG:
+    return encodeLossy(img, ext, IMWRITE_JPEG_QUALITY, out, opts, report);
+  case OutputFormat::WEBP:
+    return encodeLossy(img, ext, IMWRITE_WEBP_QUALITY, out, opts, report);
+  case OutputFormat::PNG:
+  {
+    vector<int> params = {IMWRITE_PNG_COMPRESSION,
+                          clamp(opts.pngCompression, 0, 9)};
+    if (bits)
+      params.insert(params.end(), {IMWRITE_PNG_BILEVEL, 1});
+    ++report.encodes;
+    if (!imencode(ext, img, out, params))
+      return false;
+    // LOSSLESS: THE ONLY KNOB LEFT IS ZLIB EFFORT
+    if (opts.targetBytes > 0 && out.size() > opts.targetBytes &&
+        params[1] < 9)
+    {
+      params[1] = 9;
+      ++report.encodes;
+      if (!imencode(ext, img, out, params))
+        return false;
+    }
+    return true;
+  }
+  default:
+    ++report.encodes;
+    return imencode(ext, img, out);
+  }
+}
+
+bool encodePage(const BinaryPage& page, const string& ext, vector<uchar>& out,
+                const EncodeOptions& opts, EncodeReport* report)
+{
+  out.clear();
+  EncodeReport r;
+  r.format = outputFormat(ext);
+  if (page.empty())
+    return false;
+  auto start = chrono::steady_clock::now();
+  bool ok;
+  if (r.format == OutputFormat::TIFF_G4)
+    ok = encodeTiffG4(page, out);
+  else if (r.format == OutputFormat::PBM)
+    ok = encodePbm(page, out);
+  else
+  {
+    Mat bw;
+    unpackBinaryPage(page, bw);
+    ok = encodeFormat(bw, &page, ext, out, opts, r);
+  }
+  r.encodes = max(r.encodes, 1);
+  r.encodeMs = chrono::duration<double, milli>(
+    chrono::steady_clock::now() - start).count();
+  r.bytes = ok ? out.size() : 0;
+  r.overBudget = r.overBudget ||
+                 (opts.targetBytes > 0 && r.bytes > opts.targetBytes);
+  if (report)
+    *report = r;
+  return ok;
+}
+
+bool encodePage(const Mat& page, const string& ext, vector<uchar>& out,
+                const EncodeOptions& opts, EncodeReport* report)
+{
+  OutputFormat format = outputFormat(ext);
+  if (format == OutputFormat::TIFF_G4 || format == OutputFormat::PBM)
+  {
+    BinaryPage bits;
+    if (!page.empty())
+      binarizePage(page, bits);
+    return encodePage(bits, ext, out, opts, report);
+  }
+  out.clear();
+  EncodeReport r;
+  r.format = format;
+  if (page.empty())
+    return false;
+  auto start = chrono::steady_clock::now();
+  bool ok = encodeFormat(page, nullptr, ext, out, opts, r);
+  r.encodeMs = chrono::duration<double, milli>(
+    chrono::steady_clock::now() - start).count();
+  r.bytes = ok ? out.size() : 0;
+  r.overBudget = r.overBudget ||
+                 (opts.targetBytes > 0 && r.bytes > opts.targetBytes);
+  if (report)
+    *report = r;
+  return ok;
+}
+
+// WRITE PAGE
+/******************************************************************************/
+static bool writeBytes(const string& path, const vector<uchar>& bytes)
+{
+  ofstream file(path, ios::binary | ios::trunc);
+  file.write(reinterpret_cast<const char*>(bytes.data()),
+             static_cast<streamsize>(bytes.size()));
+  file.close();
+  return !file.fail();
+}
+
+bool writePage(const string& path, const Mat& page, const EncodeOptions& opts,
+               EncodeReport* report)
+{
+  vector<uchar> bytes;
+  return encodePage(page, path, bytes, opts, report) &&
+         writeBytes(path, bytes);
+}
+
+bool writePage(const string& path, const BinaryPage& page,
+               const EncodeOptions& opts, EncodeReport* report)
+{
+  vector<uchar> bytes;
+  return encodePage(page, path, bytes, opts, report) &&
+         writeBytes(path, bytes);
+}
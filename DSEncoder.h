@@ -0,0 +1,76 @@
+//
+// Page output: JPEG, PNG, WebP and Group-4 TIFF with quality and size-budget
+// controls, and a per-page report of what the encode cost.
+//
+
+#ifndef DOCUMENTSCANNER_DSENCODER_H
+#define DOCUMENTSCANNER_DSENCODER_H
+
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include "DSBinarize.h"
+
+// TIFF_G4: 1-bit TIFF, CCITT T.6 compressed. OTHER: whatever cv::imencode
+// makes of the extension, at its default settings.
+enum class OutputFormat
+{
+  JPEG, PNG, WEBP, TIFF_G4, PBM, OTHER
+};
+
+struct EncodeOptions
+{
+  // JPEG and WebP quality, 1 - 100
+  int quality = 90;
+  // PNG zlib level, 0 - 9. A page over targetBytes is retried at 9.
+  int pngCompression = 3;
+  // Bytes per page, 0 = no budget. A lossy page that doesn't fit at quality
+  // is re-encoded at the highest quality down to minQuality that does,
+  // found in at most maxSearchEncodes encodes. Pages that can't be made to
+  // fit are written anyway (the smallest encode) and flagged overBudget.
+  size_t targetBytes = 0;
+  int minQuality = 20;
+  int maxSearchEncodes = 6;
+};
+
+struct EncodeReport
+{
+  OutputFormat format = OutputFormat::OTHER;
+  int quality = 0; // JPEG and WebP: the quality written
+  size_t bytes = 0;
+  double encodeMs = 0.0; // every encode of a size search, not the write
+  int encodes = 0;
+  bool overBudget = false;
+};
+
+// From a path or an extension, case-insensitive
+OutputFormat outputFormat(const std::string& pathOrExt);
+std::string outputFormatToString(OutputFormat format);
+
+// page is CV_8UC3 or CV_8UC1; ext picks the format (".jpg", ".png",
+// ".webp", ".tif", ".pbm", or anything cv::imencode knows). Group-4 TIFF
+// and PBM are 1-bit, so a gray or colour page is binarized with the
+// default BinarizeOptions first.
+bool encodePage(const cv::Mat& page, const std::string& ext,
+                std::vector<uchar>& out,
+                const EncodeOptions& opts = EncodeOptions(),
+                EncodeReport* report = nullptr);
+// A binarized page: TIFF and PBM straight from the packed bits, PNG as a
+// 1-bit PNG, anything else from the unpacked 0 / 255 page
+bool encodePage(const BinaryPage& page, const std::string& ext,
+                std::vector<uchar>& out,
+                const EncodeOptions& opts = EncodeOptions(),
+                EncodeReport* report = nullptr);
+// encodePage() to path's format, then written out
+bool writePage(const std::string& path, const cv::Mat& page,
+               const EncodeOptions& opts = EncodeOptions(),
+               EncodeReport* report = nullptr);
+bool writePage(const std::string& path, const BinaryPage& page,
+               const EncodeOptions& opts = EncodeOptions(),
+               EncodeReport* report = nullptr);
+
+// Single-strip little-endian TIFF, CCITT T.6 (Group 4), WhiteIsZero
+bool encodeTiffG4(const BinaryPage& page, std::vector<uchar>& out);
+
+#endif //DOCUMENTSCANNER_DSENCODER_H
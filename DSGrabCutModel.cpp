@@ -0,0 +1,231 @@
+//
+// GrabCut colour models kept across documents shot in the same setting.
+//
+#include "DSGrabCutModel.h"
+
+#include <cmath>
+#include <filesystem>
+#include <limits>
+#include <sstream>
+#include <thread>
+
+#include <opencv2/imgproc.hpp>
+
+using namespace std;
+using namespace cv;
+namespace fs = std::filesystem;
+
+// cv::grabCut's GMM: 5 components of weight, mean (3) and covariance (9)
+static const int COMPONENTS = 5;
+static const int MODEL_SIZE = COMPONENTS * (1 + 3 + 9);
+// FLOOR FOR A PIXEL NEITHER MODEL EXPLAINS, SO ONE OUTLIER CAN'T DOMINATE
+static const double MIN_LOG_DENSITY = -30.0;
+
+/************************ CONSTRUCTOR ***************************************/
+GrabCutModel::GrabCutModel(double fitTolerance) : tolerance(fitTolerance)
+{
+}
+
+/***************************** GETTERS & SETTERS ******************************/
+bool GrabCutModel::isTrained() const
+{
+  lock_guard<mutex> lock(mtx);
+  return !bgdModel.empty();
+}
+
+double GrabCutModel::getTolerance() const
+{
+  return tolerance;
+}
+
+size_t GrabCutModel::getReuses() const
+{
+  lock_guard<mutex> lock(mtx);
+  return reuses;
+}
+
+size_t GrabCutModel::getRelearns() const
+{
+  lock_guard<mutex> lock(mtx);
+  return relearns;
+}
+
+// GET / UPDATE
+/******************************************************************************/
+bool GrabCutModel::get(Mat& bgd, Mat& fgd, double& baseline) const
+{
+  lock_guard<mutex> lock(mtx);
+  if (bgdModel.empty())
+    return false;
+  bgdModel.copyTo(bgd);
+  fgdModel.copyTo(fgd);
+  baseline = baselineFit;
+  return true;
+}
+
+void GrabCutModel::update(const Mat& bgd, const Mat& fgd, double fit)
+{
+  if (bgd.total() != MODEL_SIZE || fgd.total() != MODEL_SIZE)
+    return;
+  lock_guard<mutex> lock(mtx);
+  bgd.copyTo(bgdModel);
+  fgd.copyTo(fgdModel);
+  baselineFit = fit;
+  ++relearns;
+}
+
+void GrabCutModel::noteReuse()
+{
+  lock_guard<mutex> lock(mtx);
+  ++reuses;
+}
+
+void GrabCutModel::clear()
+{
+  lock_guard<mutex> lock(mtx);
+  bgdModel.release();
+  fgdModel.release();
+  baselineFit = 0.0;
+}
+
+// LOAD / SAVE
+/******************************************************************************/
+bool GrabCutModel::load(const string& path)
+{
+  error_code ec;
+  if (!fs::exists(path, ec))
+    return false;
+  FileStorage fsIn(path, FileStorage::READ);
+  if (!fsIn.isOpened())
+    return false;
+  Mat bgd, fgd;
+  fsIn["bgdModel"] >> bgd;
+  fsIn["fgdModel"] >> fgd;
+  double fit = static_cast<double>(fsIn["baselineFit"]);
+  if (bgd.total() != MODEL_SIZE || fgd.total() != MODEL_SIZE ||
+      bgd.type() != CV_64F || fgd.type() != CV_64F)
+    return false;
+  lock_guard<mutex> lock(mtx);
+  bgdModel    = bgd.reshape(1, 1);
+  fgdModel    = fgd.reshape(1, 1);
+  baselineFit = fit;
+  return true;
+}
+
+bool GrabCutModel::save(const string& path) const
+{
+  Mat bgd, fgd;
+  double fit;
+  if (!get(bgd, fgd, fit))
+    return false;
+  // RENAMED INTO PLACE, SO A READER NEVER SEES A TORN FILE
+  ostringstream tmpName;
+  tmpName << path << ".tmp" << this_thread::get_id();
+  string tmpPath = tmpName.str();
+  {
+    FileStorage fsOut(tmpPath, FileStorage::WRITE);
+    if (!fsOut.isOpened())
+      return false;
+    fsOut << "bgdModel" << bgd;
+    fsOut << "fgdModel" << fgd;
+    fsOut << "baselineFit" << fit;
+  }
+  error_code ec;
+  fs::rename(tmpPath, path, ec);
+  if (ec)
+  {
+    fs::remove(tmpPath, ec);
+    return false;
+  }
+  return true;
+}
+
+// FIT: MEAN LOG LIKELIHOOD UNDER THE LABELLED SIDE'S GMM
+/******************************************************************************/
+namespace
+{
+// One GMM unpacked for evaluation: weights, means, inverse covariances and
+// 1/sqrt(det), computed as cv::grabCut does
+struct Gmm
+{
+  double weight[COMPONENTS] = {};
+  double mean[COMPONENTS][3] = {};
+  double inverse[COMPONENTS][9] = {};
+  double norm[COMPONENTS] = {};
+
+  explicit Gmm(const Mat& model)
+  {
+    const double* coefs = model.ptr<double>(0);
+    const double* means = coefs + COMPONENTS;
+    const double* covs  = means + 3 * COMPONENTS;
+    for (int ci = 0; ci < COMPONENTS; ++ci)
+    {
+      const double* c = covs + 9 * ci;
+      double det = c[0] * (c[4] * c[8] - c[5] * c[7]) -
+                   c[1] * (c[3] * c[8] - c[5] * c[6]) +
+                   c[2] * (c[3] * c[7] - c[4] * c[6]);
+      if (coefs[ci] <= 0.0 || det <= numeric_limits<double>::epsilon())
+        continue;
+      weight[ci] = coefs[ci];
+      for (int k = 0; k < 3; ++k)
+        mean[ci][k] = means[3 * ci + k];
+      double* inv = inverse[ci];
+      inv[0] = (c[4] * c[8] - c[5] * c[7]) / det;
+      inv[1] = (c[2] * c[7] - c[1] * c[8]) / det;
+      inv[2] = (c[1] * c[5] - c[2] * c[4]) / det;
+      inv[3] = (c[5] * c[6] - c[3] * c[8]) / det;
+      inv[4] = (c[0] * c[8] - c[2] * c[6]) / det;
+      inv[5] = (c[2] * c[3] - c[0] * c[5]) / det;
+      inv[6] = (c[3] * c[7] - c[4] * c[6]) / det;
+      inv[7] = (c[1] * c[6] - c[0] * c[7]) / det;
+      inv[8] = (c[0] * c[4] - c[1] * c[3]) / det;
+      norm[ci] = 1.0 / sqrt(det);
+    }
+  }
+
+  [[nodiscard]] double logDensity(const uchar* bgr) const
+  {
+    double p = 0.0;
+    for (int ci = 0; ci < COMPONENTS; ++ci)
+    {
+      if (weight[ci] <= 0.0)
+        continue;
+      double d0 = bgr[0] - mean[ci][0];
+      double d1 = bgr[1] - mean[ci][1];
+      double d2 = bgr[2] - mean[ci][2];
+      const double* inv = inverse[ci];
+      double mult = d0 * (d0 * inv[0] + d1 * inv[3] + d2 * inv[6]) +
+                    d1 * (d0 * inv[1] + d1 * inv[4] + d2 * inv[7]) +
+                    d2 * (d0 * inv[2] + d1 * inv[5] + d2 * inv[8]);
+      p += weight[ci] * norm[ci] * exp(-0.5 * mult);
+    }
+    return p > 0.0 ? max(MIN_LOG_DENSITY, log(p)) : MIN_LOG_DENSITY;
+  }
+};
+}
+
+double GrabCutModel::meanLogLikelihood(const Mat& img, const Mat& mask,
+                                       const Mat& bgd, const Mat& fgd,
+                                       int step)
+{
+  CV_Assert(img.type() == CV_8UC3 && mask.size() == img.size());
+  if (bgd.total() != MODEL_SIZE || fgd.total() != MODEL_SIZE)
+    return MIN_LOG_DENSITY;
+  Gmm bgdGmm(bgd), fgdGmm(fgd);
+  step = max(1, step);
+  double sum = 0.0;
+  size_t count = 0;
+  for (int y = 0; y < img.rows; y += step)
+  {
+    const uchar* pixel = img.ptr<uchar>(y);
+    const uchar* label = mask.ptr<uchar>(y);
+    for (int x = 0; x < img.cols; x += step)
+    {
+      // GC_FGD (1) AND GC_PR_FGD (3) HAVE THE LOW BIT SET
+      const Gmm& gmm = (label[x] & 1) ? fgdGmm : bgdGmm;
+      sum += gmm.logDensity(pixel + 3 * x);
+      ++count;
+    }
+  }
+  return count > 0 ? sum / count : MIN_LOG_DENSITY;
+}
@@ -0,0 +1,64 @@
+//
+// GrabCut colour models kept across documents shot in the same setting.
+//
+
+#ifndef DOCUMENTSCANNER_DSGRABCUTMODEL_H
+#define DOCUMENTSCANNER_DSGRABCUTMODEL_H
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include <opencv2/core.hpp>
+
+// The background (desk) and foreground (paper) GMMs cv::grabCut learns, plus
+// how well they fit the document they were learned on: the mean log
+// likelihood of its pixels under the model of their final label. A later
+// document is segmented with the models frozen (one GC_EVAL_FREEZE_MODEL
+// iteration, no k-means initialization); if its fit falls more than
+// tolerance below that baseline the setting has changed and the scanner
+// re-learns and replaces them. Thread-safe; share one instance between the
+// scanners of a station and load()/save() it across runs.
+class GrabCutModel
+{
+private:
+  cv::Mat bgdModel, fgdModel; // 1 x 65 CV_64F, cv::grabCut's layout
+  double baselineFit = 0.0;
+  double tolerance;
+  size_t reuses = 0, relearns = 0;
+  mutable std::mutex mtx;
+
+public:
+  /****************************** CONSTRUCTORS ********************************/
+  // tolerance: drop in mean log likelihood (nats per pixel) that triggers a
+  // re-learn
+  explicit GrabCutModel(double fitTolerance = 2.0);
+
+  /**************************** SETTERS & GETTERS *****************************/
+  [[nodiscard]] bool isTrained() const;
+  [[nodiscard]] double getTolerance() const;
+  // Documents segmented with the frozen models, and re-learns after a fit
+  // drop (the first training included)
+  [[nodiscard]] size_t getReuses() const;
+  [[nodiscard]] size_t getRelearns() const;
+
+  /*************************** PUBLIC METHODS *********************************/
+  // Copies of the models and their baseline fit; false while untrained
+  bool get(cv::Mat& bgd, cv::Mat& fgd, double& baseline) const;
+  // Replace the models with freshly learned ones
+  void update(const cv::Mat& bgd, const cv::Mat& fgd, double fit);
+  void noteReuse();
+  void clear();
+  // YAML via cv::FileStorage; load() leaves the models untouched on failure
+  bool load(const std::string& path);
+  bool save(const std::string& path) const;
+
+  /**************************** STATIC METHODS ********************************/
+  // Mean log likelihood of every step-th pixel of img (CV_8UC3) under the
+  // model of its GrabCut label in mask (fgd for GC_FGD / GC_PR_FGD)
+  static double meanLogLikelihood(const cv::Mat& img, const cv::Mat& mask,
+                                  const cv::Mat& bgd, const cv::Mat& fgd,
+                                  int step = 4);
+};
+
+#endif //DOCUMENTSCANNER_DSGRABCUTMODEL_H
@@ -0,0 +1,87 @@
+//
+// Vectorized kernels for compositing with a GrabCut label mask.
+//
+#include "DSMaskKernels.h"
+
+#include <opencv2/core/hal/intrin.hpp>
+
+using namespace std;
+using namespace cv;
+
+// ROWS TO ITERATE: ONE LONG ROW WHEN EVERY MAT IS CONTINUOUS
+/******************************************************************************/
+static cv::Size rowLayout(const Mat& a, const Mat& b, const Mat& c)
+{
+  if (a.isContinuous() && b.isContinuous() && c.isContinuous())
+    return cv::Size(a.cols * a.rows, 1);
+  return a.size();
+}
+
+// GRABCUT FOREGROUND
+/******************************************************************************/
+void grabCutForeground(const Mat& labels, Mat& fgMask)
+{
+  CV_Assert(labels.type() == CV_8UC1);
+  fgMask.create(labels.size(), CV_8UC1);
+  cv::Size layout = rowLayout(labels, fgMask, fgMask);
+  for (int y = 0; y < layout.height; ++y)
+  {
+    const uchar* l = labels.ptr<uchar>(y);
+    uchar* m = fgMask.ptr<uchar>(y);
+    int x = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+    const int step = VTraits<v_uint8>::vlanes();
+    const v_uint8 one = vx_setall_u8(1), zero = vx_setzero_u8();
+    for (; x <= layout.width - step; x += step)
+      v_store(m + x, v_ne(v_and(vx_load(l + x), one), zero));
+#endif
+    for (; x < layout.width; ++x)
+      m[x] = (l[x] & 1) ? 255 : 0;
+  }
+}
+
+// APPLY GRABCUT LABELS
+/******************************************************************************/
+void applyGrabCutLabels(const Mat& src, const Mat& labels, Mat& dst)
+{
+  CV_Assert(labels.type() == CV_8UC1 && src.size() == labels.size());
+  CV_Assert(src.type() == CV_8UC3 || src.type() == CV_8UC1);
+  dst.create(src.size(), src.type());
+  const bool color = src.type() == CV_8UC3;
+  cv::Size layout = rowLayout(src, labels, dst);
+  for (int y = 0; y < layout.height; ++y)
+  {
+    const uchar* s = src.ptr<uchar>(y);
+    const uchar* l = labels.ptr<uchar>(y);
+    uchar* d = dst.ptr<uchar>(y);
+    int x = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+    const int step = VTraits<v_uint8>::vlanes();
+    const v_uint8 one = vx_setall_u8(1), zero = vx_setzero_u8();
+    if (color)
+      for (; x <= layout.width - step; x += step)
+      {
+        v_uint8 fg = v_ne(v_and(vx_load(l + x), one), zero);
+        v_uint8 b, g, r;
+        v_load_deinterleave(s + 3 * x, b, g, r);
+        v_store_interleave(d + 3 * x, v_and(b, fg), v_and(g, fg),
+                           v_and(r, fg));
+      }
+    else
+      for (; x <= layout.width - step; x += step)
+      {
+        v_uint8 fg = v_ne(v_and(vx_load(l + x), one), zero);
+        v_store(d + x, v_and(vx_load(s + x), fg));
+      }
+#endif
+    for (; x < layout.width; ++x)
+    {
+      uchar keep = (l[x] & 1) ? 255 : 0;
+      if (color)
+        for (int c = 0; c < 3; ++c)
+          d[3 * x + c] = s[3 * x + c] & keep;
+      else
+        d[x] = s[x] & keep;
+    }
+  }
+}
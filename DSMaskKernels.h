@@ -0,0 +1,24 @@
+//
+// Vectorized kernels for compositing with a GrabCut label mask.
+//
+
+#ifndef DOCUMENTSCANNER_DSMASKKERNELS_H
+#define DOCUMENTSCANNER_DSMASKKERNELS_H
+
+#include <opencv2/core.hpp>
+
+// GrabCut labels every pixel GC_BGD (0), GC_FGD (1), GC_PR_BGD (2) or
+// GC_PR_FGD (3): a pixel is (probably) foreground exactly when its label is
+// odd. Every kernel here tests that bit a row at a time with universal
+// intrinsics, and dst may alias src.
+
+// 255 where labels is GC_FGD / GC_PR_FGD, 0 elsewhere (CV_8UC1)
+void grabCutForeground(const cv::Mat& labels, cv::Mat& fgMask);
+
+// src where labels is foreground, black elsewhere. src is CV_8UC3 or
+// CV_8UC1 and the same size as labels; a CV_8UC1 src gives the
+// single-channel image findContours takes without any color conversion.
+void applyGrabCutLabels(const cv::Mat& src, const cv::Mat& labels,
+                        cv::Mat& dst);
+
+#endif //DOCUMENTSCANNER_DSMASKKERNELS_H
@@ -0,0 +1,69 @@
+//
+// Named, reusable work buffers for DocumentScanner.
+//
+#include "DSMatPool.h"
+
+#include <algorithm>
+
+using namespace std;
+using namespace cv;
+
+/******************************************************************************/
+sptr<cv::Mat> MatPool::get(const string& key)
+{
+  auto& buffer = buffers[key];
+  if (!buffer)
+    buffer = make_shared<cv::Mat>();
+  return buffer;
+}
+
+sptr<cv::Mat> MatPool::get(const string& key, cv::Size size, int type)
+{
+  sptr<cv::Mat> buffer = get(key);
+  if (buffer->size() != size || buffer->type() != type)
+  {
+    ++numAllocations;
+    buffer->create(size, type);
+  }
+  return buffer;
+}
+
+// SUB-MATRIX OF A GROW-ONLY BUFFER
+/******************************************************************************/
+sptr<cv::Mat> MatPool::getRegion(const string& key, cv::Size size, int type)
+{
+  Mat& store = backing[key];
+  if (store.type() != type || store.cols < size.width ||
+      store.rows < size.height)
+  {
+    ++numAllocations;
+    store.create(max(store.rows, size.height), max(store.cols, size.width),
+                 type);
+  }
+  sptr<cv::Mat> buffer = get(key);
+  *buffer = store(cv::Rect(0, 0, size.width, size.height));
+  return buffer;
+}
+
+/***************************** GETTERS ****************************************/
+size_t MatPool::getNumAllocations() const
+{
+  return numAllocations;
+}
+
+size_t MatPool::bytesReserved() const
+{
+  size_t bytes = 0;
+  for (const auto& [key, buffer] : buffers)
+    if (!backing.count(key))
+      bytes += buffer->total() * buffer->elemSize();
+  for (const auto& [key, store] : backing)
+    bytes += store.total() * store.elemSize();
+  return bytes;
+}
+
+void MatPool::release()
+{
+  buffers.clear();
+  backing.clear();
+}
@@ -0,0 +1,45 @@
+//
+// Named, reusable work buffers for DocumentScanner.
+//
+
+#ifndef DOCUMENTSCANNER_DSMATPOOL_H
+#define DOCUMENTSCANNER_DSMATPOOL_H
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include <opencv2/core.hpp>
+
+#define sptr std::shared_ptr
+
+// Every buffer lives as long as the pool, so a scanner that is reset with a
+// same-sized input finds all of its Mats already allocated: cv::Mat::create
+// (and every OpenCV function writing to an output array) is a no-op when the
+// size and type already match.
+class MatPool
+{
+private:
+  std::map<std::string, sptr<cv::Mat>> buffers;
+  // Grow-only backing stores for getRegion()
+  std::map<std::string, cv::Mat> backing;
+  size_t numAllocations = 0;
+
+public:
+  /*************************** PUBLIC METHODS *********************************/
+  // Persistent buffer; size, type and contents are whatever it last held
+  sptr<cv::Mat> get(const std::string& key);
+  // Persistent buffer with exactly this size and type (contents unspecified)
+  sptr<cv::Mat> get(const std::string& key, cv::Size size, int type);
+  // Header onto a grow-only buffer, for outputs whose size changes from one
+  // document to the next (e.g. the warped page). The Mat is a sub-matrix, so
+  // a later create() with the same size and type writes in place.
+  sptr<cv::Mat> getRegion(const std::string& key, cv::Size size, int type);
+
+  // Number of times a buffer had to be (re)allocated; flat in steady state
+  [[nodiscard]] size_t getNumAllocations() const;
+  [[nodiscard]] size_t bytesReserved() const;
+  void release();
+};
+
+#endif //DOCUMENTSCANNER_DSMATPOOL_H
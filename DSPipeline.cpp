@@ -0,0 +1,398 @@
+//
+// Staged decode -> segment -> warp -> encode pipeline with bounded queues.
+//
+#include "DSPipeline.h"
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+
+using namespace std;
+
+// OPENCV'S THREAD COUNT WHILE IN SCOPE, RESTORED ON ANY WAY OUT
+class CvThreadsGuard
+{
+private:
+  int saved;
+
+public:
+  explicit CvThreadsGuard(int n) : saved(cv::getNumThreads())
+  {
+    cv::setNumThreads(n);
+  }
+  ~CvThreadsGuard()
+  {
+    cv::setNumThreads(saved);
+  }
+  CvThreadsGuard(const CvThreadsGuard&) = delete;
+  CvThreadsGuard& operator=(const CvThreadsGuard&) = delete;
+};
+
+// SCANNER FOOTPRINT: the full decode and the page (3 bytes per pixel each)
+// plus the file and the detection buffers, from the input's JPEG header (a
+// 12 MP photo when it has none)
+static size_t estimateScannerBytes(const string& path)
+{
+  const size_t headerBytes = 256 << 10;
+  vector<unsigned char> head(headerBytes);
+  ifstream file(path, ios::binary);
+  file.read(reinterpret_cast<char*>(head.data()), headerBytes);
+  head.resize(static_cast<size_t>(file.gcount()));
+  int width = 4000, height = 3000;
+  readJpegSize(head, width, height);
+  error_code ec;
+  auto fileBytes = filesystem::file_size(path, ec);
+  return static_cast<size_t>(width) * height * 7 +
+         (ec ? 0 : static_cast<size_t>(fileBytes));
+}
+
+/************************ CONSTRUCTOR ***************************************/
+DocumentPipeline::DocumentPipeline(DSOptions opts, PipelineOptions pipeOpts) :
+  options(std::move(opts)), pipeOptions(pipeOpts)
+{
+  // STAGE THREADS NEVER OPEN WINDOWS
+  options.headless = true;
+}
+
+/***************************** GETTERS ****************************************/
+const PipelineOptions& DocumentPipeline::getPipelineOptions() const
+{
+  return pipeOptions;
+}
+
+PipelineOptions DocumentPipeline::resolvedOptions() const
+{
+  PipelineOptions po = pipeOptions;
+  po.decodeThreads = max(1u, po.decodeThreads);
+  po.warpThreads   = max(1u, po.warpThreads);
+  po.encodeThreads = max(1u, po.encodeThreads);
+  if (po.segmentThreads == 0)
+  {
+    unsigned int hw = max(1u, thread::hardware_concurrency());
+    unsigned int others = po.decodeThreads + po.warpThreads + po.encodeThreads;
+    po.segmentThreads = hw > others ? hw - others : 1;
+  }
+  po.queueCapacity = max<size_t>(1, po.queueCapacity);
+  if (po.maxInFlight == 0)
+    po.maxInFlight = po.decodeThreads + po.segmentThreads + po.warpThreads +
+                     po.encodeThreads + 3 * po.queueCapacity;
+  return po;
+}
+
+// ONE MIDDLE STAGE: POP, WORK, PUSH DOWNSTREAM
+/******************************************************************************/
+// A document that already failed is passed through untouched, so the encode
+// stage is the single place where every scanner goes back to the free list.
+void DocumentPipeline::runStage(BoundedQueue<Work>& in, BoundedQueue<Work>& out,
+                                const string& stageName,
+                                const function<void(Work&)>& work)
+{
+  Work w;
+  while (in.pop(w))
+  {
+    if (w.result.error.empty())
+    {
+      try
+      {
+        work(w);
+      }
+      catch (const exception& exp)
+      {
+        w.result.error = stageName + ": " + exp.what();
+      }
+    }
+    out.push(std::move(w));
+  }
+}
+
+// SAVE PAGES: every page of a multi-document run
+/******************************************************************************/
+void DocumentPipeline::savePages(const DocumentScanner& ds,
+                                 BatchResult& result) const
+{
+  const string& out = result.outputPath;
+  size_t dot   = out.find_last_of('.');
+  size_t slash = out.find_last_of('/');
+  if (dot == string::npos || (slash != string::npos && dot < slash))
+    dot = out.size();
+  vector<cv::Mat> pages = ds.getPages();
+  try
+  {
+    for (size_t k = 0; k < pages.size(); ++k)
+    {
+      string path = out.substr(0, dot) + "_" + to_string(k + 1) +
+                    out.substr(dot);
+      ScopedSpan span(result.trace, "saveFinalImg", pages[k].cols,
+                      pages[k].rows);
+      EncodeReport report;
+      if (!writePage(path, pages[k], options.encodeOptions, &report))
+      {
+        result.error = "Could not write " + path;
+        return;
+      }
+      result.pagePaths.push_back(path);
+      EncodeReport& total = result.encode;
+      total.format      = report.format;
+      total.quality     = report.quality;
+      total.bytes      += report.bytes;
+      total.encodeMs   += report.encodeMs;
+      total.encodes    += report.encodes;
+      total.overBudget |= report.overBudget;
+    }
+  }
+  catch (const exception& exp)
+  {
+    result.error = string("encode: ") + exp.what();
+    return;
+  }
+  result.succeeded = !pages.empty();
+}
+
+// RUN - MACRO
+/******************************************************************************/
+vector<BatchResult> DocumentPipeline::run(const vector<Job>& jobs,
+                                          const DoneCallback& onDone)
+{
+  vector<BatchResult> results(jobs.size());
+  if (jobs.empty())
+    return results;
+  PipelineOptions po = resolvedOptions();
+
+  // THE SCANNER POOL IS THE MEMORY BOUND: NO FREE SCANNER, NO NEW DOCUMENT
+  size_t nScanners = min(po.maxInFlight, jobs.size());
+  if (pipeOptions.maxInFlight == 0 && po.memoryCapMB > 0)
+    nScanners = min(nScanners, max<size_t>(1, (po.memoryCapMB << 20) /
+                    estimateScannerBytes(jobs.front().inputPath)));
+  // EVERY WARP THREAD GETS ITS SHARE OF THE CORES FOR ITS TILES, NOT ALL OF
+  // THEM (warpThreads x CORES THREADS OTHERWISE)
+  DSOptions scannerOptions = options;
+  if (scannerOptions.warpTileThreads == 0)
+    scannerOptions.warpTileThreads =
+      max(1u, max(1u, thread::hardware_concurrency()) / po.warpThreads);
+  vector<unique_ptr<DocumentScanner>> scanners;
+  BoundedQueue<DocumentScanner*> freeScanners(nScanners);
+  for (size_t i = 0; i < nScanners; ++i)
+  {
+    scanners.push_back(make_unique<DocumentScanner>(scannerOptions));
+    freeScanners.push(scanners.back().get());
+  }
+  BoundedQueue<Work> decoded(po.queueCapacity);
+  BoundedQueue<Work> segmented(po.queueCapacity);
+  BoundedQueue<Work> warped(po.queueCapacity);
+
+  // EVERY STAGE HAS ITS OWN THREADS; OPENCV'S WOULD ONLY OVERSUBSCRIBE
+  unsigned int nThreads = po.decodeThreads + po.segmentThreads +
+                          po.warpThreads + po.encodeThreads;
+  unique_ptr<CvThreadsGuard> cvThreads;
+  if (po.singleThreadedOpenCV && nThreads > 1)
+    cvThreads = make_unique<CvThreadsGuard>(1);
+
+  // 1. DECODE: TAKE A FREE SCANNER, THEN THE NEXT JOB
+  atomic<size_t> nextIdx{0};
+  atomic<unsigned int> liveDecoders{po.decodeThreads};
+  auto decode = [&]()
+  {
+    DocumentScanner* ds = nullptr;
+    while (freeScanners.pop(ds))
+    {
+      size_t i = nextIdx++;
+      if (i >= jobs.size())
+      {
+        // NOTHING LEFT TO START; WAKE THE OTHER DECODERS TOO
+        freeScanners.close();
+        break;
+      }
+      Work w;
+      w.index = i;
+      w.ds    = ds;
+      w.result.inputPath  = jobs[i].inputPath;
+      w.result.outputPath = jobs[i].outputPath;
+      try
+      {
+        ds->reset(jobs[i].inputPath);
+      }
+      catch (const exception& exp)
+      {
+        w.result.error = string("decode: ") + exp.what();
+      }
+      decoded.push(std::move(w));
+    }
+    if (--liveDecoders == 0)
+      decoded.close();
+  };
+
+  // 2. SEGMENT
+  atomic<unsigned int> liveSegmenters{po.segmentThreads};
+  auto segment = [&]()
+  {
+    runStage(decoded, segmented, "segment", [&po](Work& w)
+    {
+      if (po.multiDocument)
+        w.ds->findDocuments();
+      else if (!w.ds->restoreCachedResult())
+      {
+        w.ds->runDetection();
+        w.ds->findCorners();
+      }
+    });
+    if (--liveSegmenters == 0)
+      segmented.close();
+  };
+
+  // 3. WARP
+  atomic<unsigned int> liveWarpers{po.warpThreads};
+  auto warp = [&]()
+  {
+    runStage(segmented, warped, "warp", [this, &po](Work& w)
+    {
+      if (po.multiDocument)
+      {
+        w.ds->warpDocuments();
+        return;
+      }
+      // UNDER AN OUTPUT BUDGET, PNM PAGES GO STRAIGHT TO DISK BAND BY BAND
+      // (A BINARIZED PAGE NEEDS THE WHOLE WARP, BUT IS A 24TH OF ITS SIZE)
+      if (options.outputBudgetMB > 0 && !options.binarize &&
+          PnmStripSink::handles(w.result.outputPath))
+      {
+        {
+          PnmStripSink sink(w.result.outputPath);
+          w.ds->warpToSink(sink);
+        }
+        w.written = true;
+        // WRITTEN BAND BY BAND INSIDE THE WARP; ONLY THE SIZE TO REPORT
+        error_code ec;
+        auto bytes = filesystem::file_size(w.result.outputPath, ec);
+        w.result.encode.format = outputFormat(w.result.outputPath);
+        w.result.encode.bytes  = ec ? 0 : static_cast<size_t>(bytes);
+      }
+      else
+      {
+        w.ds->performFindHomography();
+        if (options.binarize)
+          w.ds->binarize();
+      }
+    });
+    if (--liveWarpers == 0)
+      warped.close();
+  };
+
+  // 4. ENCODE: WRITE THE PAGE, RECYCLE THE SCANNER, REPORT
+  auto encode = [&]()
+  {
+    Work w;
+    while (warped.pop(w))
+    {
+      BatchResult& result = w.result;
+      result.detector = w.ds->getDetector();
+      result.degraded = w.ds->isDegraded();
+      result.degradedReason = w.ds->getDegradedReason();
+      result.trace    = w.ds->getTracer();
+      result.trace.setDocName(result.inputPath);
+      if (result.error.empty() && w.written)
+        result.succeeded = true;
+      else if (result.error.empty() && po.multiDocument)
+        savePages(*w.ds, result);
+      else if (result.error.empty())
+      {
+        try
+        {
+          const cv::Mat& page = w.ds->getFinalImg();
+          ScopedSpan span(result.trace, "saveFinalImg", page.cols, page.rows);
+          result.succeeded = w.ds->saveFinalImg(result.outputPath,
+                                                &result.encode);
+        }
+        catch (const exception& exp)
+        {
+          result.error = string("encode: ") + exp.what();
+        }
+        if (!result.succeeded && result.error.empty())
+          result.error = "Could not write " + result.outputPath;
+      }
+      freeScanners.push(w.ds);
+      if (onDone)
+        onDone(result);
+      results[w.index] = std::move(result);
+    }
+  };
+
+  vector<thread> threads;
+  for (unsigned int i = 0; i < po.decodeThreads; ++i)
+    threads.emplace_back(decode);
+  for (unsigned int i = 0; i < po.segmentThreads; ++i)
+    threads.emplace_back(segment);
+  for (unsigned int i = 0; i < po.warpThreads; ++i)
+    threads.emplace_back(warp);
+  for (unsigned int i = 0; i < po.encodeThreads; ++i)
+    threads.emplace_back(encode);
+  for (auto& t : threads)
+    t.join();
+  return results;
+}
+
+/************************ ENCODER POOL ****************************************/
+EncoderPool::EncoderPool(unsigned int nThreads, EncodeOptions opts,
+                         size_t queueCapacity) :
+  options(opts), tasks(queueCapacity)
+{
+  for (unsigned int i = 0; i < max(1u, nThreads); ++i)
+    threads.emplace_back(&EncoderPool::work, this);
+}
+
+EncoderPool::~EncoderPool()
+{
+  finish();
+}
+
+void EncoderPool::work()
+{
+  Task task;
+  while (tasks.pop(task))
+  {
+    EncodeReport report;
+    try
+    {
+      bool written = task.bits.empty() ?
+                     writePage(task.path, task.page, options, &report) :
+                     writePage(task.path, task.bits, options, &report);
+      if (!written)
+        throw runtime_error("Could not write " + task.path);
+      task.done.set_value(report);
+    }
+    catch (...)
+    {
+      task.done.set_exception(current_exception());
+    }
+  }
+}
+
+future<EncodeReport> EncoderPool::submit(cv::Mat page, string path)
+{
+  Task task;
+  task.page = std::move(page);
+  task.path = std::move(path);
+  future<EncodeReport> done = task.done.get_future();
+  tasks.push(std::move(task));
+  return done;
+}
+
+future<EncodeReport> EncoderPool::submit(BinaryPage page, string path)
+{
+  Task task;
+  task.bits = std::move(page);
+  task.path = std::move(path);
+  future<EncodeReport> done = task.done.get_future();
+  tasks.push(std::move(task));
+  return done;
+}
+
+void EncoderPool::finish()
+{
+  tasks.close();
+  for (auto& t : threads)
+    if (t.joinable())
+      t.join();
+  threads.clear();
+}
@@ -0,0 +1,213 @@
+//
+// Staged decode -> segment -> warp -> encode pipeline with bounded queues.
+//
+
+#ifndef DOCUMENTSCANNER_DSPIPELINE_H
+#define DOCUMENTSCANNER_DSPIPELINE_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "DocumentScanner.h"
+
+struct BatchResult
+{
+  std::string inputPath;
+  std::string outputPath;
+  // Multi-document runs: one file per page found, outputPath numbered
+  // <stem>_<k><ext> in reading order
+  std::vector<std::string> pagePaths;
+  bool        succeeded = false;
+  // Out of latency budget: corners from a fallback (see
+  // DSOptions::latencyBudgetMs); degradedReason says which
+  bool        degraded = false;
+  std::string degradedReason;
+  DetectionEngine detector = DetectionEngine::GRABCUT;
+  std::string error;
+  StageTracer trace;
+  // Format, quality, bytes and encode time of the page written (summed
+  // over the pages of a multi-document run)
+  EncodeReport encode;
+};
+
+// Fixed-capacity blocking FIFO. push() waits while the queue is full, which
+// is what pushes back on a stage that runs ahead of the one after it.
+template <typename T>
+class BoundedQueue
+{
+private:
+  std::deque<T> items;
+  size_t capacity;
+  bool closed = false;
+  std::mutex mtx;
+  std::condition_variable notFull, notEmpty;
+
+public:
+  /****************************** CONSTRUCTORS ********************************/
+  explicit BoundedQueue(size_t cap) : capacity(cap > 0 ? cap : 1) {}
+
+  /*************************** PUBLIC METHODS *********************************/
+  void push(T item)
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    notFull.wait(lock, [this] { return items.size() < capacity || closed; });
+    items.push_back(std::move(item));
+    notEmpty.notify_one();
+  }
+  // False once the queue is closed and drained
+  bool pop(T& item)
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    notEmpty.wait(lock, [this] { return !items.empty() || closed; });
+    if (items.empty())
+      return false;
+    item = std::move(items.front());
+    items.pop_front();
+    notFull.notify_one();
+    return true;
+  }
+  // No more pushes; wakes every waiting consumer
+  void close()
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    closed = true;
+    notEmpty.notify_all();
+    notFull.notify_all();
+  }
+  // Undoes close() for a queue that is used again
+  void reopen()
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    closed = false;
+  }
+};
+
+struct PipelineOptions
+{
+  // Threads per stage; segmentThreads == 0 uses the hardware threads left
+  // over after the other three stages
+  unsigned int decodeThreads  = 1;
+  unsigned int segmentThreads = 0;
+  unsigned int warpThreads    = 1;
+  unsigned int encodeThreads  = 1;
+  // Capacity of each queue between two stages
+  size_t queueCapacity = 2;
+  // Documents alive at once (each owns a scanner and its work buffers);
+  // 0 = one per stage thread plus one per queue slot, but no more than fit
+  // in memoryCapMB
+  size_t maxInFlight = 0;
+  // Memory the automatic maxInFlight may plan for (MB), at an estimated
+  // cost per scanner from the size of the first input; 0 = no cap
+  size_t memoryCapMB = 2048;
+  // cv::setNumThreads(1) for the duration of run(), so OpenCV's own threads
+  // don't oversubscribe the stage threads. Process-wide: any other OpenCV
+  // user in the process runs single-threaded until run() returns.
+  bool singleThreadedOpenCV = true;
+  // findDocuments() + warpDocuments() instead of the single page path
+  bool multiDocument = false;
+};
+
+// Every document moves through four stages, each with its own threads:
+//   decode   read + decode the file, downscale, blur   (DocumentScanner::reset)
+//   segment  runDetection + findCorners, unless restoreCachedResult() hits
+//            (or findDocuments)
+//   warp     performFindHomography, then binarize when DSOptions::binarize
+//            (or warpDocuments; full-resolution decode on demand)
+//   encode   encode and write the page (DSOptions::encodeOptions)
+// so disk reads and JPEG encodes overlap with detection on other documents.
+// Memory is bounded by maxInFlight: a document only enters the pipeline
+// once a scanner is free, and scanners are reused with all their buffers.
+class DocumentPipeline
+{
+public:
+  struct Job
+  {
+    std::string inputPath;
+    std::string outputPath;
+  };
+  // Called from an encode thread as each document leaves the pipeline
+  using DoneCallback = std::function<void(const BatchResult&)>;
+
+private:
+  struct Work
+  {
+    size_t index = 0;
+    DocumentScanner* ds = nullptr;
+    BatchResult result;
+    // The warp stage already streamed the page to outputPath
+    bool written = false;
+  };
+
+  DSOptions options;
+  PipelineOptions pipeOptions;
+
+  /******************************* PRIVATE METHODS ****************************/
+  void runStage(BoundedQueue<Work>& in, BoundedQueue<Work>& out,
+                const std::string& stageName,
+                const std::function<void(Work&)>& work);
+  void savePages(const DocumentScanner& ds, BatchResult& result) const;
+
+public:
+  /****************************** CONSTRUCTORS ********************************/
+  explicit DocumentPipeline(DSOptions opts = DSOptions(),
+                            PipelineOptions pipeOpts = PipelineOptions());
+
+  /**************************** SETTERS & GETTERS *****************************/
+  [[nodiscard]] const PipelineOptions& getPipelineOptions() const;
+  // Thread counts after resolving the 0 = automatic defaults
+  [[nodiscard]] PipelineOptions resolvedOptions() const;
+
+  /*************************** PUBLIC METHODS *********************************/
+  // Results are returned in job order, whatever order they finished in
+  std::vector<BatchResult> run(const std::vector<Job>& jobs,
+                               const DoneCallback& onDone = nullptr);
+};
+
+// Encodes and writes pages on threads of its own, so a producer handing
+// over one page at a time (e.g. VideoScanner's page callback) goes straight
+// back to detection. submit() only blocks while queueCapacity pages are
+// already waiting. The destructor writes whatever is still queued.
+class EncoderPool
+{
+private:
+  struct Task
+  {
+    cv::Mat page;
+    BinaryPage bits;
+    std::string path;
+    std::promise<EncodeReport> done;
+  };
+
+  EncodeOptions options;
+  BoundedQueue<Task> tasks;
+  std::vector<std::thread> threads;
+
+  /******************************* PRIVATE METHODS ****************************/
+  void work();
+
+public:
+  /****************************** CONSTRUCTORS ********************************/
+  explicit EncoderPool(unsigned int nThreads = 1,
+                       EncodeOptions opts = EncodeOptions(),
+                       size_t queueCapacity = 4);
+  EncoderPool(const EncoderPool&) = delete;
+  EncoderPool& operator=(const EncoderPool&) = delete;
+  ~EncoderPool();
+
+  /*************************** PUBLIC METHODS *********************************/
+  // The page is shared, not copied: clone a buffer the caller will reuse.
+  // The future throws if the page could not be encoded or written.
+  std::future<EncodeReport> submit(cv::Mat page, std::string path);
+  std::future<EncodeReport> submit(BinaryPage page, std::string path);
+  // Writes everything queued, then stops the threads; no submit() after
+  void finish();
+};
+
+#endif //DOCUMENTSCANNER_DSPIPELINE_H
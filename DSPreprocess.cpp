@@ -0,0 +1,262 @@
+//
+// Fused downscale + blur + gray + threshold preprocessing kernel.
+//
+#include "DSPreprocess.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include <opencv2/core/hal/intrin.hpp>
+
+using namespace std;
+using namespace cv;
+
+static const int BOX_RADIUS = 4;  // 9x9 box
+static const int STRIP_ROWS = 32; // output rows per parallel work item
+// round(sum / 81) == ((sum + 40) * 12946) >> 20, exact for every sum <= 81*255
+static const unsigned BOX_ROUND = 40, BOX_MUL = 12946, BOX_SHIFT = 20;
+// BT.601 luma in 8-bit fixed point, weights sum to 256
+static const unsigned GRAY_B = 29, GRAY_G = 150, GRAY_R = 77;
+
+static inline int reflect101(int i, int n)
+{
+  if (n == 1)
+    return 0;
+  while (i < 0 || i >= n)
+    i = i < 0 ? -i : 2 * n - 2 - i;
+  return i;
+}
+
+// AREA-AVERAGE SOURCE ROWS [y0, y1) INTO ONE WORKING ROW
+/******************************************************************************/
+// The vertical sum streams the large source rows once (SIMD); the horizontal
+// one runs on the accumulator, which is already 1/(y1-y0) of the data.
+static void downscaleRow(const Mat& src, int y0, int y1,
+                         const vector<int>& xBounds, vector<unsigned>& acc,
+                         uchar* dst)
+{
+  const int n = src.cols * 3;
+  fill(acc.begin(), acc.end(), 0u);
+  for (int y = y0; y < y1; ++y)
+  {
+    const uchar* s = src.ptr<uchar>(y);
+    int i = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+    const int step  = VTraits<v_uint8>::vlanes();
+    const int quart = VTraits<v_uint32>::vlanes();
+    for (; i <= n - step; i += step)
+    {
+      v_uint16 lo, hi;
+      v_expand(vx_load(s + i), lo, hi);
+      v_uint32 a, b, c, d;
+      v_expand(lo, a, b);
+      v_expand(hi, c, d);
+      unsigned* p = acc.data() + i;
+      v_store(p,             v_add(vx_load(p), a));
+      v_store(p + quart,     v_add(vx_load(p + quart), b));
+      v_store(p + 2 * quart, v_add(vx_load(p + 2 * quart), c));
+      v_store(p + 3 * quart, v_add(vx_load(p + 3 * quart), d));
+    }
+#endif
+    for (; i < n; ++i)
+      acc[i] += s[i];
+  }
+
+  const unsigned rows = static_cast<unsigned>(y1 - y0);
+  const int dstCols = static_cast<int>(xBounds.size()) - 1;
+  for (int x = 0; x < dstCols; ++x)
+  {
+    unsigned sum[3] = {0, 0, 0};
+    for (int sx = xBounds[x]; sx < xBounds[x + 1]; ++sx)
+      for (int c = 0; c < 3; ++c)
+        sum[c] += acc[3 * sx + c];
+    unsigned area = rows * static_cast<unsigned>(xBounds[x + 1] - xBounds[x]);
+    for (int c = 0; c < 3; ++c)
+      dst[3 * x + c] = static_cast<uchar>((sum[c] + area / 2) / area);
+  }
+}
+
+// rowSum += add - sub (ALL SUMS STAY WITHIN 9 * 255)
+/******************************************************************************/
+static void slideColumnSums(ushort* rowSum, const uchar* add, const uchar* sub,
+                            int n)
+{
+  int i = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+  const int step = VTraits<v_uint8>::vlanes();
+  const int half = VTraits<v_uint16>::vlanes();
+  for (; i <= n - step; i += step)
+  {
+    v_uint16 addLo, addHi, subLo, subHi;
+    v_expand(vx_load(add + i), addLo, addHi);
+    v_expand(vx_load(sub + i), subLo, subHi);
+    // ADD BEFORE SUBTRACTING: THE 16-BIT OPS SATURATE
+    v_store(rowSum + i,
+            v_sub(v_add(vx_load(rowSum + i), addLo), subLo));
+    v_store(rowSum + i + half,
+            v_sub(v_add(vx_load(rowSum + i + half), addHi), subHi));
+  }
+#endif
+  for (; i < n; ++i)
+    rowSum[i] = static_cast<ushort>(rowSum[i] + add[i] - sub[i]);
+}
+
+// HORIZONTAL 9-TAP BOX + /81 + THRESHOLD ON ONE ROW
+/******************************************************************************/
+// padded holds the column sums with BOX_RADIUS reflected pixels on each side
+static void boxRow(const ushort* padded, int n, uchar* blurred, uchar* thresh,
+                   uchar threshValue)
+{
+  int i = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+  const int step = VTraits<v_uint8>::vlanes();
+  const int half = VTraits<v_uint16>::vlanes();
+  const v_uint16 mul   = vx_setall_u16(static_cast<ushort>(BOX_MUL));
+  const v_uint16 round = vx_setall_u16(static_cast<ushort>(BOX_ROUND));
+  const v_uint8  thr   = vx_setall_u8(threshValue);
+  auto divide = [&](const v_uint16& sum)
+  {
+    v_uint32 a, b;
+    v_mul_expand(v_add(sum, round), mul, a, b);
+    return v_pack(v_shr<BOX_SHIFT>(a), v_shr<BOX_SHIFT>(b));
+  };
+  for (; i <= n - step; i += step)
+  {
+    v_uint16 lo = vx_load(padded + i);
+    v_uint16 hi = vx_load(padded + i + half);
+    for (int k = 1; k < 2 * BOX_RADIUS + 1; ++k)
+    {
+      lo = v_add(lo, vx_load(padded + i + 3 * k));
+      hi = v_add(hi, vx_load(padded + i + half + 3 * k));
+    }
+    v_uint8 value = v_pack(divide(lo), divide(hi));
+    v_store(blurred + i, value);
+    v_store(thresh + i, v_gt(value, thr));
+  }
+#endif
+  for (; i < n; ++i)
+  {
+    unsigned sum = 0;
+    for (int k = 0; k < 2 * BOX_RADIUS + 1; ++k)
+      sum += padded[i + 3 * k];
+    auto value = static_cast<uchar>(((sum + BOX_ROUND) * BOX_MUL) >> BOX_SHIFT);
+    blurred[i] = value;
+    thresh[i]  = value > threshValue ? 255 : 0;
+  }
+}
+
+// LUMA OF ONE BGR ROW
+/******************************************************************************/
+static void grayRow(const uchar* bgr, int cols, uchar* gray)
+{
+  int x = 0;
+#if (CV_SIMD || CV_SIMD_SCALABLE)
+  const int step = VTraits<v_uint8>::vlanes();
+  const v_uint16 wb = vx_setall_u16(GRAY_B), wg = vx_setall_u16(GRAY_G),
+                 wr = vx_setall_u16(GRAY_R), round = vx_setall_u16(128);
+  auto luma = [&](const v_uint16& b, const v_uint16& g, const v_uint16& r)
+  {
+    return v_shr<8>(v_add(v_add(v_mul_wrap(b, wb), v_mul_wrap(g, wg)),
+                          v_add(v_mul_wrap(r, wr), round)));
+  };
+  for (; x <= cols - step; x += step)
+  {
+    v_uint8 b, g, r;
+    v_load_deinterleave(bgr + 3 * x, b, g, r);
+    v_uint16 bLo, bHi, gLo, gHi, rLo, rHi;
+    v_expand(b, bLo, bHi);
+    v_expand(g, gLo, gHi);
+    v_expand(r, rLo, rHi);
+    v_store(gray + x, v_pack(luma(bLo, gLo, rLo), luma(bHi, gHi, rHi)));
+  }
+#endif
+  for (; x < cols; ++x)
+    gray[x] = static_cast<uchar>((bgr[3 * x] * GRAY_B +
+                                  bgr[3 * x + 1] * GRAY_G +
+                                  bgr[3 * x + 2] * GRAY_R + 128) >> 8);
+}
+
+// FUSED PREPROCESS
+/******************************************************************************/
+void fusedPreprocess(const Mat& src, cv::Size workSize, Mat& work,
+                     Mat& blurred, Mat& gray, Mat& thresh, int threshValue)
+{
+  CV_Assert(src.type() == CV_8UC3);
+  CV_Assert(workSize.width > 0 && workSize.height > 0 &&
+            workSize.width <= src.cols && workSize.height <= src.rows);
+  const bool downscale = workSize != src.size();
+  const int W = workSize.width, H = workSize.height, n = W * 3;
+  if (downscale)
+    work.create(workSize, CV_8UC3);
+  blurred.create(workSize, CV_8UC3);
+  gray.create(workSize, CV_8U);
+  thresh.create(workSize, CV_8UC3);
+
+  // AREA BOUNDARIES: WORKING PIXEL x COVERS SOURCE [xBounds[x], xBounds[x+1])
+  vector<int> xBounds(W + 1), yBounds(H + 1);
+  for (int x = 0; x <= W; ++x)
+    xBounds[x] = static_cast<int>(static_cast<int64>(x) * src.cols / W);
+  for (int y = 0; y <= H; ++y)
+    yBounds[y] = static_cast<int>(static_cast<int64>(y) * src.rows / H);
+  const uchar thr = saturate_cast<uchar>(threshValue);
+
+  const int nStrips = (H + STRIP_ROWS - 1) / STRIP_ROWS;
+  parallel_for_(Range(0, nStrips), [&](const Range& range)
+  {
+    vector<unsigned> acc(downscale ? src.cols * 3 : 0);
+    vector<uchar> halo;
+    vector<const uchar*> rows;
+    vector<ushort> colSums(n + 6 * BOX_RADIUS);
+    for (int strip = range.start; strip < range.end; ++strip)
+    {
+      const int y0 = strip * STRIP_ROWS, y1 = min(H, y0 + STRIP_ROWS);
+      // WORKING ROWS THIS STRIP READS, INCLUDING THE REFLECTED HALO
+      const int r0 = max(0, y0 - BOX_RADIUS), r1 = min(H, y1 + BOX_RADIUS);
+      rows.assign(r1 - r0, nullptr);
+      if (downscale)
+      {
+        // OWN ROWS GO STRAIGHT TO work; HALO ROWS (OWNED BY THE NEIGHBOURING
+        // STRIPS) ARE RECOMPUTED INTO A SMALL LOCAL BUFFER
+        halo.resize(static_cast<size_t>(2 * BOX_RADIUS) * n);
+        int haloRow = 0;
+        for (int r = r0; r < r1; ++r)
+        {
+          uchar* dst = r >= y0 && r < y1 ? work.ptr<uchar>(r)
+                                         : halo.data() + n * haloRow++;
+          downscaleRow(src, yBounds[r], yBounds[r + 1], xBounds, acc, dst);
+          rows[r - r0] = dst;
+        }
+      }
+      else
+        for (int r = r0; r < r1; ++r)
+          rows[r - r0] = src.ptr<uchar>(r);
+      auto row = [&](int r) { return rows[reflect101(r, H) - r0]; };
+
+      // VERTICAL BOX AS RUNNING COLUMN SUMS, STORED AFTER A REFLECTED PAD
+      ushort* sums = colSums.data() + 3 * BOX_RADIUS;
+      fill(colSums.begin(), colSums.end(), 0);
+      for (int k = -BOX_RADIUS; k <= BOX_RADIUS; ++k)
+      {
+        const uchar* r = row(y0 + k);
+        for (int i = 0; i < n; ++i)
+          sums[i] = static_cast<ushort>(sums[i] + r[i]);
+      }
+      for (int y = y0; y < y1; ++y)
+      {
+        if (y > y0)
+          slideColumnSums(sums, row(y + BOX_RADIUS), row(y - BOX_RADIUS - 1),
+                          n);
+        for (int p = 1; p <= BOX_RADIUS; ++p)
+        {
+          int left = reflect101(-p, W), right = reflect101(W - 1 + p, W);
+          memcpy(sums - 3 * p, sums + 3 * left, 3 * sizeof(ushort));
+          memcpy(sums + 3 * (W - 1 + p), sums + 3 * right, 3 * sizeof(ushort));
+        }
+        uchar* blurredRow = blurred.ptr<uchar>(y);
+        boxRow(colSums.data(), n, blurredRow, thresh.ptr<uchar>(y), thr);
+        grayRow(blurredRow, W, gray.ptr<uchar>(y));
+      }
+    }
+  });
+}
@@ -0,0 +1,195 @@
+//
+// Quadrilateral fitting and validation for detected document outlines.
+//
+#include "DSQuad.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <opencv2/imgproc.hpp>
+
+using namespace std;
+using namespace cv;
+
+// ORDER QUAD: CW FROM THE UPPER LEFT
+/******************************************************************************/
+void orderQuad(vector<Point2f>& quad)
+{
+  CV_Assert(quad.size() == 4);
+  Point2f center(0.f, 0.f);
+  for (const auto& p : quad)
+    center += p * 0.25f;
+  // IMAGE Y POINTS DOWN, SO INCREASING atan2 IS CLOCKWISE ON SCREEN
+  sort(quad.begin(), quad.end(), [&](const Point2f& a, const Point2f& b)
+  {
+    return atan2(a.y - center.y, a.x - center.x) <
+           atan2(b.y - center.y, b.x - center.x);
+  });
+  // THE TOP EDGE IS THE ONE CLOSEST TO HORIZONTAL, RUNNING LEFT TO RIGHT
+  int upperLeft = 0;
+  double bestCos = -2.0;
+  for (int i = 0; i < 4; ++i)
+  {
+    Point2f edge = quad[(i + 1) % 4] - quad[i];
+    double length = norm(edge);
+    double cosine = length > 0.0 ? edge.x / length : -1.0;
+    if (cosine > bestCos)
+    {
+      bestCos   = cosine;
+      upperLeft = i;
+    }
+  }
+  rotate(quad.begin(), quad.begin() + upperLeft, quad.end());
+}
+
+// FIT QUAD
+/******************************************************************************/
+// Twice the area of triangle abc
+static inline double triangleArea2(const Point& a, const Point& b,
+                                   const Point& c)
+{
+  return abs(static_cast<double>(b.x - a.x) * (c.y - a.y) -
+             static_cast<double>(b.y - a.y) * (c.x - a.x));
+}
+
+// Largest quadrilateral on the vertices of a convex polygon. For a diagonal
+// (i, k) the best vertex on either side maximizes a unimodal triangle area,
+// and moves forward only as k does, so each i costs O(h).
+static void largestInscribedQuad(const vector<Point>& hull,
+                                 vector<Point2f>& quad)
+{
+  const int h = static_cast<int>(hull.size());
+  auto at = [&](int i) -> const Point& { return hull[i % h]; };
+  double bestArea = -1.0;
+  int best[4] = {0, 1, 2, 3};
+  for (int i = 0; i < h; ++i)
+  {
+    int j = i + 1, l = i + 3;
+    for (int k = i + 2; k <= i + h - 2; ++k)
+    {
+      while (j + 1 < k &&
+             triangleArea2(at(i), at(j + 1), at(k)) >=
+             triangleArea2(at(i), at(j), at(k)))
+        ++j;
+      l = max(l, k + 1);
+      while (l + 1 < i + h &&
+             triangleArea2(at(k), at(l + 1), at(i)) >=
+             triangleArea2(at(k), at(l), at(i)))
+        ++l;
+      double area = triangleArea2(at(i), at(j), at(k)) +
+                    triangleArea2(at(k), at(l), at(i));
+      if (area > bestArea)
+      {
+        bestArea = area;
+        best[0] = i;
+        best[1] = j;
+        best[2] = k;
+        best[3] = l;
+      }
+    }
+  }
+  quad.clear();
+  for (int idx : best)
+    quad.emplace_back(static_cast<float>(at(idx).x),
+                      static_cast<float>(at(idx).y));
+}
+
+// Replaces each side of quad by a Huber line fit to the contour points
+// along its middle 80%, then intersects neighbouring sides. A side with too
+// few points, or a corner that would move implausibly far, is kept.
+static void refineQuadEdges(const vector<Point>& contour,
+                            vector<Point2f>& quad)
+{
+  // EACH SIDE AS A POINT AND A UNIT DIRECTION
+  Point2f origin[4], direction[4];
+  vector<Point2f> along;
+  double shortest = numeric_limits<double>::max();
+  for (int s = 0; s < 4; ++s)
+  {
+    Point2f a = quad[s], b = quad[(s + 1) % 4];
+    double length = norm(b - a);
+    shortest = min(shortest, length);
+    origin[s] = a;
+    direction[s] = (b - a) * static_cast<float>(1.0 / max(length, 1e-9));
+    if (length < 8.0)
+      continue;
+    Point2f normal(-direction[s].y, direction[s].x);
+    double band = max(2.0, 0.02 * length);
+    along.clear();
+    for (const auto& p : contour)
+    {
+      Point2f d = Point2f(static_cast<float>(p.x), static_cast<float>(p.y)) -
+                  a;
+      double t = d.dot(direction[s]);
+      if (t > 0.1 * length && t < 0.9 * length &&
+          abs(d.dot(normal)) <= band)
+        along.push_back(a + d);
+    }
+    if (along.size() < 5)
+      continue;
+    Vec4f line;
+    fitLine(along, line, DIST_HUBER, 0, 0.01, 0.01);
+    direction[s] = Point2f(line[0], line[1]);
+    origin[s]    = Point2f(line[2], line[3]);
+  }
+
+  double maxMove = 0.05 * shortest;
+  for (int c = 0; c < 4; ++c)
+  {
+    // CORNER c JOINS SIDE c - 1 (ENDING THERE) AND SIDE c (STARTING THERE)
+    const int s0 = (c + 3) % 4, s1 = c;
+    double cross = direction[s0].x * direction[s1].y -
+                   direction[s0].y * direction[s1].x;
+    if (abs(cross) < 1e-3)
+      continue;
+    Point2f delta = origin[s1] - origin[s0];
+    double t = (delta.x * direction[s1].y - delta.y * direction[s1].x) / cross;
+    Point2f corner = origin[s0] + direction[s0] * static_cast<float>(t);
+    if (norm(corner - quad[c]) <= maxMove)
+      quad[c] = corner;
+  }
+}
+
+bool fitQuad(const vector<cv::Point>& contour, vector<Point2f>& quad)
+{
+  quad.clear();
+  if (contour.size() < 4)
+    return false;
+  vector<cv::Point> hull;
+  convexHull(contour, hull, true);
+  if (hull.size() < 4)
+    return false;
+  largestInscribedQuad(hull, quad);
+  if (contourArea(quad) <= 0.0)
+    return false;
+  // CLOCKWISE ON SCREEN BEFORE THE SIDES ARE REFINED
+  orderQuad(quad);
+  refineQuadEdges(contour, quad);
+  orderQuad(quad);
+  return contourArea(quad) > 0.0;
+}
+
+// IS VALID QUAD
+/******************************************************************************/
+bool isValidQuad(const vector<Point2f>& quad, double minArea,
+                 double blobArea, double minFill)
+{
+  if (quad.size() != 4 || !isContourConvex(quad))
+    return false;
+  double area = contourArea(quad);
+  if (area < minArea)
+    return false;
+  if (blobArea > 0.0 && blobArea < minFill * area)
+    return false;
+  // |cos| OF EVERY CORNER ANGLE BELOW cos(45 deg)
+  for (int i = 0; i < 4; ++i)
+  {
+    Point2f a = quad[(i + 3) % 4] - quad[i];
+    Point2f b = quad[(i + 1) % 4] - quad[i];
+    double lengths = norm(a) * norm(b);
+    if (lengths <= 0.0 || abs(a.dot(b)) / lengths > 0.7071)
+      return false;
+  }
+  return true;
+}
@@ -0,0 +1,32 @@
+//
+// Quadrilateral fitting and validation for detected document outlines.
+//
+
+#ifndef DOCUMENTSCANNER_DSQUAD_H
+#define DOCUMENTSCANNER_DSQUAD_H
+
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+// Reorders four points CW starting from the upper left: the corner whose
+// CW edge points closest to +x, so a page rotated by anything under 45 deg
+// either way keeps its labelling
+void orderQuad(std::vector<cv::Point2f>& quad);
+
+// Four-corner fit of a blob outline, for any rotation: the largest-area
+// quadrilateral inscribed in its convex hull (O(n log n) hull, then O(h^2)
+// over the h hull vertices), then each side replaced by a robust line fit
+// to the outline points along it and the corners re-intersected, which
+// gives sub-pixel corners and recovers rounded or dog-eared ones. Ordered
+// with orderQuad(). Returns false for degenerate outlines.
+bool fitQuad(const std::vector<cv::Point>& contour,
+             std::vector<cv::Point2f>& quad);
+
+// A plausible page: convex, at least minArea px^2, every interior angle
+// within 45 deg of a right angle, and filled by the blob it came from to at
+// least minFill (blobArea <= 0 skips that test)
+bool isValidQuad(const std::vector<cv::Point2f>& quad, double minArea,
+                 double blobArea = 0.0, double minFill = 0.8);
+
+#endif //DOCUMENTSCANNER_DSQUAD_H
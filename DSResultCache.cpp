@@ -0,0 +1,170 @@
+//
+// Persistent cache of detection results keyed by input content.
+//
+#include "DSResultCache.h"
+
+#include <cstdio>
+#include <sstream>
+#include <thread>
+
+using namespace std;
+using namespace cv;
+namespace fs = std::filesystem;
+
+/************************ CONSTRUCTOR ***************************************/
+ResultCache::ResultCache(fs::path cacheDir) : dir(std::move(cacheDir))
+{
+  fs::create_directories(dir);
+}
+
+/***************************** GETTERS & SETTERS ******************************/
+size_t ResultCache::getHits() const
+{
+  lock_guard<mutex> lock(mtx);
+  return hits;
+}
+
+size_t ResultCache::getMisses() const
+{
+  lock_guard<mutex> lock(mtx);
+  return misses;
+}
+
+fs::path ResultCache::pathFor(const string& key) const
+{
+  return dir / key.substr(0, 2) / (key + ".yml");
+}
+
+// LOOKUP
+/******************************************************************************/
+bool ResultCache::lookup(const string& key, CachedResult& result)
+{
+  fs::path path = pathFor(key);
+  bool found = false;
+  error_code ec;
+  if (fs::exists(path, ec))
+  {
+    FileStorage fsIn(path.string(), FileStorage::READ);
+    if (fsIn.isOpened())
+    {
+      vector<float> xy, docs;
+      fsIn["corners"] >> xy;
+      fsIn["documents"] >> docs;
+      result.documents.clear();
+      if (!docs.empty() && docs.size() % 8 == 0)
+      {
+        for (size_t d = 0; d < docs.size(); d += 8)
+        {
+          vector<Point2f> corners;
+          for (size_t i = d; i < d + 8; i += 2)
+            corners.emplace_back(docs[i], docs[i + 1]);
+          result.documents.push_back(std::move(corners));
+        }
+        result.detector = static_cast<int>(fsIn["detector"]);
+        found = true;
+      }
+      if (xy.size() == 8)
+      {
+        result.corners.clear();
+        for (size_t i = 0; i < 8; i += 2)
+          result.corners.emplace_back(xy[i], xy[i + 1]);
+        result.orientation = static_cast<int>(fsIn["orientation"]);
+        result.detector    = static_cast<int>(fsIn["detector"]);
+        result.outputSize  = cv::Size(static_cast<int>(fsIn["width"]),
+                                      static_cast<int>(fsIn["height"]));
+        result.corrected   = static_cast<int>(fsIn["corrected"]) != 0;
+        found = true;
+      }
+    }
+  }
+  lock_guard<mutex> lock(mtx);
+  ++(found ? hits : misses);
+  return found;
+}
+
+// STORE
+/******************************************************************************/
+bool ResultCache::store(const string& key, const CachedResult& result)
+{
+  if (result.corners.size() != 4 && result.documents.empty())
+    return false;
+  fs::path path = pathFor(key);
+  error_code ec;
+  fs::create_directories(path.parent_path(), ec);
+
+  ostringstream tmpName;
+  tmpName << path.string() << ".tmp" << this_thread::get_id();
+  string tmpPath = tmpName.str();
+  {
+    FileStorage fsOut(tmpPath, FileStorage::WRITE);
+    if (!fsOut.isOpened())
+      return false;
+    vector<float> xy;
+    for (const auto& corner : result.corners)
+    {
+      xy.push_back(corner.x);
+      xy.push_back(corner.y);
+    }
+    fsOut << "corners" << xy;
+    // ONE FLAT LIST, EIGHT COORDINATES PER PAGE
+    vector<float> docs;
+    for (const auto& corners : result.documents)
+    {
+      if (corners.size() != 4)
+        return false;
+      for (const auto& corner : corners)
+      {
+        docs.push_back(corner.x);
+        docs.push_back(corner.y);
+      }
+    }
+    if (!docs.empty())
+      fsOut << "documents" << docs;
+    fsOut << "orientation" << result.orientation;
+    fsOut << "detector" << result.detector;
+    fsOut << "width" << result.outputSize.width;
+    fsOut << "height" << result.outputSize.height;
+    fsOut << "corrected" << static_cast<int>(result.corrected);
+  }
+  fs::rename(tmpPath, path, ec);
+  if (ec)
+  {
+    fs::remove(tmpPath, ec);
+    return false;
+  }
+  return true;
+}
+
+// STATIC
+uint64_t ResultCache::hashBytes(const void* data, size_t size, uint64_t seed)
+{
+  const auto* bytes = static_cast<const unsigned char*>(data);
+  uint64_t h = seed;
+  for (size_t i = 0; i < size; ++i)
+  {
+    h ^= bytes[i];
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+uint64_t ResultCache::hashMat(const Mat& image)
+{
+  int header[4] = {image.cols, image.rows, image.type(), 0};
+  uint64_t h = hashBytes(header, sizeof(header));
+  size_t rowBytes = image.cols * image.elemSize();
+  for (int y = 0; y < image.rows; ++y)
+    h = hashBytes(image.ptr(y), rowBytes, h);
+  return h;
+}
+
+string ResultCache::makeKey(uint64_t contentHash, const string& detectionParams)
+{
+  uint64_t paramHash = hashBytes(detectionParams.data(),
+                                 detectionParams.size());
+  char key[40];
+  snprintf(key, sizeof(key), "%016llx%08x",
+           static_cast<unsigned long long>(contentHash),
+           static_cast<unsigned int>(paramHash ^ (paramHash >> 32)));
+  return key;
+}
@@ -0,0 +1,64 @@
+//
+// Persistent cache of detection results keyed by input content.
+//
+
+#ifndef DOCUMENTSCANNER_DSRESULTCACHE_H
+#define DOCUMENTSCANNER_DSRESULTCACHE_H
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+// What a later run needs to go straight to the warp
+struct CachedResult
+{
+  // Full-resolution corners, CW from the upper left
+  std::vector<cv::Point2f> corners;
+  int orientation = 0;   // DocOrientation
+  int detector = 0;      // DetectionEngine
+  cv::Size outputSize;   // page size the last warp produced
+  bool corrected = false; // corners were adjusted by hand in drawLines()
+  // findDocuments(): every page's full-resolution corners, in reading order
+  std::vector<std::vector<cv::Point2f>> documents;
+};
+
+// One small YAML sidecar per input under <dir>/<first 2 hex>/<key>.yml.
+// The key is a 64-bit hash of the input bytes (or decoded pixels) plus every
+// option that changes detection, so new detector settings miss, while
+// output-only settings (aspect ratio, format, warp cache) still hit.
+// Writes go to a temporary file renamed into place, so concurrent scanners
+// and interrupted runs never leave a torn sidecar. Thread-safe.
+class ResultCache
+{
+private:
+  std::filesystem::path dir;
+  size_t hits = 0, misses = 0;
+  mutable std::mutex mtx;
+
+  [[nodiscard]] std::filesystem::path pathFor(const std::string& key) const;
+
+public:
+  /****************************** CONSTRUCTORS ********************************/
+  explicit ResultCache(std::filesystem::path cacheDir);
+
+  /*************************** PUBLIC METHODS *********************************/
+  bool lookup(const std::string& key, CachedResult& result);
+  bool store(const std::string& key, const CachedResult& result);
+  [[nodiscard]] size_t getHits() const;
+  [[nodiscard]] size_t getMisses() const;
+
+  /**************************** STATIC METHODS ********************************/
+  // FNV-1a, continuing from seed
+  static uint64_t hashBytes(const void* data, size_t size,
+                            uint64_t seed = 0xcbf29ce484222325ull);
+  static uint64_t hashMat(const cv::Mat& image);
+  // 16 hex digits of contentHash, then the detection parameters' hash
+  static std::string makeKey(uint64_t contentHash,
+                             const std::string& detectionParams);
+};
+
+#endif //DOCUMENTSCANNER_DSRESULTCACHE_H
@@ -0,0 +1,186 @@
+//
+// Tile-parallel perspective warp streamed to a sink one band at a time.
+//
+#include "DSTiledWarp.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <future>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <opencv2/imgproc.hpp>
+
+using namespace std;
+using namespace cv;
+
+/************************ PNM STRIP SINK ************************************/
+PnmStripSink::PnmStripSink(string filePath) : path(std::move(filePath))
+{
+}
+
+void PnmStripSink::begin(cv::Size pageSize, int type)
+{
+  CV_Assert(type == CV_8UC3 || type == CV_8UC1);
+  out.open(path, ios::binary | ios::trunc);
+  if (!out)
+    throw runtime_error("Could not write " + path);
+  out << (type == CV_8UC3 ? "P6" : "P5") << "\n"
+      << pageSize.width << " " << pageSize.height << "\n255\n";
+}
+
+void PnmStripSink::write(const cv::Mat& strip, int)
+{
+  // PNM IS RGB; ROWS ARE WRITTEN AS-IS FOR GRAY
+  const Mat* rows = &strip;
+  if (strip.channels() == 3)
+  {
+    cvtColor(strip, rgb, COLOR_BGR2RGB);
+    rows = &rgb;
+  }
+  size_t rowBytes = rows->cols * rows->elemSize();
+  for (int y = 0; y < rows->rows; ++y)
+    out.write(reinterpret_cast<const char*>(rows->ptr(y)),
+              static_cast<streamsize>(rowBytes));
+}
+
+void PnmStripSink::end()
+{
+  out.close();
+  if (out.fail())
+    throw runtime_error("Could not write " + path);
+}
+
+bool PnmStripSink::handles(const string& filePath)
+{
+  size_t dot = filePath.find_last_of('.');
+  if (dot == string::npos)
+    return false;
+  string ext = filePath.substr(dot);
+  transform(ext.begin(), ext.end(), ext.begin(),
+            [](unsigned char c) { return tolower(c); });
+  return ext == ".ppm" || ext == ".pgm" || ext == ".pnm";
+}
+
+/************************ MAT STRIP SINK ************************************/
+void MatStripSink::begin(cv::Size pageSize, int type)
+{
+  page.create(pageSize, type);
+}
+
+void MatStripSink::write(const cv::Mat& strip, int y)
+{
+  Mat rows = page.rowRange(y, y + strip.rows);
+  strip.copyTo(rows);
+}
+
+// BAND HEIGHT FROM A MEMORY BUDGET
+/******************************************************************************/
+int bandRowsForBudget(cv::Size pageSize, int type, size_t budgetBytes,
+                      int tileRows)
+{
+  if (budgetBytes == 0)
+    return pageSize.height;
+  size_t rowBytes = static_cast<size_t>(pageSize.width) * CV_ELEM_SIZE(type);
+  size_t rows = budgetBytes / max<size_t>(1, 2 * rowBytes);
+  rows = rows / tileRows * tileRows; // WHOLE TILE ROWS
+  return static_cast<int>(min<size_t>(max<size_t>(rows, tileRows),
+                                      pageSize.height));
+}
+
+// WARP ONE TILE FROM THE SOURCE RECTANGLE IT MAPS BACK TO
+/******************************************************************************/
+static void warpTile(const Mat& src, const Matx33d& h, const Matx33d& hInv,
+                     cv::Rect tile, Mat& dst)
+{
+  // TILE CORNERS BACK INTO THE SOURCE; THE QUAD IS CONVEX, SO ITS BOUNDING
+  // BOX (PLUS THE BILINEAR FOOTPRINT) HOLDS EVERY SAMPLE
+  vector<Point2f> outCorners = {
+    Point2f(tile.x, tile.y), Point2f(tile.x + tile.width, tile.y),
+    Point2f(tile.x + tile.width, tile.y + tile.height),
+    Point2f(tile.x, tile.y + tile.height)
+  };
+  vector<Point2f> srcCorners;
+  perspectiveTransform(outCorners, srcCorners, Mat(hInv));
+  cv::Rect roi = boundingRect(srcCorners);
+  roi.x -= 2;
+  roi.y -= 2;
+  roi.width  += 4;
+  roi.height += 4;
+  roi &= cv::Rect(0, 0, src.cols, src.rows);
+  if (roi.empty())
+  {
+    dst.setTo(Scalar::all(0));
+    return;
+  }
+  // page = h * src  =>  tile = T(-tile.tl) * h * T(roi.tl) * roi
+  Matx33d shift = Matx33d(1, 0, -tile.x, 0, 1, -tile.y, 0, 0, 1) * h *
+                  Matx33d(1, 0, roi.x, 0, 1, roi.y, 0, 0, 1);
+  warpPerspective(src(roi), dst, Mat(shift), tile.size(), INTER_LINEAR,
+                  BORDER_CONSTANT);
+}
+
+// TILED WARP
+/******************************************************************************/
+void tiledWarp(const Mat& src, const Mat& h, cv::Size pageSize,
+               StripSink& sink, int bandRows, cv::Size tileSize,
+               unsigned int numThreads)
+{
+  if (numThreads == 0)
+    numThreads = max(1u, thread::hardware_concurrency());
+  Mat hd;
+  h.convertTo(hd, CV_64F);
+  Matx33d h33(hd.ptr<double>());
+  Matx33d hInv = h33.inv();
+  bandRows = max(1, min(bandRows, pageSize.height));
+  tileSize.width  = max(1, min(tileSize.width, pageSize.width));
+  tileSize.height = max(1, min(tileSize.height, bandRows));
+
+  sink.begin(pageSize, src.type());
+  Mat bands[2];
+  future<void> pending;
+  int bandIdx = 0;
+  for (int y0 = 0; y0 < pageSize.height; y0 += bandRows, ++bandIdx)
+  {
+    int rows = min(bandRows, pageSize.height - y0);
+    Mat& band = bands[bandIdx % 2];
+    band.create(rows, pageSize.width, src.type());
+
+    // EVERY TILE OF THE BAND IN PARALLEL, ON THREADS OF ITS OWN (THE
+    // PIPELINE RUNS OPENCV SINGLE-THREADED, SO parallel_for_ WOULD NOT BE)
+    int tilesX = (pageSize.width + tileSize.width - 1) / tileSize.width;
+    int tilesY = (rows + tileSize.height - 1) / tileSize.height;
+    int numTiles = tilesX * tilesY;
+    atomic<int> nextTile{0};
+    auto warpTiles = [&]()
+    {
+      for (int t = nextTile++; t < numTiles; t = nextTile++)
+      {
+        cv::Rect inBand((t % tilesX) * tileSize.width,
+                        (t / tilesX) * tileSize.height, tileSize.width,
+                        tileSize.height);
+        inBand &= cv::Rect(0, 0, pageSize.width, rows);
+        Mat dst = band(inBand);
+        warpTile(src, h33, hInv, inBand + cv::Point(0, y0), dst);
+      }
+    };
+    vector<future<void>> workers;
+    for (unsigned int i = 1; i < min<unsigned int>(numThreads, numTiles); ++i)
+      workers.push_back(async(launch::async, warpTiles));
+    warpTiles();
+    for (auto& worker : workers)
+      worker.get();
+
+    // THE PREVIOUS BAND (IN THE OTHER BUFFER) MUST BE OUT BEFORE THIS ONE
+    if (pending.valid())
+      pending.get();
+    pending = async(launch::async, [&sink, &band, y0]() {
+      sink.write(band, y0);
+    });
+  }
+  if (pending.valid())
+    pending.get();
+  sink.end();
+}
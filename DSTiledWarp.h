@@ -0,0 +1,72 @@
+//
+// Tile-parallel perspective warp streamed to a sink one band at a time.
+//
+
+#ifndef DOCUMENTSCANNER_DSTILEDWARP_H
+#define DOCUMENTSCANNER_DSTILEDWARP_H
+
+#include <fstream>
+#include <string>
+
+#include <opencv2/core.hpp>
+
+// Receives the warped page top to bottom, one band of full-width rows at a
+// time. write() runs on its own thread while the next band is warped.
+class StripSink
+{
+public:
+  virtual ~StripSink() = default;
+  virtual void begin(cv::Size pageSize, int type) = 0;
+  virtual void write(const cv::Mat& strip, int y) = 0;
+  virtual void end() = 0;
+};
+
+// Streams a binary PPM (BGR input) or PGM (gray input) to disk, so no more
+// than one band of the page is ever in memory
+class PnmStripSink : public StripSink
+{
+private:
+  std::string path;
+  std::ofstream out;
+  cv::Mat rgb;
+
+public:
+  explicit PnmStripSink(std::string filePath);
+  void begin(cv::Size pageSize, int type) override;
+  void write(const cv::Mat& strip, int y) override;
+  void end() override;
+  // true for .ppm / .pgm / .pnm
+  static bool handles(const std::string& filePath);
+};
+
+// Assembles the page in memory (for encoders that need the whole image)
+class MatStripSink : public StripSink
+{
+private:
+  cv::Mat& page;
+
+public:
+  explicit MatStripSink(cv::Mat& dst) : page(dst) {}
+  void begin(cv::Size pageSize, int type) override;
+  void write(const cv::Mat& strip, int y) override;
+  void end() override {}
+};
+
+// Warps src through h (src -> page coordinates) into a pageSize page. Each
+// band of bandRows rows is cut into tileSize tiles, each warped from just
+// the source rectangle it maps back to; a finished band goes to the sink
+// while the next one is warped. The tiles run on numThreads threads of the
+// warp's own (0 = one per hardware thread), so it stays parallel under
+// cv::setNumThreads(1). Peak memory besides src is two bands plus one
+// source rectangle per thread.
+void tiledWarp(const cv::Mat& src, const cv::Mat& h, cv::Size pageSize,
+               StripSink& sink, int bandRows,
+               cv::Size tileSize = cv::Size(512, 256),
+               unsigned int numThreads = 0);
+
+// Band height that keeps two bands of a pageSize page of this type within
+// budgetBytes (at least one tile row, at most the whole page)
+int bandRowsForBudget(cv::Size pageSize, int type, size_t budgetBytes,
+                      int tileRows = 256);
+
+#endif //DOCUMENTSCANNER_DSTILEDWARP_H
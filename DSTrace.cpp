@@ -0,0 +1,169 @@
+//
+// Lightweight per-document stage tracing.
+//
+#include "DSTrace.h"
+
+#include <atomic>
+#include <iomanip>
+#include <sstream>
+#include <ctime>
+
+using namespace std;
+
+static const auto processEpoch = chrono::steady_clock::now();
+
+// ESCAPE A STRING FOR A JSON STRING LITERAL
+/******************************************************************************/
+static string jsonEscape(const string& str)
+{
+  string out;
+  out.reserve(str.size());
+  for (char c : str)
+  {
+    switch (c)
+    {
+    case '"':  out += "\\\""; break;
+    case '\\': out += "\\\\"; break;
+    case '\n': out += "\\n";  break;
+    case '\t': out += "\\t";  break;
+    default:
+      if (static_cast<unsigned char>(c) < 0x20)
+        continue;
+      out += c;
+    }
+  }
+  return out;
+}
+
+/************************ CONSTRUCTOR ***************************************/
+StageTracer::StageTracer(string documentName) : docName(std::move(documentName))
+{
+}
+
+/***************************** GETTERS & SETTERS ******************************/
+void StageTracer::setDocName(const string& name)
+{
+  docName = name;
+}
+
+const string& StageTracer::getDocName() const
+{
+  return docName;
+}
+
+const vector<TraceSpan>& StageTracer::getSpans() const
+{
+  return spans;
+}
+
+// Sum of the outermost spans only: a nested span is recorded before the span
+// enclosing it, so it is skipped when a later span covers its interval.
+int64_t StageTracer::totalWallUs() const
+{
+  int64_t total = 0;
+  for (size_t i = 0; i < spans.size(); ++i)
+  {
+    bool nested = false;
+    for (size_t j = i + 1; j < spans.size() && !nested; ++j)
+      nested = spans[j].startUs <= spans[i].startUs &&
+               spans[j].startUs + spans[j].wallUs >=
+               spans[i].startUs + spans[i].wallUs;
+    if (!nested)
+      total += spans[i].wallUs;
+  }
+  return total;
+}
+
+/******************************************************************************/
+void StageTracer::record(TraceSpan span)
+{
+  spans.push_back(std::move(span));
+}
+
+void StageTracer::clear()
+{
+  spans.clear();
+}
+
+// ONE LINE PER DOCUMENT
+/******************************************************************************/
+string StageTracer::toLogLine() const
+{
+  ostringstream line;
+  line << fixed << setprecision(2)
+       << "doc=" << docName << " total=" << totalWallUs() / 1000.0 << "ms";
+  for (const auto& span : spans)
+    line << " " << span.name << "=" << span.wallUs / 1000.0 << "/"
+         << span.cpuUs / 1000.0 << "cpu@" << span.width << "x" << span.height;
+  return line.str();
+}
+
+// CHROME TRACE-EVENT JSON ("X" = COMPLETE EVENTS)
+/******************************************************************************/
+void StageTracer::writeChromeTrace(ostream& os,
+                                   const vector<StageTracer>& tracers)
+{
+  os << "{\"traceEvents\":[";
+  bool first = true;
+  for (const auto& tracer : tracers)
+    for (const auto& span : tracer.spans)
+    {
+      os << (first ? "\n" : ",\n")
+         << "{\"name\":\"" << jsonEscape(span.name) << "\",\"cat\":\"stage\""
+         << ",\"ph\":\"X\",\"ts\":" << span.startUs
+         << ",\"dur\":" << span.wallUs
+         << ",\"pid\":1,\"tid\":" << span.threadId
+         << ",\"args\":{\"doc\":\"" << jsonEscape(tracer.docName) << "\""
+         << ",\"cpu_us\":" << span.cpuUs
+         << ",\"width\":" << span.width << ",\"height\":" << span.height
+         << "}}";
+      first = false;
+    }
+  os << "\n],\"displayTimeUnit\":\"ms\"}" << endl;
+}
+
+/**************************** STATIC METHODS ********************************/
+int64_t StageTracer::wallNowUs()
+{
+  return chrono::duration_cast<chrono::microseconds>(
+    chrono::steady_clock::now() - processEpoch).count();
+}
+
+int64_t StageTracer::threadCpuNowUs()
+{
+  timespec ts{};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+int StageTracer::currentThreadId()
+{
+  static atomic<int> nextId{1};
+  thread_local int id = nextId++;
+  return id;
+}
+
+/************************ SCOPED SPAN ***************************************/
+ScopedSpan::ScopedSpan(StageTracer& t, string name, int width, int height) :
+  tracer(t)
+{
+  span.name     = std::move(name);
+  span.width    = width;
+  span.height   = height;
+  span.threadId = StageTracer::currentThreadId();
+  span.cpuUs    = StageTracer::threadCpuNowUs();
+  span.startUs  = StageTracer::wallNowUs();
+}
+
+ScopedSpan::~ScopedSpan()
+{
+  span.wallUs = StageTracer::wallNowUs() - span.startUs;
+  span.cpuUs  = StageTracer::threadCpuNowUs() - span.cpuUs;
+  tracer.record(std::move(span));
+}
+
+void ScopedSpan::setSize(int width, int height)
+{
+  span.width  = width;
+  span.height = height;
+}
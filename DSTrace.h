@@ -0,0 +1,74 @@
+//
+// Lightweight per-document stage tracing.
+//
+
+#ifndef DOCUMENTSCANNER_DSTRACE_H
+#define DOCUMENTSCANNER_DSTRACE_H
+
+#include <cstdint>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+struct TraceSpan
+{
+  std::string name;
+  int64_t startUs = 0; // wall clock, microseconds since process start
+  int64_t wallUs  = 0;
+  int64_t cpuUs   = 0; // CPU time of the recording thread
+  int width       = 0; // dimensions of the image the stage worked on
+  int height      = 0;
+  int threadId    = 0; // small, stable per-thread id (Chrome "tid")
+};
+
+// Collects the spans of one document. Spans are recorded by the thread that
+// runs the stage; one tracer is never written by two threads at once.
+class StageTracer
+{
+private:
+  std::string docName;
+  std::vector<TraceSpan> spans;
+
+public:
+  /****************************** CONSTRUCTORS ********************************/
+  explicit StageTracer(std::string documentName = "");
+
+  /**************************** SETTERS & GETTERS *****************************/
+  void setDocName(const std::string& name);
+  [[nodiscard]] const std::string& getDocName() const;
+  [[nodiscard]] const std::vector<TraceSpan>& getSpans() const;
+  [[nodiscard]] int64_t totalWallUs() const;
+
+  /*************************** PUBLIC METHODS *********************************/
+  void record(TraceSpan span);
+  void clear();
+  // doc=<name> total=<ms> <stage>=<wall ms>/<cpu ms>cpu@<w>x<h> ...
+  [[nodiscard]] std::string toLogLine() const;
+
+  /**************************** STATIC METHODS ********************************/
+  // Chrome trace-event JSON (chrome://tracing, Perfetto) for many documents
+  static void writeChromeTrace(std::ostream& os,
+                               const std::vector<StageTracer>& tracers);
+  static int64_t wallNowUs();
+  static int64_t threadCpuNowUs();
+  static int currentThreadId();
+};
+
+// RECORDS ONE SPAN FROM CONSTRUCTION TO DESTRUCTION
+class ScopedSpan
+{
+private:
+  StageTracer& tracer;
+  TraceSpan span;
+
+public:
+  ScopedSpan(StageTracer& t, std::string name, int width = 0, int height = 0);
+  ~ScopedSpan();
+  // For stages that only learn the image size while running (e.g. decoding)
+  void setSize(int width, int height);
+  ScopedSpan(const ScopedSpan&) = delete;
+  ScopedSpan& operator=(const ScopedSpan&) = delete;
+};
+
+#endif //DOCUMENTSCANNER_DSTRACE_H
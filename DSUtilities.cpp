@@ -7,7 +7,7 @@ using namespace std;
 
 static char waitBar[] = {'|', '/', '-', '\\'};
 
-void spinWaiting(int ms, const bool& stop, string& message)
+void spinWaiting(int ms, const atomic<bool>& stop, string& message)
 {
   if (!message.empty())
   {
@@ -33,4 +33,49 @@ void spinWaiting(int ms, const bool& stop, string& message)
       }
     }
   }
-}
\ No newline at end of file
+}
+
+// READ JPEG SIZE
+/******************************************************************************/
+bool readJpegSize(const vector<unsigned char>& bytes, int& width, int& height)
+{
+  return readJpegSize(bytes.data(), bytes.size(), width, height);
+}
+
+bool readJpegSize(const unsigned char* bytes, size_t n, int& width,
+                  int& height)
+{
+  if (n < 4 || bytes[0] != 0xFF || bytes[1] != 0xD8)
+    return false;
+  size_t pos = 2;
+  while (pos + 3 < n)
+  {
+    if (bytes[pos] != 0xFF)
+      return false;
+    unsigned char marker = bytes[pos + 1];
+    if (marker == 0xFF) // FILL BYTE
+    {
+      ++pos;
+      continue;
+    }
+    pos += 2;
+    // STANDALONE MARKERS CARRY NO LENGTH
+    if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7))
+      continue;
+    if (marker == 0xD9 || marker == 0xDA) // EOI / SOS: NO FRAME HEADER FOUND
+      return false;
+    size_t length = (bytes[pos] << 8) | bytes[pos + 1];
+    // SOF0..SOF15, EXCEPT DHT (C4), JPG (C8) AND DAC (CC)
+    if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 &&
+        marker != 0xC8 && marker != 0xCC)
+    {
+      if (pos + 7 > n)
+        return false;
+      height = (bytes[pos + 3] << 8) | bytes[pos + 4];
+      width  = (bytes[pos + 5] << 8) | bytes[pos + 6];
+      return width > 0 && height > 0;
+    }
+    pos += length;
+  }
+  return false;
+}
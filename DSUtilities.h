@@ -9,10 +9,22 @@
 #include <queue>
 #include <thread>
 #include <chrono>
+#include <atomic>
+#include <vector>
+#include <string>
 
 #define DEBUG_PRINT(var)	std::cout << (var) << ": Line: " << __LINE__ \
                                     << std::endl;
 
-void spinWaiting(int ms, const bool& stop, std::string& message);
+// Console spinner. No longer used by DocumentScanner::run (see DSTrace.h);
+// `stop` is atomic so it can be flipped safely from another thread.
+void spinWaiting(int ms, const std::atomic<bool>& stop, std::string& message);
+
+// Width/height from a JPEG's SOF header without decoding anything. Returns
+// false for non-JPEG data. The size is before any EXIF orientation.
+bool readJpegSize(const unsigned char* bytes, size_t n, int& width,
+                  int& height);
+bool readJpegSize(const std::vector<unsigned char>& bytes, int& width,
+                  int& height);
 
 #endif //DOCUMENTSCANNER_DSUTILITIES_H
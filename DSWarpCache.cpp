@@ -0,0 +1,155 @@
+//
+// Cache of fixed-point remap tables for repeated warp geometry.
+//
+#include "DSWarpCache.h"
+
+#include <opencv2/imgproc.hpp>
+
+using namespace std;
+using namespace cv;
+
+bool WarpMapCache::Key::operator<(const Key& other) const
+{
+  if (corners != other.corners)
+    return corners < other.corners;
+  if (srcWidth != other.srcWidth)
+    return srcWidth < other.srcWidth;
+  if (srcHeight != other.srcHeight)
+    return srcHeight < other.srcHeight;
+  if (outWidth != other.outWidth)
+    return outWidth < other.outWidth;
+  return outHeight < other.outHeight;
+}
+
+/************************ CONSTRUCTOR ***************************************/
+WarpMapCache::WarpMapCache(size_t maxCacheBytes, float gridQuantum) :
+  maxBytes(maxCacheBytes), quantum(gridQuantum > 0.0f ? gridQuantum : 1.0f)
+{
+}
+
+/******************************************************************************/
+void WarpMapCache::quantize(vector<cv::Point2f>& corners) const
+{
+  for (auto& corner : corners)
+  {
+    corner.x = cvRound(corner.x / quantum) * quantum;
+    corner.y = cvRound(corner.y / quantum) * quantum;
+  }
+}
+
+// GET MAPS: LRU LOOKUP, BUILD ON MISS
+/******************************************************************************/
+void WarpMapCache::getMaps(const vector<cv::Point2f>& corners,
+                           cv::Size srcSize, cv::Size outSize,
+                           const cv::Mat& h, cv::Mat& map1, cv::Mat& map2)
+{
+  Key key{};
+  for (size_t i = 0; i < 4 && i < corners.size(); ++i)
+  {
+    key.corners[2 * i]     = cvRound(corners[i].x / quantum);
+    key.corners[2 * i + 1] = cvRound(corners[i].y / quantum);
+  }
+  key.srcWidth  = srcSize.width;
+  key.srcHeight = srcSize.height;
+  key.outWidth  = outSize.width;
+  key.outHeight = outSize.height;
+
+  {
+    lock_guard<mutex> lock(mtx);
+    auto found = entries.find(key);
+    if (found != entries.end())
+    {
+      ++hits;
+      lru.splice(lru.begin(), lru, found->second.lruPos);
+      map1 = found->second.map1;
+      map2 = found->second.map2;
+      return;
+    }
+    ++misses;
+  }
+
+  // BUILD OUTSIDE THE LOCK; A RACING DUPLICATE BUILD IS HARMLESS
+  buildMaps(h, outSize, map1, map2);
+
+  lock_guard<mutex> lock(mtx);
+  if (entries.count(key))
+    return;
+  Entry entry{map1, map2, {}};
+  size_t bytes = entryBytes(entry);
+  if (bytes > maxBytes)
+    return;
+  while (bytesUsed + bytes > maxBytes && !lru.empty())
+  {
+    auto victim = entries.find(lru.back());
+    bytesUsed -= entryBytes(victim->second);
+    entries.erase(victim);
+    lru.pop_back();
+  }
+  lru.push_front(key);
+  entry.lruPos = lru.begin();
+  entries.emplace(key, entry);
+  bytesUsed += bytes;
+}
+
+/***************************** GETTERS ****************************************/
+size_t WarpMapCache::getHits() const
+{
+  lock_guard<mutex> lock(mtx);
+  return hits;
+}
+
+size_t WarpMapCache::getMisses() const
+{
+  lock_guard<mutex> lock(mtx);
+  return misses;
+}
+
+void WarpMapCache::clear()
+{
+  lock_guard<mutex> lock(mtx);
+  entries.clear();
+  lru.clear();
+  bytesUsed = 0;
+}
+
+/**************************** STATIC METHODS ********************************/
+size_t WarpMapCache::entryBytes(const Entry& e)
+{
+  return e.map1.total() * e.map1.elemSize() +
+         e.map2.total() * e.map2.elemSize();
+}
+
+// BUILD MAPS: inverse perspective mapping of every output pixel, converted
+// to the fixed-point representation cv::remap consumes fastest
+/******************************************************************************/
+void WarpMapCache::buildMaps(const cv::Mat& h, cv::Size outSize,
+                             cv::Mat& map1, cv::Mat& map2)
+{
+  Mat hInv;
+  cv::invert(h, hInv);
+  hInv.convertTo(hInv, CV_64F);
+  const double* m = hInv.ptr<double>();
+
+  Mat mapXY(outSize, CV_32FC2);
+  cv::parallel_for_(cv::Range(0, outSize.height), [&](const cv::Range& r)
+  {
+    for (int y = r.start; y < r.end; ++y)
+    {
+      auto* row = mapXY.ptr<float>(y);
+      // INCREMENTAL IN x: EACH TERM IS AFFINE IN THE OUTPUT COORDINATE
+      double X = m[1] * y + m[2];
+      double Y = m[4] * y + m[5];
+      double W = m[7] * y + m[8];
+      for (int x = 0; x < outSize.width; ++x)
+      {
+        double w = W != 0.0 ? 1.0 / W : 0.0;
+        row[2 * x]     = static_cast<float>(X * w);
+        row[2 * x + 1] = static_cast<float>(Y * w);
+        X += m[0];
+        Y += m[3];
+        W += m[6];
+      }
+    }
+  });
+  cv::convertMaps(mapXY, cv::noArray(), map1, map2, CV_16SC2);
+}
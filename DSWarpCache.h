@@ -0,0 +1,73 @@
+//
+// Cache of fixed-point remap tables for repeated warp geometry.
+//
+
+#ifndef DOCUMENTSCANNER_DSWARPCACHE_H
+#define DOCUMENTSCANNER_DSWARPCACHE_H
+
+#include <array>
+#include <list>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+// A fixed camera (e.g. a document feeder) sees the same four corners frame
+// after frame. Instead of letting warpPerspective invert the homography for
+// every pixel on every call, the inverse mapping is computed once, stored as
+// CV_16SC2 + CV_16UC1 fixed-point remap tables and reused with cv::remap.
+// Corners are quantized first, so nearby geometry shares one entry and a hit
+// produces exactly the pixels a miss would have produced.
+// Shared by every scanner of a batch; all methods are thread-safe.
+class WarpMapCache
+{
+public:
+  struct Key
+  {
+    std::array<int, 8> corners; // quantized x,y of UL, UR, LR, LL
+    int srcWidth, srcHeight;
+    int outWidth, outHeight;
+    bool operator<(const Key& other) const;
+  };
+
+private:
+  struct Entry
+  {
+    cv::Mat map1; // CV_16SC2 integer coordinates
+    cv::Mat map2; // CV_16UC1 interpolation table index
+    std::list<Key>::iterator lruPos;
+  };
+
+  std::map<Key, Entry> entries;
+  std::list<Key> lru; // most recently used first
+  size_t maxBytes;
+  size_t bytesUsed = 0;
+  float quantum;
+  size_t hits = 0, misses = 0;
+  mutable std::mutex mtx;
+
+  static size_t entryBytes(const Entry& e);
+
+public:
+  /****************************** CONSTRUCTORS ********************************/
+  explicit WarpMapCache(size_t maxCacheBytes = 256u << 20,
+                        float gridQuantum = 1.0f);
+
+  /*************************** PUBLIC METHODS *********************************/
+  // Snap corners to the quantization grid (call before computing the warp)
+  void quantize(std::vector<cv::Point2f>& corners) const;
+  // Remap tables for homography h (source -> output), built on a miss
+  void getMaps(const std::vector<cv::Point2f>& corners, cv::Size srcSize,
+               cv::Size outSize, const cv::Mat& h,
+               cv::Mat& map1, cv::Mat& map2);
+  [[nodiscard]] size_t getHits() const;
+  [[nodiscard]] size_t getMisses() const;
+  void clear();
+
+  /**************************** STATIC METHODS ********************************/
+  static void buildMaps(const cv::Mat& h, cv::Size outSize,
+                        cv::Mat& map1, cv::Mat& map2);
+};
+
+#endif //DOCUMENTSCANNER_DSWARPCACHE_H
@@ -4,59 +4,324 @@
 
 #include "DocumentScanner.h"
 
+#include <algorithm>
+#include <atomic>
 #include <utility>
+#include <limits>
+#include <fstream>
+#include <future>
+#include <sstream>
 
 using namespace std;
 using namespace cv;
 using namespace chrono_literals; // ms, ns, s
 
+// GRABCUT COST UNTIL A SCANNER HAS TIMED ITS OWN: MS PER ITERATION PER
+// MEGAPIXEL OF THE WORKING IMAGE, ERRING SLOW
+static const double GRABCUT_PRIOR_MS_PER_MP = 400.0;
+
 /************************ CONSTRUCTOR ***************************************/
 DocumentScanner::DocumentScanner(string filename, string cornersWinName,
                                  string finalWinName,
-                                 int bordersz) :
-  fileName(std::move(filename)), cornersWinName(cornersWinName), 
-  finalWinName(finalWinName), borderSize(bordersz),
-  pointMover(CVPointMover())
+                                 int bordersz, DSOptions opts) :
+  cornersWinName(cornersWinName), finalWinName(finalWinName),
+  borderSize(bordersz), pointMover(CVPointMover()), options(opts)
+{
+  reset(filename);
+}
+
+DocumentScanner::DocumentScanner(string filename, const DSOptions& opts) :
+  DocumentScanner(std::move(filename), "Detection", "Extracted Document", 2,
+                  opts)
+{
+}
+
+DocumentScanner::DocumentScanner(const cv::Mat& image, const DSOptions& opts) :
+  DocumentScanner(opts)
+{
+  reset(image);
+}
+
+DocumentScanner::DocumentScanner(const uchar* data, size_t size,
+                                 const DSOptions& opts) :
+  DocumentScanner(opts)
+{
+  reset(data, size);
+}
+
+DocumentScanner::DocumentScanner(const DSOptions& opts) :
+  cornersWinName("Detection"), finalWinName("Extracted Document"),
+  borderSize(2), pointMover(CVPointMover()), options(opts)
+{
+}
+
+// RESET: start over on a new input, keeping every pooled work buffer
+/******************************************************************************/
+void DocumentScanner::reset(const string& filename)
 {
+  fileName = filename;
+  resetState();
   if (!loadImage())
     handleError(DSErrorCodes::FILE_LOADING_ERROR);
   else
+    initialize();
+}
+
+void DocumentScanner::reset(const cv::Mat& image)
+{
+  fileName = "<in-memory image>";
+  resetState();
+  // SHARES THE CALLER'S PIXELS; NOTHING WRITES TO pFullImg
+  pFullImg       = make_shared<cv::Mat>(image);
+  pDecodedImg    = pFullImg;
+  fullSize       = image.size();
+  fullResDecoded = true;
+  if (options.resultCache)
+  {
+    contentHash = ResultCache::hashMat(image);
+    cacheKey = ResultCache::makeKey(contentHash, detectionParams());
+  }
+  lookupCachedResult();
+  if (!prepareWorkingImage())
+    handleError(DSErrorCodes::FILE_LOADING_ERROR);
+  else
+    initialize();
+}
+
+void DocumentScanner::reset(const uchar* data, size_t size)
+{
+  fileName = "<in-memory bytes>";
+  resetState();
+  if (data == nullptr || size == 0 ||
+      size > static_cast<size_t>(numeric_limits<int>::max()))
+    handleError(DSErrorCodes::FILE_LOADING_ERROR);
+  // A VIEW OF THE CALLER'S BYTES, NOT A COPY; THE DEFERRED FULL-RESOLUTION
+  // DECODE READS THEM AGAIN
+  encodedBytes = Mat(1, static_cast<int>(size), CV_8U,
+                     const_cast<uchar*>(data));
+  bool decoded;
+  {
+    ScopedSpan span(tracer, "loadImage");
+    decoded = decodeEncoded();
+    span.setSize(pDecodedImg->cols, pDecodedImg->rows);
+  }
+  if (!decoded || !prepareWorkingImage())
+    handleError(DSErrorCodes::FILE_LOADING_ERROR);
+  else
+    initialize();
+}
+
+void DocumentScanner::resetState()
+{
+  encodedBytes.release();
+  orientation  = DocOrientation::NOT_SET;
+  usedDetector = DetectionEngine::GRABCUT;
+  cornerPoints.clear();
+  quadCorners.clear();
+  origPaperContour.clear();
+  documentQuads.clear();
+  pPages.clear();
+  binaryImg = BinaryPage();
+  cacheKey.clear();
+  documentsKey.clear();
+  cachedDocuments.clear();
+  haveCacheHit      = false;
+  preprocessPending = false;
+  cachedCorners.clear();
+  cornersCorrected  = false;
+  deadline          = Deadline::after(options.latencyBudgetMs);
+  degraded          = false;
+  cornersFixed      = false;
+  degradedReason.clear();
+  grabCutIterations = 0;
+  hasGrabCutPrior   = false;
+  grabCutModelReused = false;
+  tracer.clear();
+  tracer.setDocName(fileName);
+}
+
+// INITIALIZE: everything shared by every input once an image is loaded
+/******************************************************************************/
+void DocumentScanner::initialize()
+{
+  // A CACHE HIT GOES STRAIGHT TO THE WARP; DETECTION INPUTS ONLY ON DEMAND
+  if (haveCacheHit)
+    preprocessPending = true;
+  else
+    preprocess();
+  pMask = pool.get("mask", pOrigImg->size(), CV_8U);
+  pMask->setTo(Scalar(0));
+  Point_<int> upperLeft(borderSize, borderSize);
+  Point_<int> lowerRight(pOrigImg->cols - borderSize,
+                         pOrigImg->rows - borderSize);
+  if (!rect)
+    rect = make_shared<cv::Rect>();
+  *rect = Rect_<int>(upperLeft, lowerRight);
+  // NOTE: Points go CW
+
+  // SET ARGUMENTS TO CVPointMover
+  if (!options.headless)
   {
-    pDirtyImg = make_shared<cv::Mat> (Mat(pOrigImg->clone()));
-    GaussianBlur(*pDirtyImg, *pDirtyImg,
-                 cv::Size(9,9), 4.0);
-    pMask = make_shared<cv::Mat> (Mat(pOrigImg->size(), CV_8U,
-                                      Scalar(0)));
-    Point_<int> upperLeft(borderSize, borderSize);
-    Point_<int> lowerRight(pOrigImg->cols - borderSize,
-                           pOrigImg->rows - borderSize);
-    rect = make_shared<cv::Rect> (Rect_<int>(upperLeft, lowerRight));
-    int x = rect->x;
-    int y = rect->y;
-    // NOTE: Points go CW
-
-    // SET ARGUMENTS TO CVPointMover
     namedWindow(cornersWinName);
     cv::setMouseCallback(cornersWinName, on_move<int>, &pointMover);
-    pointMover.setPCleanMat(shared_ptr<cv::Mat>(pOrigImg));
-    pointMover.setPDirtyMat(shared_ptr<cv::Mat>(pDirtyImg));
-    pointMover.setWinName(cornersWinName);
-    grabCutMode = cv::GC_INIT_WITH_RECT;
-    aspectRatio = 8.5 / 11; // 0.773
   }
+  pointMover.setPCleanMat(shared_ptr<cv::Mat>(pOrigImg));
+  // THE EDITOR RENDERS INTO ITS OWN BUFFER; pDirtyImg HOLDS THE BLURRED INPUT
+  pointMover.setPDirtyMat(pool.get("editor"));
+  pointMover.setWinName(cornersWinName);
+  grabCutMode = cv::GC_INIT_WITH_RECT;
 }
 
 // LOAD IMAGE
 /******************************************************************************/
+// The file is read into a reused byte buffer and decoded into a pooled Mat,
+// so same-sized inputs decode without a new pixel allocation. When only
+// detection-resolution pixels are needed the JPEG is decoded at a reduced
+// size and the full decode is deferred to ensureFullRes().
 bool DocumentScanner::loadImage()
 {
-  pOrigImg  = make_shared<cv::Mat>(Mat(cv::imread(fileName)));
-  // SCALE DOWN IMAGE IF TOO LARGE
-  if (pOrigImg->cols > 2000)
-    cv::resize(*pOrigImg, *pOrigImg,
-               cv::Size(pOrigImg->cols / 2, pOrigImg->rows / 2),
-               0, 0);
-  return (!pOrigImg->empty());
+  {
+    ScopedSpan span(tracer, "loadImage");
+    ifstream file(fileName, ios::binary | ios::ate);
+    if (!file)
+      return false;
+    fileBytes.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    if (fileBytes.empty() ||
+        !file.read(reinterpret_cast<char*>(fileBytes.data()),
+                   static_cast<streamsize>(fileBytes.size())))
+      return false;
+    encodedBytes = Mat(1, static_cast<int>(fileBytes.size()), CV_8U,
+                       fileBytes.data());
+    if (!decodeEncoded())
+      return false;
+    span.setSize(pDecodedImg->cols, pDecodedImg->rows);
+  }
+  return prepareWorkingImage();
+}
+
+// DECODE ENCODED: encodedBytes into pDecodedImg (and pFullImg)
+/******************************************************************************/
+bool DocumentScanner::decodeEncoded()
+{
+  pFullImg = pool.get("full");
+  fullResDecoded = false;
+  if (options.resultCache)
+  {
+    contentHash = ResultCache::hashBytes(encodedBytes.data,
+                                         encodedBytes.total());
+    cacheKey = ResultCache::makeKey(contentHash, detectionParams());
+  }
+  // A HIT NEEDS NO DETECTION PIXELS, ONLY THE FULL IMAGE FOR THE WARP
+  lookupCachedResult();
+  if (haveCacheHit || !decodeReduced())
+  {
+    ensureFullRes();
+    pDecodedImg = pFullImg;
+    fullSize    = pFullImg->size();
+  }
+  return !pDecodedImg->empty();
+}
+
+// DECODE REDUCED: DCT-scaled JPEG decode at 1/2, 1/4 or 1/8 size
+/******************************************************************************/
+bool DocumentScanner::decodeReduced()
+{
+  int width = 0, height = 0;
+  if (!options.reducedDecode || options.detectionSize <= 0 ||
+      !readJpegSize(encodedBytes.data, encodedBytes.total(), width, height))
+    return false;
+
+  // LARGEST REDUCTION THAT STILL LEAVES detectionSize PIXELS ON THE LONG SIDE
+  int longSide = max(width, height);
+  int reduction = 8;
+  while (reduction > 1 && longSide / reduction < options.detectionSize)
+    reduction /= 2;
+  if (reduction == 1)
+    return false;
+  int flags = reduction == 8 ? IMREAD_REDUCED_COLOR_8 :
+              reduction == 4 ? IMREAD_REDUCED_COLOR_4 :
+                               IMREAD_REDUCED_COLOR_2;
+
+  pDecodedImg = pool.get("reduced");
+  if (cv::imdecode(encodedBytes, flags, pDecodedImg.get()).empty())
+    return false;
+  // THE HEADER SIZE IS PRE-EXIF; FOLLOW THE DECODER IF IT ROTATED
+  if ((pDecodedImg->cols > pDecodedImg->rows) != (width > height))
+    swap(width, height);
+  fullSize = cv::Size(width, height);
+  return true;
+}
+
+// ENSURE FULL RESOLUTION: decode pFullImg if loading skipped it
+/******************************************************************************/
+void DocumentScanner::ensureFullRes()
+{
+  if (fullResDecoded)
+    return;
+  ScopedSpan span(tracer, "decodeFullRes", fullSize.width, fullSize.height);
+  if (cv::imdecode(encodedBytes, IMREAD_COLOR, pFullImg.get()).empty())
+    // DON'T LET THE PREVIOUS DOCUMENT'S PIXELS SURVIVE A FAILED DECODE
+    pFullImg->release();
+  fullResDecoded = true;
+  // UNDER AN OUTPUT BUDGET THE COMPRESSED COPY IS DEAD WEIGHT FROM HERE ON
+  if (options.outputBudgetMB > 0)
+  {
+    encodedBytes.release();
+    vector<uchar>().swap(fileBytes);
+  }
+}
+
+// PREPARE WORKING IMAGE: derive pOrigImg from pDecodedImg
+/******************************************************************************/
+bool DocumentScanner::prepareWorkingImage()
+{
+  pOrigImg = pDecodedImg;
+  detectionScale = 1.0;
+  if (pDecodedImg->empty() || pDecodedImg->type() != CV_8UC3)
+    return false;
+
+  // SCALE DOWN THE WORKING IMAGE; pFullImg IS KEPT FOR THE FINAL WARP
+  double scale = 1.0;
+  int longSide = max(pDecodedImg->cols, pDecodedImg->rows);
+  if (options.detectionSize > 0 && longSide > options.detectionSize)
+    scale = static_cast<double>(longSide) / options.detectionSize;
+  else if (options.detectionSize <= 0 && pDecodedImg->cols > 2000)
+    scale = 2.0;
+  if (scale > 1.0)
+  {
+    // ONLY SIZED HERE; preprocess() FILLS IT IN THE SAME PASS AS THE BLUR
+    cv::Size workSz(max(1, cvRound(pDecodedImg->cols / scale)),
+                    max(1, cvRound(pDecodedImg->rows / scale)));
+    pOrigImg = pool.get("work", workSz, pDecodedImg->type());
+  }
+  // USE THE EXACT RATIO AFTER ROUNDING
+  detectionScale = static_cast<double>(fullSize.width) / pOrigImg->cols;
+  return true;
+}
+
+// PREPROCESS: one fused pass from pDecodedImg to every detection input
+/******************************************************************************/
+// Fills pOrigImg (when it is a downscaled copy), the blurred pDirtyImg, its
+// grayscale "blurGray" for the quad detector and the 3-channel "thresh"
+// image GrabCut segments.
+void DocumentScanner::preprocess()
+{
+  preprocessPending = false;
+  ScopedSpan span(tracer, "preprocess", pDecodedImg->cols, pDecodedImg->rows);
+  cv::Size workSz = pOrigImg->size();
+  pDirtyImg = pool.get("dirty", workSz, CV_8UC3);
+  fusedPreprocess(*pDecodedImg, workSz, *pOrigImg, *pDirtyImg,
+                  *pool.get("blurGray", workSz, CV_8U),
+                  *pool.get("thresh", workSz, CV_8UC3), 165);
+}
+
+// Detection after a cache hit after all (e.g. a caller that never asked
+// restoreCachedResult()) still gets its inputs
+void DocumentScanner::ensurePreprocessed()
+{
+  if (preprocessPending)
+    preprocess();
 }
 
 // ERROR HANDLER
@@ -70,6 +335,10 @@ void DocumentScanner::handleError(DSErrorCodes errorCode)
     throw runtime_error("File loading error");
   case DSErrorCodes::GRABCUT_ERROR:
     throw runtime_error("cv::grabCut error");
+  case DSErrorCodes::DETECTION_ERROR:
+    throw runtime_error("No document found in " + fileName);
+  case DSErrorCodes::CANCELLED:
+    throw runtime_error("Cancelled: " + fileName);
   default:
     throw runtime_error("Unknown option");
   }
@@ -79,21 +348,70 @@ void DocumentScanner::handleError(DSErrorCodes errorCode)
 /******************************************************************************/
 void DocumentScanner::runGrabCut(int numIterations)
 {
+  ensurePreprocessed();
+  ScopedSpan span(tracer, "runGrabCut", pOrigImg->cols, pOrigImg->rows);
   Mat bgdModel, fgdModel;
-  pGrabCutImg = make_shared<cv::Mat>(pDirtyImg->clone());
-  Mat threshImg;
-  cvtColor(*pGrabCutImg, threshImg, COLOR_BGR2GRAY);
-  threshold(*pGrabCutImg, threshImg, 165, 255,
-            THRESH_BINARY);
-  imshow("Thresh", threshImg);
-  waitKey();
-  destroyWindow("Thresh");
+  // THRESHOLDED BY preprocess()
+  Mat& threshImg = *pool.get("thresh");
+  if (!options.headless)
+  {
+    imshow("Thresh", threshImg);
+    waitKey();
+    destroyWindow("Thresh");
+  }
+  int64_t startUs = StageTracer::wallNowUs();
   try
   {
-    grabCut(threshImg, *pMask, *rect, bgdModel,
-    //grabCut(*pDirtyImg, *pMask, *rect, bgdModel,
-            fgdModel, numIterations, grabCutMode);
-    cout << endl << "Done with grabCut" << endl;
+    // A TRAINED SESSION MODEL NEEDS NO LEARNING AT ALL
+    if (!reuseGrabCutModel(threshImg, bgdModel, fgdModel))
+    {
+      if (options.grabCutWarmStart && seedGrabCutPrior())
+        runGrabCutWarm(threshImg, bgdModel, fgdModel);
+      else if (!deadline.hasLimit())
+      {
+        grabCutMode = cv::GC_INIT_WITH_RECT;
+        grabCut(threshImg, *pMask, *rect, bgdModel,
+        //grabCut(*pDirtyImg, *pMask, *rect, bgdModel,
+                fgdModel, numIterations, grabCutMode);
+        grabCutIterations = numIterations;
+      }
+      else
+      {
+        // ONE ITERATION AT A TIME, SO THE DEADLINE CAN STOP IT BETWEEN THEM
+        grabCutMode = cv::GC_INIT_WITH_RECT;
+        grabCutIterations = 0;
+        while (grabCutIterations < numIterations)
+        {
+          int64_t iterStartUs = StageTracer::wallNowUs();
+          grabCut(threshImg, *pMask, *rect, bgdModel, fgdModel, 1,
+                  grabCutMode);
+          grabCutMode = cv::GC_EVAL;
+          ++grabCutIterations;
+          double iterMs = (StageTracer::wallNowUs() - iterStartUs) / 1000.0;
+          if (grabCutIterations < numIterations &&
+              deadline.remainingMs() < iterMs)
+          {
+            markDegraded("GrabCut cut short by the deadline");
+            break;
+          }
+        }
+      }
+    }
+    // RUNNING COST ESTIMATE FOR DECIDING WHETHER GRABCUT FITS A DEADLINE
+    double iterMs = (StageTracer::wallNowUs() - startUs) / 1000.0 /
+                    max(1, grabCutIterations);
+    grabCutIterationMs = grabCutIterationMs > 0.0 ?
+                         0.8 * grabCutIterationMs + 0.2 * iterMs : iterMs;
+    // FRESHLY LEARNED MODELS BECOME THE SESSION'S, UNLESS CUT SHORT
+    if (options.grabCutModel && !grabCutModelReused && !degraded &&
+        grabCutIterations > 0)
+      options.grabCutModel->update(
+        bgdModel, fgdModel,
+        GrabCutModel::meanLogLikelihood(threshImg, *pMask, bgdModel,
+                                        fgdModel));
+    if (!options.headless)
+      cout << endl << "Done with grabCut (" << grabCutIterations
+           << " iterations)" << endl;
   }
   catch (const char* exp)
   {
@@ -101,12 +419,133 @@ void DocumentScanner::runGrabCut(int numIterations)
     handleError(DSErrorCodes::GRABCUT_ERROR);
   }
 
-  // REPLACE BACKGROUND AND PROBABLY BACKGROUND WITH BLACK (i.e. 0)
-  for(int i = 0; i < pMask->rows; ++i)
-    for(int j = 0; j < pMask->cols; ++j)
-      if (pMask->ptr<uchar>(i, j)[0] == 0 || pMask->ptr(i, j)[2] == 2)
-        for(int chanNum = 0; chanNum < 3; ++chanNum)
-          pGrabCutImg->ptr(i, j)[chanNum] = 0;
+  // REPLACE BACKGROUND AND PROBABLY BACKGROUND WITH BLACK (i.e. 0), STRAIGHT
+  // FROM THE BLURRED GRAY: runFindContours NEEDS NO COLOR CONVERSION
+  pGrabCutImg = pool.get("grabCut", pMask->size(), CV_8U);
+  applyGrabCutLabels(*pool.get("blurGray"), *pMask, *pGrabCutImg);
+}
+
+// GRABCUT PRIOR: seed pMask for GC_INIT_WITH_MASK
+/******************************************************************************/
+// The page is where the edges are: the convex hull of every edge pixel
+// inside rect starts as GC_PR_FGD, the rest as GC_PR_BGD, and the border
+// band outside rect is GC_BGD as with the rectangle init. Edges, not the
+// thresholded image GrabCut segments, so the color models are not learned
+// from the answer. A prior from setGrabCutPrior() (e.g. the previous
+// frame's labels) is used as is. Returns false when one side is too thin
+// to fit GrabCut's color models, so the caller falls back to the rectangle.
+bool DocumentScanner::seedGrabCutPrior()
+{
+  const double minFraction = 0.01;
+  if (hasGrabCutPrior && pool.get("prior")->size() == pMask->size())
+    pool.get("prior")->copyTo(*pMask);
+  else
+  {
+    Mat& edges = *pool.get("edges", pMask->size(), CV_8U);
+    Canny(*pool.get("blurGray"), edges, 50, 150);
+    vector<cv::Point> edgePoints, hull;
+    findNonZero(edges(*rect), edgePoints);
+    pMask->setTo(Scalar(GC_PR_BGD));
+    if (edgePoints.size() >= 3)
+    {
+      convexHull(edgePoints, hull);
+      Mat inRect = (*pMask)(*rect);
+      fillConvexPoly(inRect, hull, Scalar(GC_PR_FGD));
+    }
+    pMask->rowRange(0, rect->y).setTo(Scalar(GC_BGD));
+    pMask->rowRange(rect->y + rect->height, pMask->rows).setTo(Scalar(GC_BGD));
+    pMask->colRange(0, rect->x).setTo(Scalar(GC_BGD));
+    pMask->colRange(rect->x + rect->width, pMask->cols).setTo(Scalar(GC_BGD));
+  }
+
+  Mat& fg = *pool.get("maskDiff", pMask->size(), CV_8U);
+  bitwise_and(*pMask, Scalar(1), fg);
+  double fgFraction = static_cast<double>(countNonZero(fg)) / pMask->total();
+  return fgFraction >= minFraction && fgFraction <= 1.0 - minFraction;
+}
+
+// WARM-STARTED GRABCUT: one iteration at a time until the labels settle
+/******************************************************************************/
+void DocumentScanner::runGrabCutWarm(const cv::Mat& img, cv::Mat& bgdModel,
+                                     cv::Mat& fgdModel)
+{
+  Mat& prevMask = *pool.get("prevMask", pMask->size(), CV_8U);
+  Mat& changed  = *pool.get("maskDiff", pMask->size(), CV_8U);
+  const double maxChanged = options.grabCutTolerance * pMask->total();
+  const double budgetUs   = options.grabCutBudgetMs * 1000.0;
+  const int64_t startUs   = StageTracer::wallNowUs();
+
+  grabCutMode = cv::GC_INIT_WITH_MASK;
+  grabCutIterations = 0;
+  while (true)
+  {
+    pMask->copyTo(prevMask);
+    int64_t iterStartUs = StageTracer::wallNowUs();
+    grabCut(img, *pMask, *rect, bgdModel, fgdModel, 1, grabCutMode);
+    grabCutMode = cv::GC_EVAL;
+    ++grabCutIterations;
+    int64_t nowUs = StageTracer::wallNowUs();
+
+    // CONVERGED WHEN FEW PIXELS SWITCHED BETWEEN (PR_)FGD AND (PR_)BGD
+    bitwise_xor(prevMask, *pMask, changed);
+    bitwise_and(changed, Scalar(1), changed);
+    if (countNonZero(changed) <= maxChanged)
+      break;
+    if (grabCutIterations >= max(1, options.grabCutMaxIterations))
+      break;
+    if (deadline.remainingMs() * 1000.0 < nowUs - iterStartUs)
+    {
+      markDegraded("GrabCut cut short by the deadline");
+      break;
+    }
+    // STOP IF ANOTHER ITERATION LIKE THE LAST ONE WOULD OVERRUN THE BUDGET
+    if (budgetUs > 0.0 &&
+        (nowUs - startUs) + (nowUs - iterStartUs) > budgetUs)
+      break;
+  }
+}
+
+// SESSION GRABCUT MODEL: one frozen-model iteration
+/******************************************************************************/
+// Segments with DSOptions::grabCutModel's GMMs instead of learning new ones,
+// from the same seed as the warm start (the rectangle's when that has too
+// little paper). Returns false, leaving the caller to re-learn, when there
+// is no trained model or its fit to this document has dropped by more than
+// the model's tolerance: a different desk, paper or lighting.
+bool DocumentScanner::reuseGrabCutModel(const cv::Mat& img, cv::Mat& bgdModel,
+                                        cv::Mat& fgdModel)
+{
+  const double minFraction = 0.01;
+  double baseline = 0.0;
+  if (!options.grabCutModel ||
+      !options.grabCutModel->get(bgdModel, fgdModel, baseline))
+    return false;
+  if (!seedGrabCutPrior())
+  {
+    pMask->setTo(Scalar(GC_BGD));
+    (*pMask)(*rect).setTo(Scalar(GC_PR_FGD));
+  }
+  grabCutMode = cv::GC_EVAL_FREEZE_MODEL;
+  grabCut(img, *pMask, *rect, bgdModel, fgdModel, 1, grabCutMode);
+  grabCutIterations = 1;
+
+  Mat& fg = *pool.get("maskDiff", pMask->size(), CV_8U);
+  bitwise_and(*pMask, Scalar(1), fg);
+  double fgFraction = static_cast<double>(countNonZero(fg)) / pMask->total();
+  double fit = GrabCutModel::meanLogLikelihood(img, *pMask, bgdModel,
+                                               fgdModel);
+  if (fgFraction < minFraction || fgFraction > 1.0 - minFraction ||
+      fit < baseline - options.grabCutModel->getTolerance())
+  {
+    if (!options.headless)
+      cout << "GrabCut model fit dropped (" << fit << " vs " << baseline
+           << "), re-learning" << endl;
+    grabCutIterations = 0;
+    return false;
+  }
+  options.grabCutModel->noteReuse();
+  grabCutModelReused = true;
+  return true;
 }
 
 [[maybe_unused]] void DocumentScanner::drawGrabCutRect()
@@ -123,12 +562,14 @@ void DocumentScanner::runGrabCut(int numIterations)
 
 void DocumentScanner::runFindContours()
 {
-  Mat imgGray;
-  cvtColor(*pGrabCutImg, imgGray, COLOR_BGR2GRAY);
+  ScopedSpan span(tracer, "runFindContours", pOrigImg->cols, pOrigImg->rows);
+  const Mat& imgGray = *pGrabCutImg;
   vector<vector<cv::Point> > contours;
   vector<Vec4i> hierarchy;
   findContours(imgGray, contours, hierarchy,
                RETR_EXTERNAL, CHAIN_APPROX_SIMPLE);
+  if (contours.empty())
+    handleError(DSErrorCodes::DETECTION_ERROR);
 
   // Find contour with greatest area
   double area = -1.0;
@@ -147,66 +588,281 @@ void DocumentScanner::runFindContours()
   origPaperContour = std::move(contours[idx]); // transfer value to origPaperContour address
 }
 
-void DocumentScanner::findCorners()
+// FAST QUAD DETECTOR
+/******************************************************************************/
+// Looks for the largest convex 4-point polygon among the edge contours.
+// On success origPaperContour holds the 4 vertices, ready for findCorners.
+bool DocumentScanner::runQuadDetector()
 {
-  // TO ME, THIS SEEMS REDUNDANT.
-  vector<cv::Point> approxRect;
-  approxPolyDP(origPaperContour, approxRect, 1,
-               true);
-  cv::Rect paperRect = boundingRect(approxRect);
+  ScopedSpan span(tracer, "runQuadDetector", pOrigImg->cols, pOrigImg->rows);
+  // GRAYSCALE OF pDirtyImg, FROM preprocess()
+  const Mat& imgGray = *pool.get("blurGray");
+  Mat& edges   = *pool.get("edges", pDirtyImg->size(), CV_8U);
+  double minArea = options.minQuadAreaFraction * pDirtyImg->rows *
+                   pDirtyImg->cols;
 
-  // FIND EXTREME POINTS
-  int minX = INT_MAX, maxX = 0;
-  int minY = INT_MAX, maxY = 0;
-  int minXIdx = -1, maxXIdx = -1;
-  int minYIdx = -1, maxYIdx = -1;
-  for(int i = 0; i < approxRect.size(); ++i)
+  // TRY EDGES FIRST, THEN A GLOBAL (OTSU) THRESHOLD FOR LOW-CONTRAST EDGES
+  for (int pass = 0; pass < 2; ++pass)
   {
-    if (approxRect[i].x > maxX)
+    if (pass == 0)
     {
-      maxX = approxRect[i].x;
-      maxXIdx = i;
+      Canny(imgGray, edges, 50, 150);
+      dilate(edges, edges, getStructuringElement(MORPH_RECT, cv::Size(3, 3)));
     }
-    if (approxRect[i].x < minX)
+    else
+      threshold(imgGray, edges, 0, 255, THRESH_BINARY | THRESH_OTSU);
+
+    vector<vector<cv::Point> > contours;
+    findContours(edges, contours, RETR_LIST, CHAIN_APPROX_SIMPLE);
+
+    double bestArea = minArea;
+    vector<cv::Point> bestQuad;
+    vector<cv::Point> approx;
+    for (const auto& contour : contours)
     {
-      minX = approxRect[i].x;
-      minXIdx = i;
+      double area = contourArea(contour);
+      if (area <= bestArea)
+        continue;
+      approxPolyDP(contour, approx, 0.02 * arcLength(contour, true), true);
+      if (approx.size() != 4 || !isContourConvex(approx))
+        continue;
+      bestArea = contourArea(approx);
+      bestQuad = approx;
     }
-    if (approxRect[i].y > maxY)
+    if (!bestQuad.empty())
     {
-      maxY = approxRect[i].y;
-      maxYIdx = i;
+      origPaperContour = std::move(bestQuad);
+      return true;
     }
-    if (approxRect[i].y < minY)
+  }
+  return false;
+}
+
+// FIND DOCUMENTS: every plausible page quad
+/******************************************************************************/
+// The same two engines as runDetection(), but every contour that fits a
+// valid quad is kept instead of only the largest.
+void DocumentScanner::findDocuments()
+{
+  checkCancelled();
+  documentQuads.clear();
+  cachedDocuments.clear();
+  if (restoreCachedDocuments())
+    return;
+  ensurePreprocessed();
+  ScopedSpan span(tracer, "findDocuments", pOrigImg->cols, pOrigImg->rows);
+  vector<vector<cv::Point> > contours;
+  if (options.engine != DetectionEngine::GRABCUT)
+  {
+    Mat& edges = *pool.get("edges", pDirtyImg->size(), CV_8U);
+    Canny(*pool.get("blurGray"), edges, 50, 150);
+    dilate(edges, edges, getStructuringElement(MORPH_RECT, cv::Size(3, 3)));
+    findContours(edges, contours, RETR_LIST, CHAIN_APPROX_SIMPLE);
+    collectDocumentQuads(contours);
+    if (!documentQuads.empty())
     {
-      minY = approxRect[i].y;
-      minYIdx = i;
+      usedDetector = DetectionEngine::CONTOURS;
+      return;
     }
+    if (options.engine == DetectionEngine::CONTOURS)
+      handleError(DSErrorCodes::DETECTION_ERROR);
   }
 
-  // Determine if rotated to left or to right
-  if (approxRect[minXIdx].y < approxRect[maxXIdx].y)
+  checkCancelled();
+  this->runGrabCut(2);
+  checkCancelled();
+  contours.clear();
+  findContours(*pGrabCutImg, contours, RETR_EXTERNAL, CHAIN_APPROX_SIMPLE);
+  collectDocumentQuads(contours);
+  usedDetector = DetectionEngine::GRABCUT;
+  if (documentQuads.empty())
+    handleError(DSErrorCodes::DETECTION_ERROR);
+}
+
+// COLLECT DOCUMENT QUADS: validate, drop nested duplicates, reading order
+/******************************************************************************/
+void DocumentScanner::collectDocumentQuads(
+  const vector<vector<cv::Point>>& contours)
+{
+  double minArea = options.minDocumentAreaFraction * pOrigImg->total();
+  vector<pair<double, vector<Point2f>>> candidates;
+  vector<Point2f> quad;
+  for (const auto& contour : contours)
   {
-    orientation = DocOrientation::TO_LEFT;
-    setCornerPoint(CornerPoints::UPPER_LEFT,  approxRect[minXIdx]);
-    setCornerPoint(CornerPoints::UPPER_RIGHT, approxRect[minYIdx]);
-    setCornerPoint(CornerPoints::LOWER_LEFT,  approxRect[maxYIdx]);
-    setCornerPoint(CornerPoints::LOWER_RIGHT, approxRect[maxXIdx]);
+    double blobArea = contourArea(contour);
+    if (blobArea < minArea || !fitQuad(contour, quad) ||
+        !isValidQuad(quad, minArea, blobArea))
+      continue;
+    candidates.emplace_back(contourArea(quad), quad);
   }
-  else if (approxRect[minXIdx].y == approxRect[maxXIdx].y)
+  sort(candidates.begin(), candidates.end(),
+       [](const auto& a, const auto& b) { return a.first > b.first; });
+
+  // LARGEST FIRST; ANYTHING CENTERED INSIDE AN ACCEPTED PAGE IS THAT PAGE'S
+  // OTHER EDGE OR ITS CONTENT
+  auto centerOf = [](const vector<Point2f>& q) {
+    return (q[0] + q[1] + q[2] + q[3]) * 0.25f;
+  };
+  for (auto& candidate : candidates)
   {
-    orientation = DocOrientation::UPRIGHT;
+    if (static_cast<int>(documentQuads.size()) >= max(1, options.maxDocuments))
+      break;
+    Point2f center = centerOf(candidate.second);
+    bool nested = false;
+    for (const auto& accepted : documentQuads)
+      if (pointPolygonTest(accepted, center, false) >= 0 ||
+          pointPolygonTest(candidate.second, centerOf(accepted), false) >= 0)
+      {
+        nested = true;
+        break;
+      }
+    if (!nested)
+      documentQuads.push_back(std::move(candidate.second));
+  }
+
+  // READING ORDER: ROWS BY TOP EDGE, THEN LEFT TO RIGHT
+  float rowTolerance = 0.05f * pOrigImg->rows;
+  sort(documentQuads.begin(), documentQuads.end(),
+       [rowTolerance](const vector<Point2f>& a, const vector<Point2f>& b)
+       {
+         if (abs(a[0].y - b[0].y) > rowTolerance)
+           return a[0].y < b[0].y;
+         return a[0].x < b[0].x;
+       });
+}
+
+// RUN DETECTION: fills origPaperContour using the selected engine
+/******************************************************************************/
+void DocumentScanner::runDetection()
+{
+  checkCancelled();
+  ensurePreprocessed();
+  bool triedQuads = options.engine != DetectionEngine::GRABCUT;
+  if (triedQuads && runQuadDetector())
+  {
+    usedDetector = DetectionEngine::CONTOURS;
+    return;
+  }
+  if (options.engine == DetectionEngine::CONTOURS)
+    handleError(DSErrorCodes::DETECTION_ERROR);
+
+  // NO TIME FOR GRABCUT (BY ITS COST ON EARLIER DOCUMENTS, OR THE PRIOR ON
+  // A SCANNER'S FIRST): THE CHEAP DETECTOR, THEN A GUESS
+  checkCancelled();
+  double grabCutMs = grabCutIterationMs > 0.0 ? grabCutIterationMs :
+                     GRABCUT_PRIOR_MS_PER_MP * pOrigImg->total() / 1e6;
+  if (deadline.expired() || deadline.remainingMs() < grabCutMs)
+  {
+    markDegraded("no time for GrabCut");
+    if (!triedQuads && runQuadDetector())
+      usedDetector = DetectionEngine::CONTOURS;
+    else
+      useFallbackQuad();
+    return;
+  }
+
+  if (!options.headless)
+    cout << "Separating foreground from background... " << flush;
+  this->runGrabCut(2);
+  checkCancelled();
+  this->runFindContours();
+  usedDetector = DetectionEngine::GRABCUT;
+}
+
+// DEADLINE HELPERS
+/******************************************************************************/
+void DocumentScanner::checkCancelled()
+{
+  if (deadline.isCancelled())
+    handleError(DSErrorCodes::CANCELLED);
+}
+
+void DocumentScanner::markDegraded(const string& reason)
+{
+  if (!degraded)
+    degradedReason = reason;
+  degraded = true;
+}
+
+// FALLBACK QUAD: the previous document's quad (when opted in), or the full
+// frame
+/******************************************************************************/
+void DocumentScanner::useFallbackQuad()
+{
+  vector<Point2f> quad;
+  float w = static_cast<float>(pOrigImg->cols);
+  float h = static_cast<float>(pOrigImg->rows);
+  if (options.reusePreviousQuad && lastQuad.size() == 4)
+  {
+    for (const auto& corner : lastQuad)
+      quad.emplace_back(corner.x * w, corner.y * h);
+    orientation = lastOrientation;
+    degradedReason += ", used the previous quad";
   }
   else
   {
-    orientation = DocOrientation::TO_RIGHT;
-    setCornerPoint(CornerPoints::UPPER_LEFT,  approxRect[minYIdx]);
-    setCornerPoint(CornerPoints::UPPER_RIGHT, approxRect[maxXIdx]);
-    setCornerPoint(CornerPoints::LOWER_LEFT,  approxRect[minXIdx]);
-    setCornerPoint(CornerPoints::LOWER_RIGHT, approxRect[maxYIdx]);
+    float b = static_cast<float>(borderSize);
+    quad = {Point2f(b, b), Point2f(w - 1 - b, b), Point2f(w - 1 - b, h - 1 - b),
+            Point2f(b, h - 1 - b)};
+    orientation = DocOrientation::UPRIGHT;
+    degradedReason += ", used the full frame";
   }
-  cout << "Orientation of document: " << orientationToString(orientation)
-       << endl;
+  setQuad(quad);
+  origPaperContour.assign(quad.begin(), quad.end());
+  cornersFixed = true;
+}
+
+// FIND CORNERS: ordered, float-precision quad for any rotation
+/******************************************************************************/
+// Convex hull, largest inscribed quad, then sub-pixel line fits to the
+// outline along each side (see fitQuad). The orientation is read off the
+// top edge.
+void DocumentScanner::findCorners()
+{
+  checkCancelled();
+  if (cornersFixed)
+    return;
+  ScopedSpan span(tracer, "findCorners", pOrigImg->cols, pOrigImg->rows);
+  vector<Point2f> quad;
+  if (!fitQuad(origPaperContour, quad))
+    handleError(DSErrorCodes::DETECTION_ERROR);
+  setQuad(quad);
+  orientation = quadOrientation(quad);
+
+  // REMEMBERED AS THE FALLBACK FOR A LATER DOCUMENT THAT RUNS OUT OF TIME
+  lastQuad.clear();
+  for (const auto& corner : quadCorners)
+    lastQuad.emplace_back(corner.x / pOrigImg->cols,
+                          corner.y / pOrigImg->rows);
+  lastOrientation = orientation;
+  if (!options.headless)
+    cout << "Orientation of document: " << orientationToString(orientation)
+         << endl;
+}
+
+// SET QUAD: float corners, and their rounding for drawLines()
+/******************************************************************************/
+void DocumentScanner::setQuad(const vector<Point2f>& quad)
+{
+  quadCorners = quad;
+  const CornerPoints order[4] = {
+    CornerPoints::UPPER_LEFT, CornerPoints::UPPER_RIGHT,
+    CornerPoints::LOWER_RIGHT, CornerPoints::LOWER_LEFT
+  };
+  for (int i = 0; i < 4; ++i)
+    cornerPoints[order[i]] = cv::Point(cvRound(quad[i].x),
+                                       cvRound(quad[i].y));
+}
+
+// Within a degree of level is UPRIGHT; a top edge rising to the right is a
+// page turned to the left
+DocOrientation DocumentScanner::quadOrientation(const vector<Point2f>& quad)
+{
+  Point2f top = quad[1] - quad[0];
+  double degrees = atan2(top.y, top.x) * 180.0 / CV_PI;
+  if (abs(degrees) < 1.0)
+    return DocOrientation::UPRIGHT;
+  return degrees < 0.0 ? DocOrientation::TO_LEFT : DocOrientation::TO_RIGHT;
 }
 
 /***************************** GETTERS & SETTERS ******************************/
@@ -220,6 +876,118 @@ void DocumentScanner::setCornerPoint(const CornerPoints cp, cv::Point& point)
   cornerPoints[cp] = std::move(point);
 }
 
+bool DocumentScanner::isHeadless() const
+{
+  return options.headless;
+}
+
+const cv::Mat& DocumentScanner::getFinalImg() const
+{
+  return *pFinalImg;
+}
+
+const BinaryPage& DocumentScanner::getBinaryImg() const
+{
+  return binaryImg;
+}
+
+DetectionEngine DocumentScanner::getDetector() const
+{
+  return usedDetector;
+}
+
+DocOrientation DocumentScanner::getOrientation() const
+{
+  return orientation;
+}
+
+const StageTracer& DocumentScanner::getTracer() const
+{
+  return tracer;
+}
+
+const MatPool& DocumentScanner::getPool() const
+{
+  return pool;
+}
+
+int DocumentScanner::getGrabCutIterations() const
+{
+  return grabCutIterations;
+}
+
+bool DocumentScanner::isGrabCutModelReused() const
+{
+  return grabCutModelReused;
+}
+
+void DocumentScanner::setGrabCutModel(sptr<GrabCutModel> model)
+{
+  options.grabCutModel = std::move(model);
+}
+
+void DocumentScanner::setResultCache(sptr<ResultCache> cache)
+{
+  options.resultCache = std::move(cache);
+}
+
+void DocumentScanner::clearHistory()
+{
+  lastQuad.clear();
+  lastOrientation    = DocOrientation::NOT_SET;
+  grabCutIterationMs = 0.0;
+}
+
+void DocumentScanner::setGrabCutPrior(const cv::Mat& labels)
+{
+  labels.copyTo(*pool.get("prior"));
+  hasGrabCutPrior = !labels.empty();
+}
+
+const cv::Mat& DocumentScanner::getGrabCutLabels() const
+{
+  static const cv::Mat noLabels;
+  return pMask ? *pMask : noLabels;
+}
+
+void DocumentScanner::setDeadline(const Deadline& d)
+{
+  deadline = d;
+}
+
+Deadline DocumentScanner::getDeadline() const
+{
+  return deadline;
+}
+
+void DocumentScanner::cancel()
+{
+  deadline.cancel();
+}
+
+bool DocumentScanner::isDegraded() const
+{
+  return degraded;
+}
+
+const string& DocumentScanner::getDegradedReason() const
+{
+  return degradedReason;
+}
+
+const vector<vector<Point2f>>& DocumentScanner::getDocumentQuads() const
+{
+  return documentQuads;
+}
+
+vector<Mat> DocumentScanner::getPages() const
+{
+  vector<Mat> pages;
+  for (const auto& page : pPages)
+    pages.push_back(*page);
+  return pages;
+}
+
 // DRAW LINES
 /******************************************************************************/
 void DocumentScanner::drawLines()
@@ -229,6 +997,10 @@ void DocumentScanner::drawLines()
     cout << "You must first find contours and corners" << endl;
     return;
   }
+  if (options.headless)
+    return;
+  ensurePreprocessed();
+  ScopedSpan span(tracer, "drawLines", pOrigImg->cols, pOrigImg->rows);
   auto points = make_shared<vector<cv::Point>>(vector<cv::Point>({
     cornerPoints[CornerPoints::UPPER_LEFT],
     cornerPoints[CornerPoints::UPPER_RIGHT],
@@ -237,13 +1009,17 @@ void DocumentScanner::drawLines()
   ));
   pointMover.setPPoints(shared_ptr<vector<cv::Point>>(points));
   pointMover.drawLines();
-  // TODO: Place text for instructions here
-  char c;
-  while (true)
+  // DRAGS ONLY REDRAW THE AREA AROUND THE MOVED CORNER, ONCE PER FRAME
+  pointMover.runEventLoop('q');
+  // AN EDITED CORNER INVALIDATES THE CACHED FULL-RESOLUTION ONES
+  if (*points != vector<cv::Point>({cornerPoints[CornerPoints::UPPER_LEFT],
+                                    cornerPoints[CornerPoints::UPPER_RIGHT],
+                                    cornerPoints[CornerPoints::LOWER_RIGHT],
+                                    cornerPoints[CornerPoints::LOWER_LEFT]}))
   {
-    c = static_cast<char>(waitKey());
-    if (c == 'q')
-      break;
+    cachedCorners.clear();
+    quadCorners.assign(points->begin(), points->end());
+    cornersCorrected = true;
   }
   // MUST REASSIGN BACK TO cornerPoints map (Yes, should have just used vector)
   cornerPoints[CornerPoints::UPPER_LEFT]  = points->at(0);
@@ -252,28 +1028,207 @@ void DocumentScanner::drawLines()
   cornerPoints[CornerPoints::LOWER_LEFT]  = points->at(3);
 }
 
-// PERFORM FIND HOMOGRAPHY
+// FULL RESOLUTION CORNERS
 /******************************************************************************/
-void DocumentScanner::performFindHomography()
+// Scales cornerPoints (working-image coordinates) up to pFullImg and refines
+// each one with cornerSubPix on a small grayscale window of the full image.
+// Returned in CW order starting from the upper left. refineFullRes() does
+// the same for any working-image corners.
+vector<Point2f> DocumentScanner::fullResCorners()
 {
-  // TRANSFER CORNER POINTS TO AN ARRAY
-  vector<Point2f> srcPoints = {
+  if (!cachedCorners.empty())
+    return cachedCorners;
+  if (quadCorners.size() == 4)
+    return refineFullRes(quadCorners);
+  return refineFullRes({
     cornerPoints[CornerPoints::UPPER_LEFT],
     cornerPoints[CornerPoints::UPPER_RIGHT],
     cornerPoints[CornerPoints::LOWER_RIGHT],
     cornerPoints[CornerPoints::LOWER_LEFT]
+  });
+}
+
+vector<Point2f> DocumentScanner::refineFullRes(vector<Point2f> corners)
+{
+  if (detectionScale <= 1.0)
+    return corners;
+
+  // ONE WORKING-IMAGE PIXEL OF UNCERTAINTY EACH WAY, WITHIN SANE LIMITS
+  int halfWin = min(15, max(3, cvCeil(detectionScale)));
+  int pad = 2 * halfWin;
+  cv::Rect fullRect(0, 0, pFullImg->cols, pFullImg->rows);
+  for (auto& corner : corners)
+  {
+    corner *= detectionScale;
+    cv::Rect roi(cvRound(corner.x) - pad, cvRound(corner.y) - pad,
+                 2 * pad + 1, 2 * pad + 1);
+    roi &= fullRect;
+    if (roi.width <= 2 * halfWin + 5 || roi.height <= 2 * halfWin + 5)
+      continue;
+
+    Mat roiGray;
+    cvtColor((*pFullImg)(roi), roiGray, COLOR_BGR2GRAY);
+    vector<Point2f> refined = {
+      Point2f(corner.x - roi.x, corner.y - roi.y)
+    };
+    cornerSubPix(roiGray, refined, cv::Size(halfWin, halfWin),
+                 cv::Size(-1, -1),
+                 TermCriteria(TermCriteria::COUNT | TermCriteria::EPS, 20,
+                              0.05));
+    Point2f moved(refined[0].x + roi.x, refined[0].y + roi.y);
+    // KEEP THE SCALED CORNER IF REFINEMENT WANDERED OFF
+    if (norm(moved - corner) <= detectionScale * 2)
+      corner = moved;
+  }
+  return corners;
+}
+
+// RESULT CACHE
+/******************************************************************************/
+// Everything that changes what detection finds; output-only settings stay
+// out so they can change without invalidating the cache.
+string DocumentScanner::detectionParams() const
+{
+  ostringstream params;
+  params << "engine=" << static_cast<int>(options.engine)
+         << ";detectionSize=" << options.detectionSize
+         << ";reducedDecode=" << options.reducedDecode
+         << ";minQuadArea=" << options.minQuadAreaFraction
+         << ";warmStart=" << options.grabCutWarmStart
+         << ";tolerance=" << options.grabCutTolerance
+         << ";maxIterations=" << options.grabCutMaxIterations
+         << ";budgetMs=" << options.grabCutBudgetMs
+         << ";border=" << borderSize;
+  // FROZEN SESSION MODELS SEGMENT DIFFERENTLY FROM FRESHLY LEARNED ONES, AND
+  // EVERY RE-LEARN CHANGES THEM: KEYED BY THE MODELS' CONTENT, WHICH ALSO
+  // HOLDS ACROSS RUNS WITH A PERSISTENT CACHE
+  Mat bgdModel, fgdModel;
+  double baseline;
+  if (options.grabCutModel &&
+      options.grabCutModel->get(bgdModel, fgdModel, baseline))
+    params << ";model=" << hex << ResultCache::hashMat(bgdModel)
+           << ResultCache::hashMat(fgdModel);
+  return params.str();
+}
+
+void DocumentScanner::lookupCachedResult()
+{
+  haveCacheHit = !cacheKey.empty() &&
+                 options.resultCache->lookup(cacheKey, cacheHit);
+}
+
+// The page list has a key of its own: the page limits change what
+// findDocuments() keeps, and one page's corners are not a page list.
+bool DocumentScanner::restoreCachedDocuments()
+{
+  if (cacheKey.empty())
+    return false;
+  ostringstream params;
+  params << detectionParams() << ";maxDocuments=" << options.maxDocuments
+         << ";minDocumentArea=" << options.minDocumentAreaFraction;
+  documentsKey = ResultCache::makeKey(contentHash, params.str());
+  CachedResult cached;
+  if (!options.resultCache->lookup(documentsKey, cached) ||
+      cached.documents.empty())
+    return false;
+  ScopedSpan span(tracer, "restoreCachedDocuments");
+  cachedDocuments = cached.documents;
+  usedDetector    = static_cast<DetectionEngine>(cached.detector);
+  // WORKING-IMAGE QUADS, FOR getDocumentQuads()
+  for (const auto& corners : cachedDocuments)
+  {
+    vector<Point2f> quad;
+    for (const auto& corner : corners)
+      quad.emplace_back(static_cast<float>(corner.x / detectionScale),
+                        static_cast<float>(corner.y / detectionScale));
+    documentQuads.push_back(std::move(quad));
+  }
+  return true;
+}
+
+bool DocumentScanner::restoreCachedResult()
+{
+  if (!haveCacheHit)
+    return false;
+  const CachedResult& cached = cacheHit;
+  ScopedSpan span(tracer, "restoreCachedResult");
+  cachedCorners    = cached.corners;
+  cornersCorrected = cached.corrected;
+  orientation      = static_cast<DocOrientation>(cached.orientation);
+  usedDetector     = static_cast<DetectionEngine>(cached.detector);
+
+  // WORKING-IMAGE CORNERS, FOR drawLines()
+  const CornerPoints order[4] = {
+    CornerPoints::UPPER_LEFT, CornerPoints::UPPER_RIGHT,
+    CornerPoints::LOWER_RIGHT, CornerPoints::LOWER_LEFT
   };
+  for (int i = 0; i < 4; ++i)
+    cornerPoints[order[i]] = cv::Point(
+      cvRound(cachedCorners[i].x / detectionScale),
+      cvRound(cachedCorners[i].y / detectionScale));
+  quadCorners.clear();
+  return true;
+}
+
+// Unedited corners restored from the cache are already stored. Fallback
+// corners from a spent latency budget are a guess, not a result to reuse,
+// unless they were corrected by hand.
+void DocumentScanner::storeResult(const vector<Point2f>& corners,
+                                  cv::Size pageSize)
+{
+  if (cacheKey.empty() || !cachedCorners.empty() ||
+      (degraded && !cornersCorrected))
+    return;
+  CachedResult result;
+  result.corners     = corners;
+  result.orientation = static_cast<int>(orientation);
+  result.detector    = static_cast<int>(usedDetector);
+  result.outputSize  = pageSize;
+  result.corrected   = cornersCorrected;
+  options.resultCache->store(cacheKey, result);
+}
+
+void DocumentScanner::storeDocuments(
+  const vector<vector<Point2f>>& corners)
+{
+  if (documentsKey.empty() || !cachedDocuments.empty() || degraded)
+    return;
+  CachedResult result;
+  result.documents = corners;
+  result.detector  = static_cast<int>(usedDetector);
+  options.resultCache->store(documentsKey, result);
+}
+
+// PERFORM FIND HOMOGRAPHY
+/******************************************************************************/
+void DocumentScanner::performFindHomography()
+{
+  // TRANSFER CORNER POINTS TO AN ARRAY (FULL RESOLUTION)
+  checkCancelled();
+  ScopedSpan span(tracer, "performFindHomography", fullSize.width,
+                  fullSize.height);
+  ensureFullRes();
+  if (pFullImg->empty())
+    handleError(DSErrorCodes::FILE_LOADING_ERROR);
+  vector<Point2f> corners = fullResCorners();
+  warpQuad(*pFullImg, corners);
+  storeResult(corners, pFinalImg->size());
+}
+
+// PAGE GEOMETRY: output size and homography for four source corners
+/******************************************************************************/
+Mat DocumentScanner::pageGeometry(vector<Point2f>& srcPoints,
+                                  cv::Size& pageSize) const
+{
+  if (options.warpCache)
+    options.warpCache->quantize(srcPoints);
 
   // FIND DIMENSIONS FOR NEW MAT
-  int w1 = cornerPoints[CornerPoints::UPPER_LEFT].x -
-           cornerPoints[CornerPoints::UPPER_RIGHT].x;
-  int h1 = cornerPoints[CornerPoints::UPPER_LEFT].y -
-           cornerPoints[CornerPoints::UPPER_RIGHT].y;
+  float w1 = srcPoints[0].x - srcPoints[1].x;
+  float h1 = srcPoints[0].y - srcPoints[1].y;
   int dirtyImgW = static_cast<int>(sqrt(w1*w1 + h1*h1));
-  int w2 = cornerPoints[CornerPoints::UPPER_LEFT].x -
-           cornerPoints[CornerPoints::LOWER_LEFT].x;
-  int h2 = cornerPoints[CornerPoints::UPPER_LEFT].y -
-           cornerPoints[CornerPoints::LOWER_LEFT].y;
+  float w2 = srcPoints[0].x - srcPoints[3].x;
+  float h2 = srcPoints[0].y - srcPoints[3].y;
   int dirtyImgH = static_cast<int>(sqrt(w2*w2 + h2*h2));
   // TODO: Fix aspect ratio
   //  dirtyImgW /= aspectRatio;
@@ -285,11 +1240,167 @@ void DocumentScanner::performFindHomography()
     cv::Point(dirtyImgW-1, dirtyImgH-1),
     cv::Point(0,           dirtyImgH-1)
   };
-  Mat h = findHomography(srcPoints, dstPoints, RANSAC);
-  cv::Size finalSz(dirtyImgW, dirtyImgH);
-  Mat finalImg(finalSz, CV_8U, Scalar(0));
-  warpPerspective(*pOrigImg, finalImg, h, finalSz);
-  imshow(finalWinName, finalImg);
+  pageSize = cv::Size(dirtyImgW, dirtyImgH);
+  // EXACTLY FOUR CORRESPONDENCES: SOLVE DIRECTLY, NOTHING FOR RANSAC TO DO
+  return getPerspectiveTransform(srcPoints, dstPoints);
+}
+
+// WARP QUAD: rectify image given its four corners into pFinalImg
+/******************************************************************************/
+void DocumentScanner::warpQuad(const cv::Mat& image, vector<Point2f> srcPoints)
+{
+  ScopedSpan span(tracer, "warpQuad", image.cols, image.rows);
+  cv::Size finalSz;
+  Mat h = pageGeometry(srcPoints, finalSz);
+  pFinalImg = pool.getRegion("final", finalSz, image.type());
+  binaryImg = BinaryPage();
+  warpInto(image, srcPoints, h, *pFinalImg);
+}
+
+// WARP INTO: dst must already have the page size and the image type
+/******************************************************************************/
+void DocumentScanner::warpInto(const cv::Mat& image,
+                               const vector<Point2f>& srcPoints,
+                               const cv::Mat& h, cv::Mat& dst)
+{
+  if (options.warpCache)
+  {
+    Mat map1, map2;
+    options.warpCache->getMaps(srcPoints, image.size(), dst.size(), h,
+                               map1, map2);
+    remap(image, dst, map1, map2, INTER_LINEAR);
+  }
+  else
+    warpPerspective(image, dst, h, dst.size());
+}
+
+// PAGE SIZE: what performFindHomography() will produce
+/******************************************************************************/
+cv::Size DocumentScanner::getPageSize()
+{
+  ensureFullRes();
+  vector<Point2f> srcPoints = fullResCorners();
+  cv::Size pageSz;
+  pageGeometry(srcPoints, pageSz);
+  return pageSz;
+}
+
+// PERFORM FIND HOMOGRAPHY INTO A CALLER'S BUFFER
+/******************************************************************************/
+void DocumentScanner::performFindHomography(cv::Mat& dst)
+{
+  checkCancelled();
+  ScopedSpan span(tracer, "performFindHomography", fullSize.width,
+                  fullSize.height);
+  ensureFullRes();
+  if (pFullImg->empty())
+    handleError(DSErrorCodes::FILE_LOADING_ERROR);
+  vector<Point2f> corners = fullResCorners();
+  vector<Point2f> srcPoints = corners;
+  cv::Size pageSz;
+  Mat h = pageGeometry(srcPoints, pageSz);
+  // NO-OP WHEN dst ALREADY WRAPS A BUFFER OF THE RIGHT SIZE AND TYPE
+  dst.create(pageSz, pFullImg->type());
+  warpInto(*pFullImg, srcPoints, h, dst);
+  storeResult(corners, pageSz);
+}
+
+// WARP TO SINK: performFindHomography with a bounded output page
+/******************************************************************************/
+void DocumentScanner::warpToSink(StripSink& sink)
+{
+  checkCancelled();
+  ScopedSpan span(tracer, "warpToSink", fullSize.width, fullSize.height);
+  ensureFullRes();
+  if (pFullImg->empty())
+    handleError(DSErrorCodes::FILE_LOADING_ERROR);
+  vector<Point2f> srcPoints = fullResCorners();
+  cv::Size pageSize;
+  Mat h = pageGeometry(srcPoints, pageSize);
+  int bandRows = bandRowsForBudget(pageSize, pFullImg->type(),
+                                   options.outputBudgetMB << 20);
+  tiledWarp(*pFullImg, h, pageSize, sink, bandRows, cv::Size(512, 256),
+            options.warpTileThreads);
+  storeResult(srcPoints, pageSize);
+}
+
+// WARP DOCUMENTS: every findDocuments() quad, concurrently
+/******************************************************************************/
+void DocumentScanner::warpDocuments()
+{
+  checkCancelled();
+  ScopedSpan span(tracer, "warpDocuments", fullSize.width, fullSize.height);
+  ensureFullRes();
+  if (pFullImg->empty())
+    handleError(DSErrorCodes::FILE_LOADING_ERROR);
+
+  // GEOMETRY AND BUFFERS UP FRONT; THE POOL IS NOT THREAD-SAFE
+  size_t n = documentQuads.size();
+  vector<vector<Point2f>> corners(n), srcPoints(n);
+  vector<Mat> homographies(n);
+  pPages.resize(n);
+  for (size_t i = 0; i < n; ++i)
+  {
+    corners[i] = cachedDocuments.size() == n ? cachedDocuments[i] :
+                                               refineFullRes(documentQuads[i]);
+    srcPoints[i] = corners[i];
+    cv::Size pageSz;
+    homographies[i] = pageGeometry(srcPoints[i], pageSz);
+    pPages[i] = pool.getRegion("page" + to_string(i), pageSz,
+                               pFullImg->type());
+  }
+
+  // ONE PAGE AT A TIME PER THREAD OF ITS OWN (THE PIPELINE RUNS OPENCV
+  // SINGLE-THREADED, SO parallel_for_ WOULD NOT BE); A CANCELLED SCAN
+  // STARTS NO FURTHER PAGE
+  unsigned int numThreads = options.warpTileThreads;
+  if (numThreads == 0)
+    numThreads = max(1u, thread::hardware_concurrency());
+  atomic<size_t> nextPage{0};
+  auto warpPages = [&]()
+  {
+    for (size_t i = nextPage++; i < n && !deadline.isCancelled();
+         i = nextPage++)
+      warpInto(*pFullImg, srcPoints[i], homographies[i], *pPages[i]);
+  };
+  vector<future<void>> workers;
+  for (size_t i = 1; i < min<size_t>(numThreads, n); ++i)
+    workers.push_back(async(launch::async, warpPages));
+  warpPages();
+  for (auto& worker : workers)
+    worker.get();
+  checkCancelled();
+  storeDocuments(corners);
+}
+
+// BINARIZE: fused post-warp enhancement into a 1-bit page
+/******************************************************************************/
+void DocumentScanner::binarize()
+{
+  checkCancelled();
+  ScopedSpan span(tracer, "binarize", pFinalImg->cols, pFinalImg->rows);
+  if (pFinalImg->empty())
+    return;
+  // POOLED LIKE THE PAGE ITSELF: SAME-SIZED PAGES REUSE THE BITS
+  binaryImg.bits = *pool.getRegion(
+    "binary", cv::Size((pFinalImg->cols + 7) / 8, pFinalImg->rows), CV_8U);
+  binarizePage(*pFinalImg, binaryImg, options.binarizeOptions);
+}
+
+// SHOW FINAL IMAGE
+/******************************************************************************/
+void DocumentScanner::showFinalImg()
+{
+  if (options.headless || pFinalImg->empty())
+    return;
+  if (binaryImg.empty())
+    imshow(finalWinName, *pFinalImg);
+  else
+  {
+    Mat bw;
+    unpackBinaryPage(binaryImg, bw);
+    imshow(finalWinName, bw);
+  }
   waitKey();
 }
 
@@ -297,28 +1408,103 @@ void DocumentScanner::performFindHomography()
 /******************************************************************************/
 void DocumentScanner::run()
 {
-  // SPAWN THREAD FOR WAITING COMMAND LINE OUTPUT
-  bool stopThread = false;
-  string message = "Separating foreground from background";
-  thread spinThread(spinWaiting, 300, std::ref(stopThread),
-                    std::ref(message));
-  // 1. GRABCUT
-  this->runGrabCut(2);
-  stopThread = true;
-  message    = "Finished performing grabCut";
-  spinThread.join();
-
-  // 2. FIND CONTOURS
-  this->runFindContours();
+  // 0. CORNERS FROM AN EARLIER RUN ON THE SAME INPUT SKIP 1. - 3.
+  if (this->restoreCachedResult())
+  {
+    if (!options.headless)
+      cout << "Corners from the result cache"
+           << (cornersCorrected ? " (corrected)" : "") << endl;
+  }
+  else
+  {
+    // 1. & 2. SEGMENT AND FIND THE PAPER CONTOUR (GRABCUT OR QUAD DETECTOR)
+    this->runDetection();
+    if (!options.headless)
+      cout << "Detected with: " << detectionEngineToString(usedDetector)
+           << endl;
 
-  // 3. FIND CORNERS
-  this->findCorners();
+    // 3. FIND CORNERS
+    this->findCorners();
+  }
 
-  // 4. DRAW LINES
+  // 4. DRAW LINES (INTERACTIVE CORRECTION IS SKIPPED WHEN HEADLESS)
   this->drawLines();
 
   // 5. PERFORM findHomography
   this->performFindHomography();
+
+  // 6. OPTIONAL 1-BIT ENHANCEMENT
+  if (options.binarize)
+    this->binarize();
+  if (!options.headless)
+    cout << tracer.toLogLine() << endl;
+  this->showFinalImg();
+}
+
+// OUTPUT BITS: the 1-bit page to write for ext, or nullptr for the colour one
+/******************************************************************************/
+// getBinaryImg() once binarize() has run; Group 4 and PBM are 1-bit only, so
+// for those the page is binarized here, with this scanner's settings
+const BinaryPage* DocumentScanner::outputBits(const string& ext,
+                                              BinaryPage& scratch) const
+{
+  if (!binaryImg.empty())
+    return &binaryImg;
+  OutputFormat format = outputFormat(ext);
+  if (pFinalImg->empty() ||
+      (format != OutputFormat::TIFF_G4 && format != OutputFormat::PBM))
+    return nullptr;
+  binarizePage(*pFinalImg, scratch, options.binarizeOptions);
+  return &scratch;
+}
+
+// SAVE FINAL IMAGE
+/******************************************************************************/
+bool DocumentScanner::saveFinalImg(const string& path,
+                                   EncodeReport* report) const
+{
+  BinaryPage scratch;
+  if (const BinaryPage* bits = outputBits(path, scratch))
+    return writePage(path, *bits, options.encodeOptions, report);
+  if (pFinalImg->empty())
+    return false;
+  return writePage(path, *pFinalImg, options.encodeOptions, report);
+}
+
+// ENCODE FINAL IMAGE: to memory, in the format of ext
+/******************************************************************************/
+bool DocumentScanner::encodeFinalImg(vector<uchar>& out, const string& ext,
+                                     const vector<int>& params,
+                                     EncodeReport* report) const
+{
+  out.clear();
+  if (params.empty())
+  {
+    BinaryPage scratch;
+    if (const BinaryPage* bits = outputBits(ext, scratch))
+      return encodePage(*bits, ext, out, options.encodeOptions, report);
+    if (pFinalImg->empty())
+      return false;
+    return encodePage(*pFinalImg, ext, out, options.encodeOptions, report);
+  }
+  Mat bw;
+  if (!binaryImg.empty())
+    unpackBinaryPage(binaryImg, bw);
+  const Mat& page = binaryImg.empty() ? *pFinalImg : bw;
+  if (page.empty())
+    return false;
+  auto start = chrono::steady_clock::now();
+  bool encoded = cv::imencode(ext, page, out, params);
+  if (report)
+  {
+    *report = EncodeReport();
+    report->format   = outputFormat(ext);
+    report->bytes    = out.size();
+    report->encodes  = 1;
+    report->encodeMs = chrono::duration<double, milli>(
+      chrono::steady_clock::now() - start).count();
+  }
+  return encoded;
 }
 
 // STATIC
@@ -343,11 +1529,23 @@ string DocumentScanner::orientationToString(DocOrientation o)
   return docOrient;
 }
 
-
-
-
-
-
-
-
-
+string DocumentScanner::detectionEngineToString(DetectionEngine e)
+{
+  std::string engine;
+  switch (e)
+  {
+  case DetectionEngine::GRABCUT:
+    engine = "GrabCut";
+    break;
+  case DetectionEngine::CONTOURS:
+    engine = "Contours";
+    break;
+  case DetectionEngine::AUTO:
+    engine = "Auto";
+    break;
+  default:
+    engine = "Not a valid engine";
+    break;
+  }
+  return engine;
+}
@@ -17,6 +17,18 @@
 #include <opencv2/imgcodecs.hpp>
 #include <MacTypes.h>
 #include "DSUtilities.h"
+#include "DSTrace.h"
+#include "DSMatPool.h"
+#include "DSWarpCache.h"
+#include "DSTiledWarp.h"
+#include "DSQuad.h"
+#include "DSResultCache.h"
+#include "DSGrabCutModel.h"
+#include "DSBinarize.h"
+#include "DSEncoder.h"
+#include "DSDeadline.h"
+#include "DSPreprocess.h"
+#include "DSMaskKernels.h"
 #include "CVPointMover.h"
 
 #ifndef RED
@@ -40,7 +52,9 @@
 enum class DSErrorCodes
 {
   FILE_LOADING_ERROR,
-  GRABCUT_ERROR
+  GRABCUT_ERROR,
+  DETECTION_ERROR,
+  CANCELLED
 };
 
 enum class DocOrientation {
@@ -51,6 +65,92 @@ enum class CornerPoints{
   UPPER_LEFT, UPPER_RIGHT, LOWER_LEFT, LOWER_RIGHT
 };
 
+// GRABCUT: robust but slow. CONTOURS: Canny + findContours + 4-point polygon
+// search, a few ms for light paper on a darker background. AUTO: CONTOURS,
+// falling back to GRABCUT when no plausible quad is found.
+enum class DetectionEngine {
+  GRABCUT, CONTOURS, AUTO
+};
+
+// OPTIONS THAT MUST BE KNOWN BEFORE THE IMAGE IS LOADED
+struct DSOptions
+{
+  // No highgui calls at all: no windows, no waitKey, no corner editing.
+  // Required for batch processing and for running on worker threads.
+  bool headless = false;
+  DetectionEngine engine = DetectionEngine::GRABCUT;
+  // Smallest quad the contour detector accepts, as a fraction of the image
+  double minQuadAreaFraction = 0.2;
+  // Long side (px) of the pyramid level used for segmentation and corner
+  // finding. The corners are scaled back up, refined, and the warp samples
+  // the full-resolution source. 0 keeps the single-resolution behaviour
+  // (images wider than 2000 px are halved).
+  int detectionSize = 0;
+  // With detectionSize > 0, decode JPEGs straight at 1/2, 1/4 or 1/8 size
+  // (DCT scaling) and decode the full image only when the final warp needs it
+  bool reducedDecode = true;
+  // Optional remap-table cache for fixed-geometry sources; share one
+  // instance between scanners. nullptr warps with warpPerspective.
+  std::shared_ptr<WarpMapCache> warpCache;
+  // GrabCut warm-start mode: seed GC_INIT_WITH_MASK from an edge prior (or
+  // the labels passed to setGrabCutPrior) instead of the border rectangle,
+  // then run single GC_EVAL iterations until at most grabCutTolerance of
+  // the pixels change side, grabCutMaxIterations is reached, or the next
+  // iteration would overrun grabCutBudgetMs (0 = no time limit).
+  // Off by default: runGrabCut's fixed iteration count from the rectangle.
+  bool grabCutWarmStart = false;
+  double grabCutTolerance = 0.002;
+  int grabCutMaxIterations = 5;
+  double grabCutBudgetMs = 0.0;
+  // Memory (MB) for the output page only: warpToSink() warps it in
+  // tile-parallel bands sized to fit, and the compressed file bytes are
+  // dropped once the full image is decoded. The decoded source is NOT
+  // bounded: it stays resident in full, so peak memory still grows with the
+  // input size. 0 = the whole page at once.
+  size_t outputBudgetMB = 0;
+  // Threads each warpToSink() warps its tiles on (0 = one per hardware
+  // thread); DocumentPipeline gives every warp thread its share
+  unsigned int warpTileThreads = 0;
+  // findDocuments(): at most this many documents per image, each at least
+  // minDocumentAreaFraction of it (several receipts on one table)
+  int maxDocuments = 8;
+  double minDocumentAreaFraction = 0.01;
+  // Optional detection-result cache keyed by input content; share one
+  // instance between scanners. The cache is looked up as soon as the input
+  // bytes are read; a hit decodes only the full-resolution image, skips
+  // preprocess() and lets restoreCachedResult() go straight to the warp.
+  // Hand corrections made in drawLines() are stored with the corners.
+  // findDocuments() keeps its page list under a key of its own.
+  std::shared_ptr<ResultCache> resultCache;
+  // Per-document latency budget (ms from reset(), 0 = none). A document
+  // that runs out of time skips or cuts short GrabCut and falls back to
+  // the quad detector, then the full frame, and is marked degraded
+  // (isDegraded()) instead of failing. Degraded corners are never written
+  // to resultCache.
+  double latencyBudgetMs = 0.0;
+  // Before the full frame, try the previous document's quad. Only for a
+  // fixed feeder where every page lands in the same place: anywhere else
+  // it warps one input with another's page geometry.
+  bool reusePreviousQuad = false;
+  // Optional session GrabCut colour models; share one instance between
+  // scanners photographing the same background. Once trained, a document
+  // is segmented with one frozen-model GrabCut iteration, and the models
+  // are re-learned from any document they no longer fit (see GrabCutModel).
+  // nullptr learns new models for every document.
+  std::shared_ptr<GrabCutModel> grabCutModel;
+  // Post-warp enhancement for OCR and archiving: binarize() turns the page
+  // into a clean 1-bit image (getBinaryImg()), which saveFinalImg() and
+  // encodeFinalImg() then write instead of the colour page, ".pbm" straight
+  // from the packed bits. run(), the batch pipeline and the daemon call it
+  // after the warp.
+  bool binarize = false;
+  BinarizeOptions binarizeOptions;
+  // Output quality and per-page size budget for saveFinalImg() and
+  // encodeFinalImg() (see DSEncoder.h). Pages written as ".tif" are
+  // Group-4 compressed, binarized with binarizeOptions if need be.
+  EncodeOptions encodeOptions;
+};
+
 
 class DocumentScanner
 {
@@ -58,27 +158,94 @@ private:
   std::string fileName;
   std::string cornersWinName;
   std::string finalWinName;
-  float aspectRatio; // 8.5 / 11 is default
+  float aspectRatio = 8.5 / 11; // 0.773
   sptr<cv::Mat> pMask;
-  sptr<cv::Mat> pOrigImg;
+  sptr<cv::Mat> pFullImg; // untouched source, only read by the final warp
+  sptr<cv::Mat> pDecodedImg; // what loading decoded: pFullImg or a reduction
+  sptr<cv::Mat> pOrigImg; // detection-resolution working image
+  cv::Size fullSize; // known even while pFullImg is still undecoded
+  bool fullResDecoded = false;
+  double detectionScale = 1.0; // pFullImg size / pOrigImg size
   sptr<cv::Mat> pDirtyImg;
-  sptr<cv::Mat> pGrabCutImg;
+  sptr<cv::Mat> pGrabCutImg; // blurred gray, background blacked out
   CVPointMover_<int> pointMover;
   int grabCutMode;
+  int grabCutIterations = 0;
+  bool hasGrabCutPrior = false;
+  bool grabCutModelReused = false;
   int borderSize;
   DocOrientation orientation = DocOrientation::NOT_SET;
   sptr<cv::Rect> rect;
   std::map<CornerPoints, cv::Point> cornerPoints;
+  std::vector<cv::Point2f> quadCorners; // cornerPoints unrounded, CW from UL
   std::vector<cv::Point> origPaperContour;
+  std::vector<std::vector<cv::Point2f>> documentQuads;
+  std::vector<sptr<cv::Mat>> pPages;
+  sptr<cv::Mat> pFinalImg = std::make_shared<cv::Mat>();
+  BinaryPage binaryImg; // bits from the pool; empty until binarize()
+  DSOptions options;
+  DetectionEngine usedDetector = DetectionEngine::GRABCUT;
+  StageTracer tracer;
+  // Every large Mat below comes from here, so reset() reuses them
+  MatPool pool;
+  std::vector<uchar> fileBytes;
+  cv::Mat encodedBytes; // 1 x N view of fileBytes or of the caller's bytes
+  std::string cacheKey; // empty without options.resultCache
+  uint64_t contentHash = 0;
+  std::string documentsKey; // set by findDocuments() with a cache
+  CachedResult cacheHit;
+  bool haveCacheHit = false;
+  bool preprocessPending = false; // skipped by a cache hit until needed
+  std::vector<cv::Point2f> cachedCorners; // full-res, until edited
+  std::vector<std::vector<cv::Point2f>> cachedDocuments; // full-res
+  bool cornersCorrected = false;
+  Deadline deadline;
+  bool degraded = false;
+  std::string degradedReason;
+  bool cornersFixed = false; // set by a fallback; findCorners() keeps them
+  // KEPT ACROSS reset(): FALLBACK QUAD AND GRABCUT COST OF EARLIER DOCUMENTS
+  std::vector<cv::Point2f> lastQuad; // fractions of the working image size
+  DocOrientation lastOrientation = DocOrientation::NOT_SET;
+  double grabCutIterationMs = 0.0; // 0 = not timed yet
 
   /******************************* PRIVATE METHODS ****************************/
   bool loadImage();
+  bool decodeEncoded();
+  bool decodeReduced();
+  void ensureFullRes();
+  bool prepareWorkingImage();
+  void resetState();
+  void initialize();
+  void lookupCachedResult();
+  bool restoreCachedDocuments();
+  void ensurePreprocessed();
   void handleError(DSErrorCodes errorCode);
-  void runGrabCut(int numIterations=2);
   [[maybe_unused]] void drawGrabCutRect();
-  void runFindContours();
-  void findCorners();
-  void performFindHomography();
+  bool runQuadDetector();
+  bool seedGrabCutPrior();
+  void runGrabCutWarm(const cv::Mat& img, cv::Mat& bgdModel,
+                      cv::Mat& fgdModel);
+  bool reuseGrabCutModel(const cv::Mat& img, cv::Mat& bgdModel,
+                         cv::Mat& fgdModel);
+  void checkCancelled();
+  void markDegraded(const std::string& reason);
+  void useFallbackQuad();
+  void collectDocumentQuads(
+    const std::vector<std::vector<cv::Point>>& contours);
+  std::vector<cv::Point2f> refineFullRes(std::vector<cv::Point2f> corners);
+  [[nodiscard]] std::string detectionParams() const;
+  void storeDocuments(const std::vector<std::vector<cv::Point2f>>& corners);
+  void storeResult(const std::vector<cv::Point2f>& corners,
+                   cv::Size pageSize);
+  void warpInto(const cv::Mat& image,
+                const std::vector<cv::Point2f>& srcPoints, const cv::Mat& h,
+                cv::Mat& dst);
+  cv::Mat pageGeometry(std::vector<cv::Point2f>& srcPoints,
+                       cv::Size& pageSize) const;
+  const BinaryPage* outputBits(const std::string& ext,
+                               BinaryPage& scratch) const;
+  void setQuad(const std::vector<cv::Point2f>& quad);
+  static DocOrientation quadOrientation(const std::vector<cv::Point2f>& quad);
 
 public:
 
@@ -86,20 +253,135 @@ public:
   explicit DocumentScanner(std::string filename, 
                            std::string cornersWinName = "Detection",
                            std::string finalWinName = "Extracted Document",
-                           int bordersz = 2);
+                           int bordersz = 2,
+                           DSOptions opts = DSOptions());
+  DocumentScanner(std::string filename, const DSOptions& opts);
+  // Scans an already-decoded BGR image; the pixels are shared, not copied
+  DocumentScanner(const cv::Mat& image, const DSOptions& opts);
+  // Decodes encoded image bytes (JPEG, PNG, ...) in place; see reset()
+  DocumentScanner(const uchar* data, size_t size, const DSOptions& opts);
+  // No input yet: call reset() before running any stage
+  explicit DocumentScanner(const DSOptions& opts);
   virtual ~DocumentScanner() = default;
 
+  /****************************** RESET ***************************************/
+  // Start over on a new input. Work buffers are kept, so a stream of
+  // same-sized inputs does no large allocations after the first one.
+  void reset(const std::string& filename);
+  void reset(const cv::Mat& image);
+  // Encoded bytes already in memory: decoded straight from the caller's
+  // buffer, which must stay valid until the warp (the full-resolution
+  // decode may be deferred until then)
+  void reset(const uchar* data, size_t size);
+
   /**************************** SETTERS & GETTERS *****************************/
   void setAspectRatio(float ratio);
 
   void setCornerPoint(CornerPoints cp, cv::Point& point);
 
+  [[nodiscard]] bool isHeadless() const;
+  [[nodiscard]] const cv::Mat& getFinalImg() const;
+  // 1-bit page from binarize(); empty before it or without it
+  [[nodiscard]] const BinaryPage& getBinaryImg() const;
+  // Which engine produced origPaperContour (never AUTO)
+  [[nodiscard]] DetectionEngine getDetector() const;
+  // As classified by findCorners() (or restored from the result cache)
+  [[nodiscard]] DocOrientation getOrientation() const;
+  // Wall/CPU time and image size of every stage run so far
+  [[nodiscard]] const StageTracer& getTracer() const;
+  [[nodiscard]] const MatPool& getPool() const;
+  // GrabCut iterations the last runGrabCut() ran
+  [[nodiscard]] int getGrabCutIterations() const;
+  // GrabCut labels (e.g. the previous frame's getGrabCutLabels()) to seed
+  // the next warm-started runGrabCut(); cleared by reset()
+  void setGrabCutPrior(const cv::Mat& labels);
+  [[nodiscard]] const cv::Mat& getGrabCutLabels() const;
+  // The last runGrabCut() used DSOptions::grabCutModel without re-learning
+  [[nodiscard]] bool isGrabCutModelReused() const;
+  // Replaces DSOptions::grabCutModel (nullptr detaches it)
+  void setGrabCutModel(sptr<GrabCutModel> model);
+  // Replaces DSOptions::resultCache (nullptr detaches it)
+  void setResultCache(sptr<ResultCache> cache);
+  // Forgets what earlier documents left behind for the next one: the
+  // fallback quad and orientation, and the GrabCut cost estimate
+  void clearHistory();
+  // reset() starts a deadline from DSOptions::latencyBudgetMs; a token set
+  // after reset() replaces it. Copies of getDeadline() can cancel this scan
+  // from another thread: the next stage then throws.
+  void setDeadline(const Deadline& d);
+  [[nodiscard]] Deadline getDeadline() const;
+  void cancel();
+  // A fallback or a cut-short GrabCut produced this document's corners
+  [[nodiscard]] bool isDegraded() const;
+  [[nodiscard]] const std::string& getDegradedReason() const;
+  // Working-image coordinates, as found by findDocuments()
+  [[nodiscard]] const std::vector<std::vector<cv::Point2f>>&
+  getDocumentQuads() const;
+  // One page per document quad (pooled buffers, valid until the next
+  // warpDocuments() or reset())
+  [[nodiscard]] std::vector<cv::Mat> getPages() const;
+
+  /*************************** PIPELINE STAGES ********************************/
+  // Called in this order by run(); public so they can be timed separately
+  // Corners, orientation and detector from DSOptions::resultCache; true on
+  // a hit, which replaces runDetection() and findCorners()
+  bool restoreCachedResult();
+  void preprocess();
+  // GrabCut and/or the quad detector, as chosen by DSOptions::engine
+  void runDetection();
+  // numIterations applies to the rectangle initialization only; the warm
+  // start iterates to convergence and a reused DSOptions::grabCutModel
+  // runs a single iteration (see DSOptions)
+  void runGrabCut(int numIterations=2);
+  void runFindContours();
+  void findCorners();
+  void performFindHomography();
+  // Warps into dst instead of getFinalImg(). When dst already has
+  // getPageSize() and the input's type (e.g. a Mat header over caller-owned
+  // memory) the page is written there with no allocation or copy.
+  void performFindHomography(cv::Mat& dst);
+  // Output page size for the current corners (decodes the full image)
+  [[nodiscard]] cv::Size getPageSize();
+  // Corners found by findCorners(), scaled to the full-resolution input and
+  // refined there; CW from the upper left
+  std::vector<cv::Point2f> fullResCorners();
+  // Rectify any image given its four corners (CW from the upper left) into
+  // getFinalImg(); performFindHomography() is this on the loaded input
+  void warpQuad(const cv::Mat& image, std::vector<cv::Point2f> corners);
+  // performFindHomography() without materializing the page: bands of it
+  // (see DSOptions::outputBudgetMB; the source is still decoded whole) are
+  // warped in parallel tiles and handed
+  // to sink as they finish. getFinalImg() is left untouched.
+  void warpToSink(StripSink& sink);
+  // Multi-document alternative to runDetection() + findCorners(): every
+  // plausible page quad in the image (see DSOptions::maxDocuments), CW from
+  // the upper left, in reading order. Shares one decode and segmentation.
+  void findDocuments();
+  // Warps every quad from findDocuments() into getPages(), one page per
+  // thread (up to DSOptions::warpTileThreads), through the warp cache
+  void warpDocuments();
+  // Illumination flattening, Sauvola threshold and despeckling of
+  // getFinalImg() into getBinaryImg(), in one fused pass (see DSBinarize.h)
+  void binarize();
+
   /*************************** PUBLIC METHODS *********************************/
   void drawLines();
+  void showFinalImg();
   void run();
+  // Both write getBinaryImg() instead once binarize() has run, with
+  // DSOptions::encodeOptions; report gets the format, quality, bytes and
+  // encode time
+  bool saveFinalImg(const std::string& path,
+                    EncodeReport* report = nullptr) const;
+  // getFinalImg() encoded in memory (ext as for cv::imencode: ".jpg", ...,
+  // ".tif" and ".pbm"). Explicit cv::imencode params bypass encodeOptions.
+  bool encodeFinalImg(std::vector<uchar>& out, const std::string& ext = ".jpg",
+                      const std::vector<int>& params = {},
+                      EncodeReport* report = nullptr) const;
 
   /**************************** STATIC METHODS ********************************/
   static std::string orientationToString(DocOrientation o);
+  static std::string detectionEngineToString(DetectionEngine e);
 };
 
 
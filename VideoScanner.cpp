@@ -0,0 +1,308 @@
+//
+// Streaming front end: track the page across video frames, emit stable pages.
+//
+#include "VideoScanner.h"
+
+#include <algorithm>
+#include <cctype>
+
+#include <opencv2/video.hpp>
+#include <opencv2/calib3d.hpp>
+
+using namespace std;
+using namespace cv;
+
+// KEY FRAMES ARE SEGMENTED AT A SMALL PYRAMID LEVEL, NEVER ON SCREEN
+static DSOptions streamOptions(DSOptions opts)
+{
+  opts.headless = true;
+  if (opts.detectionSize <= 0)
+    opts.detectionSize = 512;
+  return opts;
+}
+
+/************************ CONSTRUCTOR ***************************************/
+VideoScanner::VideoScanner(DSOptions opts, VideoOptions vidOpts) :
+  options(streamOptions(std::move(opts))), videoOptions(vidOpts),
+  ds(options)
+{
+}
+
+/***************************** GETTERS & SETTERS ******************************/
+void VideoScanner::setPageCallback(PageCallback callback)
+{
+  onPage = std::move(callback);
+}
+
+bool VideoScanner::isTracking() const
+{
+  return tracking;
+}
+
+vector<Point2f> VideoScanner::getCorners() const
+{
+  vector<Point2f> frameCorners;
+  if (tracking)
+    for (const auto& corner : corners)
+      frameCorners.push_back(corner * static_cast<float>(trackScale));
+  return frameCorners;
+}
+
+int64_t VideoScanner::getNumFrames() const
+{
+  return numFrames;
+}
+
+int64_t VideoScanner::getNumDetections() const
+{
+  return numDetections;
+}
+
+int64_t VideoScanner::getNumPages() const
+{
+  return numPages;
+}
+
+// OPEN: FILE / URL, OR A CAMERA INDEX
+/******************************************************************************/
+bool VideoScanner::open(const string& source)
+{
+  bool isIndex = !source.empty() &&
+                 all_of(source.begin(), source.end(),
+                        [](unsigned char c) { return isdigit(c); });
+  if (isIndex)
+    capture.open(stoi(source));
+  else
+    capture.open(source);
+  return capture.isOpened();
+}
+
+// RUN - MACRO
+/******************************************************************************/
+int64_t VideoScanner::run()
+{
+  Mat frame;
+  while (capture.read(frame))
+    processFrame(frame, capture.get(CAP_PROP_POS_MSEC));
+  return numPages;
+}
+
+// PROCESS ONE FRAME
+/******************************************************************************/
+bool VideoScanner::processFrame(const Mat& frame, double timestampMs)
+{
+  ++numFrames;
+  if (frame.empty())
+    return false;
+
+  // TRACKING PYRAMID LEVEL + SCENE THUMBNAIL
+  int longSide = max(frame.cols, frame.rows);
+  trackScale = longSide > videoOptions.trackingSize ?
+               static_cast<double>(longSide) / videoOptions.trackingSize : 1.0;
+  Mat small = frame;
+  if (trackScale > 1.0)
+    resize(frame, small, cv::Size(cvRound(frame.cols / trackScale),
+                                  cvRound(frame.rows / trackScale)),
+           0, 0, INTER_AREA);
+  if (small.channels() == 3)
+    cvtColor(small, gray, COLOR_BGR2GRAY);
+  else
+    small.copyTo(gray);
+  resize(gray, thumb, cv::Size(32, 24), 0, 0, INTER_AREA);
+
+  bool sceneChange = false;
+  staticScene = false;
+  if (!prevThumb.empty() && prevGray.size() == gray.size())
+  {
+    Mat thumbDiff;
+    absdiff(thumb, prevThumb, thumbDiff);
+    double diff = mean(thumbDiff)[0];
+    sceneChange = diff > videoOptions.sceneChangeThreshold;
+    staticScene = diff < videoOptions.staticSceneThreshold;
+  }
+  else
+    sceneChange = true;
+
+  if (sceneChange)
+  {
+    tracking    = false;
+    pageEmitted = false;
+    detectCooldown = 0;
+  }
+  else if (tracking && !track())
+  {
+    // LOST: TRY A FULL DETECTION ON THIS VERY FRAME
+    tracking = false;
+    detectCooldown = 0;
+  }
+  if (!tracking && detectCooldown-- <= 0)
+    tracking = detect(frame);
+
+  bool emitted = emitIfStable(frame, timestampMs);
+  std::swap(gray, prevGray);
+  std::swap(thumb, prevThumb);
+  return emitted;
+}
+
+// FULL DETECTION ON A KEY FRAME
+/******************************************************************************/
+bool VideoScanner::detect(const Mat& frame)
+{
+  ++numDetections;
+  vector<Point2f> quad;
+  try
+  {
+    ds.reset(frame);
+    ds.runDetection();
+    ds.findCorners();
+    quad = ds.fullResCorners();
+  }
+  catch (const exception&)
+  {
+    quad.clear();
+  }
+  for (auto& corner : quad)
+    corner /= static_cast<float>(trackScale);
+  if (!isPlausibleQuad(quad))
+  {
+    detectCooldown = videoOptions.redetectBackoff;
+    return false;
+  }
+
+  // THE SAME PAGE FOUND AGAIN IS NOT A NEW PAGE
+  double diag = norm(quad[0] - quad[2]);
+  if (pageEmitted &&
+      maxCornerMotion(quad, emittedCorners) > videoOptions.newPageMotion * diag)
+    pageEmitted = false;
+  corners = prevCorners = quad;
+  stillFrames = 0;
+  seedFeatures();
+  return true;
+}
+
+// TRACK: LK ON THE PAGE FEATURES, RANSAC HOMOGRAPHY, MOVE THE CORNERS
+/******************************************************************************/
+bool VideoScanner::track()
+{
+  prevCorners = corners;
+  if (static_cast<int>(features.size()) < videoOptions.minFeatures)
+    // NOTHING TO TRACK ON A PLAIN PAGE: HOLD IT WHILE THE SCENE IS STILL
+    return staticScene;
+
+  vector<Point2f> next;
+  vector<uchar> status;
+  vector<float> err;
+  calcOpticalFlowPyrLK(prevGray, gray, features, next, status, err,
+                       cv::Size(21, 21), 3);
+  vector<Point2f> from, to;
+  for (size_t i = 0; i < status.size(); ++i)
+    if (status[i])
+    {
+      from.push_back(features[i]);
+      to.push_back(next[i]);
+    }
+  if (static_cast<int>(to.size()) < videoOptions.minFeatures)
+    return false;
+
+  Mat inliers;
+  Mat h = findHomography(from, to, RANSAC, 2.0, inliers);
+  if (h.empty())
+    return false;
+  int numInliers = countNonZero(inliers);
+  if (numInliers < videoOptions.minFeatures ||
+      numInliers < videoOptions.minConfidence * features.size())
+    return false;
+
+  vector<Point2f> moved;
+  perspectiveTransform(corners, moved, h);
+  if (!isPlausibleQuad(moved))
+    return false;
+  corners = moved;
+
+  features.clear();
+  for (size_t i = 0; i < to.size(); ++i)
+    if (inliers.at<uchar>(static_cast<int>(i)))
+      features.push_back(to[i]);
+  if (static_cast<int>(features.size()) < videoOptions.maxFeatures / 2)
+    seedFeatures();
+  return true;
+}
+
+// SEED FEATURES: CORNERS ON THE PAGE AND ALONG ITS BORDER
+/******************************************************************************/
+void VideoScanner::seedFeatures()
+{
+  Mat mask(gray.size(), CV_8U, Scalar(0));
+  vector<cv::Point> quad;
+  for (const auto& corner : corners)
+    quad.emplace_back(cvRound(corner.x), cvRound(corner.y));
+  fillConvexPoly(mask, quad, Scalar(255));
+  polylines(mask, vector<vector<cv::Point>>{quad}, true, Scalar(255), 15);
+  goodFeaturesToTrack(gray, features, videoOptions.maxFeatures, 0.01, 7,
+                      mask);
+}
+
+// PLAUSIBLE QUAD: CONVEX, LARGE ENOUGH, (ALMOST) INSIDE THE FRAME
+/******************************************************************************/
+bool VideoScanner::isPlausibleQuad(const vector<Point2f>& quad) const
+{
+  if (quad.size() != 4 || !isContourConvex(quad))
+    return false;
+  float marginX = 0.05f * gray.cols, marginY = 0.05f * gray.rows;
+  for (const auto& corner : quad)
+    if (corner.x < -marginX || corner.x > gray.cols + marginX ||
+        corner.y < -marginY || corner.y > gray.rows + marginY)
+      return false;
+  // HALF THE DETECTOR'S MINIMUM: A TRACKED PAGE MAY SHRINK A LITTLE
+  return contourArea(quad) >=
+         0.5 * options.minQuadAreaFraction * gray.total();
+}
+
+double VideoScanner::maxCornerMotion(const vector<Point2f>& a,
+                                     const vector<Point2f>& b) const
+{
+  double motion = 0.0;
+  for (size_t i = 0; i < a.size() && i < b.size(); ++i)
+    motion = max(motion, static_cast<double>(norm(a[i] - b[i])));
+  return motion;
+}
+
+// EMIT: WARP THE FULL FRAME ONCE THE PAGE HAS BEEN STILL FOR A WHILE
+/******************************************************************************/
+bool VideoScanner::emitIfStable(const Mat& frame, double timestampMs)
+{
+  if (!tracking)
+  {
+    stillFrames = 0;
+    return false;
+  }
+  stillFrames = maxCornerMotion(corners, prevCorners) <
+                videoOptions.stableMotionPx ? stillFrames + 1 : 0;
+  double diag = norm(corners[0] - corners[2]);
+  if (pageEmitted && maxCornerMotion(corners, emittedCorners) >
+                     videoOptions.newPageMotion * diag)
+    pageEmitted = false;
+  if (pageEmitted || stillFrames < videoOptions.stableFrames)
+    return false;
+
+  // TRACKED CORNERS ARE SUB-PIXEL AT TRACKING RESOLUTION, SO THEY ARE WITHIN
+  // ABOUT trackScale PX IN THE FRAME
+  VideoPage info;
+  info.frameIndex  = numFrames - 1;
+  info.timestampMs = timestampMs;
+  info.corners     = getCorners();
+  try
+  {
+    ds.warpQuad(frame, info.corners);
+  }
+  catch (const exception&)
+  {
+    return false;
+  }
+  pageEmitted    = true;
+  emittedCorners = corners;
+  ++numPages;
+  if (onPage)
+    onPage(ds.getFinalImg(), info);
+  return true;
+}
@@ -0,0 +1,120 @@
+//
+// Streaming front end: track the page across video frames, emit stable pages.
+//
+
+#ifndef DOCUMENTSCANNER_VIDEOSCANNER_H
+#define DOCUMENTSCANNER_VIDEOSCANNER_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <opencv2/videoio.hpp>
+
+#include "DocumentScanner.h"
+
+struct VideoOptions
+{
+  // Long side (px) of the grayscale frames used for tracking
+  int trackingSize = 640;
+  // Features followed with pyramidal Lucas-Kanade inside the page
+  int maxFeatures = 80;
+  // Tracking is lost (and full detection re-run) when fewer than
+  // minFeatures survive, or fewer than minConfidence of the features
+  // tracked into this frame agree with the frame-to-frame homography
+  int minFeatures = 10;
+  double minConfidence = 0.6;
+  // Mean absolute grey difference between consecutive 32x24 thumbnails
+  // that counts as a scene change (new page, cut, camera moved)
+  double sceneChangeThreshold = 25.0;
+  // Below this thumbnail difference a page too plain to track features on
+  // is assumed not to have moved
+  double staticSceneThreshold = 2.0;
+  // A page is emitted once its corners have moved less than stableMotionPx
+  // (tracking px) per frame for stableFrames frames in a row
+  double stableMotionPx = 1.5;
+  int stableFrames = 8;
+  // Corner motion since the last emitted page, as a fraction of the page
+  // diagonal, that makes it a new page
+  double newPageMotion = 0.15;
+  // Frames to wait between failed detections
+  int redetectBackoff = 5;
+};
+
+// Where a page was found: frame index, stream timestamp and its corners in
+// frame coordinates (CW from the upper left)
+struct VideoPage
+{
+  int64_t frameIndex = 0;
+  double timestampMs = 0.0;
+  std::vector<cv::Point2f> corners;
+};
+
+// Full detection (GrabCut / quad detector at DSOptions::detectionSize) only
+// runs on the first frame, after a scene change, or when tracking fails.
+// Every other frame costs a downscale, one LK step over a few dozen
+// features and a RANSAC homography, which keeps up with a camera on a
+// single core.
+class VideoScanner
+{
+public:
+  // page is only valid during the call (it is a reused buffer); clone it
+  // to keep it
+  using PageCallback = std::function<void(const cv::Mat& page,
+                                          const VideoPage& info)>;
+
+private:
+  DSOptions options;
+  VideoOptions videoOptions;
+  DocumentScanner ds;
+  cv::VideoCapture capture;
+  PageCallback onPage;
+
+  // TRACKING STATE (TRACKING-RESOLUTION COORDINATES)
+  bool tracking = false;
+  double trackScale = 1.0; // frame px per tracking px
+  cv::Mat gray, prevGray, thumb, prevThumb;
+  std::vector<cv::Point2f> features;
+  std::vector<cv::Point2f> corners, prevCorners, emittedCorners;
+  bool pageEmitted = false;
+  bool staticScene = false;
+  int stillFrames = 0;
+  int detectCooldown = 0;
+
+  int64_t numFrames = 0;
+  int64_t numDetections = 0;
+  int64_t numPages = 0;
+
+  /******************************* PRIVATE METHODS ****************************/
+  bool detect(const cv::Mat& frame);
+  bool track();
+  void seedFeatures();
+  bool isPlausibleQuad(const std::vector<cv::Point2f>& quad) const;
+  double maxCornerMotion(const std::vector<cv::Point2f>& a,
+                         const std::vector<cv::Point2f>& b) const;
+  bool emitIfStable(const cv::Mat& frame, double timestampMs);
+
+public:
+  /****************************** CONSTRUCTORS ********************************/
+  explicit VideoScanner(DSOptions opts = DSOptions(),
+                        VideoOptions vidOpts = VideoOptions());
+
+  /**************************** SETTERS & GETTERS *****************************/
+  void setPageCallback(PageCallback callback);
+  [[nodiscard]] bool isTracking() const;
+  // Current page corners in frame coordinates (empty when not tracking)
+  [[nodiscard]] std::vector<cv::Point2f> getCorners() const;
+  [[nodiscard]] int64_t getNumFrames() const;
+  [[nodiscard]] int64_t getNumDetections() const;
+  [[nodiscard]] int64_t getNumPages() const;
+
+  /*************************** PUBLIC METHODS *********************************/
+  // A video file, a stream URL, or a camera index ("0")
+  bool open(const std::string& source);
+  // Process one BGR frame from any source; true if it emitted a page
+  bool processFrame(const cv::Mat& frame, double timestampMs = 0.0);
+  // Read the opened source to the end; returns the number of pages
+  int64_t run();
+};
+
+#endif //DOCUMENTSCANNER_VIDEOSCANNER_H
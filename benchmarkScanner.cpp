@@ -0,0 +1,571 @@
+//
+// Per-stage latency / throughput / memory benchmark over images/.
+//
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <sstream>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+#include <opencv2/opencv.hpp>
+
+#include "DocumentScanner.h"
+#include "BatchScanner.h"
+#include "DSPreprocess.h"
+#include "DSMaskKernels.h"
+#include "DSTiledWarp.h"
+#include "DSBinarize.h"
+#include "DSEncoder.h"
+
+using namespace std;
+using namespace cv;
+namespace fs = std::filesystem;
+
+struct StageStats
+{
+  double minMs    = 0.0;
+  double medianMs = 0.0;
+  double p95Ms    = 0.0;
+};
+
+/******************************************************************************/
+static StageStats summarize(vector<double> samples)
+{
+  StageStats stats;
+  if (samples.empty())
+    return stats;
+  sort(samples.begin(), samples.end());
+  auto percentile = [&samples](double p)
+  {
+    size_t idx = static_cast<size_t>(p * (samples.size() - 1) + 0.5);
+    return samples[min(idx, samples.size() - 1)];
+  };
+  stats.minMs    = samples.front();
+  stats.medianMs = percentile(0.5);
+  stats.p95Ms    = percentile(0.95);
+  return stats;
+}
+
+// MAT MEMORY: EVERY cv::Mat ALLOCATION GOES THROUGH THIS COUNTER
+/******************************************************************************/
+// Wraps OpenCV's own allocator and tracks the bytes live and their peak, so
+// each stage reports the Mat memory it needed on top of what was already
+// allocated when it started (pooled buffers that are reused count as 0).
+class CountingAllocator : public MatAllocator
+{
+private:
+  MatAllocator* base = Mat::getStdAllocator();
+  mutable atomic<size_t> liveBytes{0};
+  mutable atomic<size_t> peakBytes{0};
+
+  void add(size_t bytes) const
+  {
+    size_t live = liveBytes += bytes;
+    size_t peak = peakBytes;
+    while (live > peak && !peakBytes.compare_exchange_weak(peak, live))
+      ;
+  }
+
+public:
+  UMatData* allocate(int dims, const int* sizes, int type, void* data,
+                     size_t* step, AccessFlag flags,
+                     UMatUsageFlags usageFlags) const override
+  {
+    UMatData* u = base->allocate(dims, sizes, type, data, step, flags,
+                                usageFlags);
+    if (u)
+    {
+      u->currAllocator = this;
+      if (!(u->flags & UMatData::USER_ALLOCATED))
+        add(u->size);
+    }
+    return u;
+  }
+  bool allocate(UMatData* u, AccessFlag flags,
+                UMatUsageFlags usageFlags) const override
+  {
+    return base->allocate(u, flags, usageFlags);
+  }
+  void deallocate(UMatData* u) const override
+  {
+    if (u && !(u->flags & UMatData::USER_ALLOCATED))
+      liveBytes -= u->size;
+    base->deallocate(u);
+  }
+  // Peak from here on starts at what is live now
+  void resetPeak() const
+  {
+    peakBytes = liveBytes.load();
+  }
+  [[nodiscard]] size_t live() const
+  {
+    return liveBytes;
+  }
+  [[nodiscard]] size_t peak() const
+  {
+    return peakBytes;
+  }
+};
+
+// NEVER DESTROYED: STATIC MATS ARE RELEASED THROUGH IT AFTER main()
+static CountingAllocator& matCounter = *new CountingAllocator;
+static double stagePeakMb = 0.0; // set by timeIt(), printed by printRow()
+
+// RUN fn() numIterations TIMES, RETURN MILLISECONDS PER CALL
+/******************************************************************************/
+static vector<double> timeIt(int numIterations, const function<void()>& fn)
+{
+  vector<double> samples;
+  size_t startBytes = matCounter.live();
+  matCounter.resetPeak();
+  for (int i = 0; i < numIterations; ++i)
+  {
+    auto start = chrono::steady_clock::now();
+    fn();
+    auto stop = chrono::steady_clock::now();
+    samples.push_back(
+      chrono::duration<double, milli>(stop - start).count());
+  }
+  stagePeakMb = (matCounter.peak() - startBytes) / (1024.0 * 1024.0);
+  return samples;
+}
+
+/******************************************************************************/
+static void printHeader()
+{
+  cout << left << setw(22) << "image" << setw(12) << "size"
+       << setw(24) << "stage" << right
+       << setw(10) << "min ms" << setw(10) << "med ms" << setw(10) << "p95 ms"
+       << setw(10) << "MP/s" << setw(12) << "peak Mat MB" << endl;
+}
+
+static void printRow(const string& image, const string& size,
+                     const string& stage, const vector<double>& samples,
+                     double megapixels)
+{
+  StageStats stats = summarize(samples);
+  double mps = stats.medianMs > 0.0 ? megapixels / (stats.medianMs / 1000.0)
+                                    : 0.0;
+  cout << left << setw(22) << image << setw(12) << size << setw(24) << stage
+       << right << fixed << setprecision(2)
+       << setw(10) << stats.minMs << setw(10) << stats.medianMs
+       << setw(10) << stats.p95Ms << setw(10) << mps
+       << setprecision(1) << setw(12) << stagePeakMb << endl;
+}
+
+// PREPROCESSING: THE SEPARATE PASSES VS. THE FUSED KERNEL
+/******************************************************************************/
+// Bytes read + written per working pixel, each pass's input and output
+// counted once (a = source pixels per working pixel):
+//   separate  resize 3a+3 (when a > 1), GaussianBlur 3+3, threshold 3+3,
+//             cvtColor 3+1
+//   fused     source 3a, work 3 (when a > 1), blurred 3, gray 1, thresh 3
+static void benchmarkPreprocess(const string& name, const Mat& decoded,
+                                int longSide, int numIterations)
+{
+  cv::Size workSz = decoded.size();
+  int nativeLongSide = max(decoded.cols, decoded.rows);
+  if (longSide > 0 && longSide < nativeLongSide)
+  {
+    double scale = static_cast<double>(longSide) / nativeLongSide;
+    workSz = cv::Size(max(1, cvRound(decoded.cols * scale)),
+                      max(1, cvRound(decoded.rows * scale)));
+  }
+  string size = to_string(workSz.width) + "x" + to_string(workSz.height);
+  double mp = decoded.total() / 1e6;
+  bool downscale = workSz != decoded.size();
+  double a = static_cast<double>(decoded.total()) / workSz.area();
+
+  Mat work, blurred, gray, thresh;
+  printRow(name, size, "preprocess separate",
+           timeIt(numIterations, [&]() {
+             const Mat* in = &decoded;
+             if (downscale)
+             {
+               resize(decoded, work, workSz, 0, 0, INTER_AREA);
+               in = &work;
+             }
+             GaussianBlur(*in, blurred, cv::Size(9, 9), 4.0);
+             threshold(blurred, thresh, 165, 255, THRESH_BINARY);
+             cvtColor(blurred, gray, COLOR_BGR2GRAY);
+           }), mp);
+  printRow(name, size, "preprocess fused",
+           timeIt(numIterations, [&]() {
+             fusedPreprocess(decoded, workSz, work, blurred, gray, thresh);
+           }), mp);
+
+  double separateBytes = (downscale ? 3 * a + 3 : 0.0) + 6 + 6 + 4;
+  double fusedBytes    = 3 * a + (downscale ? 3 : 0.0) + 7;
+  cout << left << setw(22) << name << setw(12) << size
+       << "bytes/working px: separate " << fixed << setprecision(1)
+       << separateBytes << ", fused " << fusedBytes << endl;
+}
+
+// FINAL WARP: WHOLE PAGE VS. TILED BANDS (NATIVE SIZE)
+/******************************************************************************/
+// A fixed 5% inset quad. Page memory is the output held at once: the whole
+// page for warpPerspective, two bands for the budgeted tiled warp.
+class NullStripSink : public StripSink
+{
+public:
+  void begin(cv::Size, int) override {}
+  void write(const Mat&, int) override {}
+  void end() override {}
+};
+
+static void benchmarkTiledWarp(const string& name, const Mat& decoded,
+                               int numIterations)
+{
+  string size = to_string(decoded.cols) + "x" + to_string(decoded.rows);
+  double mp = decoded.total() / 1e6;
+  float dx = 0.05f * decoded.cols, dy = 0.05f * decoded.rows;
+  vector<Point2f> quad = {
+    Point2f(dx, dy), Point2f(decoded.cols - dx, 1.5f * dy),
+    Point2f(decoded.cols - 1.5f * dx, decoded.rows - dy),
+    Point2f(dx, decoded.rows - dy)
+  };
+  cv::Size pageSz(cvRound(decoded.cols - 2 * dx),
+                  cvRound(decoded.rows - 2 * dy));
+  vector<Point2f> dst = {
+    Point2f(0, 0), Point2f(pageSz.width - 1, 0),
+    Point2f(pageSz.width - 1, pageSz.height - 1),
+    Point2f(0, pageSz.height - 1)
+  };
+  Mat h = getPerspectiveTransform(quad, dst);
+  const size_t budget = 64u << 20;
+  int bandRows = bandRowsForBudget(pageSz, decoded.type(), budget);
+
+  Mat page;
+  MatStripSink toMat(page);
+  NullStripSink toNull;
+  printRow(name, size, "warpPerspective",
+           timeIt(numIterations, [&]() {
+             warpPerspective(decoded, page, h, pageSz);
+           }), mp);
+  // OPENCV IS SINGLE-THREADED HERE, AS IN THE PIPELINE: THE TILE THREADS
+  // ARE THE ONLY PARALLELISM
+  printRow(name, size, "tiledWarp 1 thread",
+           timeIt(numIterations, [&]() {
+             tiledWarp(decoded, h, pageSz, toMat, pageSz.height,
+                       cv::Size(512, 256), 1);
+           }), mp);
+  printRow(name, size, "tiledWarp whole page",
+           timeIt(numIterations, [&]() {
+             tiledWarp(decoded, h, pageSz, toMat, pageSz.height);
+           }), mp);
+  printRow(name, size, "tiledWarp 64MB bands",
+           timeIt(numIterations, [&]() {
+             tiledWarp(decoded, h, pageSz, toNull, bandRows);
+           }), mp);
+  double rowMb = pageSz.width * decoded.elemSize() / (1024.0 * 1024.0);
+  cout << left << setw(22) << name << setw(12) << size
+       << "page MB: whole " << fixed << setprecision(1)
+       << rowMb * pageSz.height << ", 64MB bands "
+       << rowMb * 2 * bandRows << endl;
+}
+
+// BINARIZATION: SEPARATE OPENCV PASSES VS. THE FUSED 1-BIT KERNEL
+/******************************************************************************/
+// The separate chain is what a downstream tool would run on the colour
+// page: gray, a mean adaptive threshold and a median despeckle, each a full
+// page pass (and none of them flattens the illumination).
+static void benchmarkBinarize(const string& name, const Mat& decoded,
+                              int numIterations)
+{
+  string size = to_string(decoded.cols) + "x" + to_string(decoded.rows);
+  double mp = decoded.total() / 1e6;
+  Mat gray, bw;
+  printRow(name, size, "gray+adaptive+median",
+           timeIt(numIterations, [&]() {
+             cvtColor(decoded, gray, COLOR_BGR2GRAY);
+             adaptiveThreshold(gray, bw, 255, ADAPTIVE_THRESH_MEAN_C,
+                               THRESH_BINARY, 31, 10);
+             medianBlur(bw, bw, 3);
+           }), mp);
+  BinaryPage page;
+  printRow(name, size, "binarizePage",
+           timeIt(numIterations, [&]() { binarizePage(decoded, page); }), mp);
+  BinarizeOptions noFlatten;
+  noFlatten.backgroundCell = 0;
+  printRow(name, size, "binarizePage no flatten",
+           timeIt(numIterations, [&]() {
+             binarizePage(decoded, page, noFlatten);
+           }), mp);
+  cout << left << setw(22) << name << setw(12) << size
+       << "page KB: BGR " << (decoded.total() * decoded.elemSize() >> 10)
+       << ", 1-bit " << (page.bits.total() >> 10) << endl;
+}
+
+// OUTPUT ENCODERS: EACH FORMAT, THEN A JPEG SIZE SEARCH
+/******************************************************************************/
+// The budget is half the quality-90 JPEG, so the search has to work for it.
+static void benchmarkEncode(const string& name, const Mat& decoded,
+                            int numIterations)
+{
+  string size = to_string(decoded.cols) + "x" + to_string(decoded.rows);
+  double mp = decoded.total() / 1e6;
+  BinaryPage bits;
+  binarizePage(decoded, bits);
+  vector<uchar> out;
+  EncodeReport report;
+  EncodeOptions options;
+  ostringstream sizes;
+  for (const string ext : {".jpg", ".webp", ".png"})
+  {
+    printRow(name, size, "encodePage " + ext,
+             timeIt(numIterations, [&]() {
+               encodePage(decoded, ext, out, options, &report);
+             }), mp);
+    sizes << " " << ext << " " << (report.bytes >> 10);
+  }
+  for (const string ext : {".tif", ".png", ".pbm"})
+  {
+    printRow(name, size, "encodePage 1-bit " + ext,
+             timeIt(numIterations, [&]() {
+               encodePage(bits, ext, out, options, &report);
+             }), mp);
+    sizes << " 1-bit " << ext << " " << (report.bytes >> 10);
+  }
+  encodePage(decoded, ".jpg", out, options, &report);
+  options.targetBytes = report.bytes / 2;
+  printRow(name, size, "encodePage .jpg budget",
+           timeIt(numIterations, [&]() {
+             encodePage(decoded, ".jpg", out, options, &report);
+           }), mp);
+  cout << left << setw(22) << name << setw(12) << size << "page KB:"
+       << sizes.str() << "; budget " << (options.targetBytes >> 10)
+       << " -> " << (report.bytes >> 10) << " at q" << report.quality
+       << " in " << report.encodes << " encodes" << endl;
+}
+
+// INPUT PATHS: FILE, TEMP FILE ROUND TRIP, BYTES IN MEMORY
+/******************************************************************************/
+// What a service holding the encoded bytes pays to get them into a scanner:
+// writing them to a temp file for reset(path), versus reset(data, size).
+static void benchmarkInput(const string& name, const fs::path& path,
+                           int numIterations)
+{
+  ifstream file(path, ios::binary);
+  vector<uchar> bytes((istreambuf_iterator<char>(file)),
+                      istreambuf_iterator<char>());
+  DSOptions options;
+  options.headless      = true;
+  options.detectionSize = 1024;
+  fs::path tmpPath = fs::temp_directory_path() / ("ds_bench_" + name);
+  try
+  {
+    DocumentScanner ds(options);
+    ds.reset(bytes.data(), bytes.size()); // WARM THE POOL
+    printRow(name, to_string(bytes.size() >> 10) + " KB",
+             "reset temp file",
+             timeIt(numIterations, [&]() {
+               ofstream(tmpPath, ios::binary).write(
+                 reinterpret_cast<const char*>(bytes.data()),
+                 static_cast<streamsize>(bytes.size()));
+               ds.reset(tmpPath.string());
+             }), 0.0);
+    printRow(name, to_string(bytes.size() >> 10) + " KB",
+             "reset bytes",
+             timeIt(numIterations, [&]() {
+               ds.reset(bytes.data(), bytes.size());
+             }), 0.0);
+  }
+  catch (const exception& exp)
+  {
+    cerr << name << ": " << exp.what() << endl;
+  }
+  error_code ec;
+  fs::remove(tmpPath, ec);
+}
+
+// GRABCUT MASK KERNELS ON RANDOM LABELS AT COMMON CAMERA SIZES
+/******************************************************************************/
+static void benchmarkMaskKernels(int numIterations)
+{
+  const vector<cv::Size> sizes = {{640, 480}, {1280, 960}, {2016, 1512},
+                                  {4032, 3024}};
+  for (const auto& sz : sizes)
+  {
+    string size = to_string(sz.width) + "x" + to_string(sz.height);
+    double mp = sz.area() / 1e6;
+    Mat labels(sz, CV_8UC1), bgr(sz, CV_8UC3), gray(sz, CV_8UC1);
+    randu(labels, Scalar(GC_BGD), Scalar(GC_PR_FGD + 1));
+    randu(bgr, Scalar::all(0), Scalar::all(256));
+    randu(gray, Scalar::all(0), Scalar::all(256));
+    Mat dst, fg, odd;
+
+    // THE PER-PIXEL LOOP runGrabCut USED TO RUN (WITH ITS MASK READ FIXED)
+    printRow("mask kernels", size, "scalar ptr(i,j) loop",
+             timeIt(numIterations, [&]() {
+               bgr.copyTo(dst);
+               for (int i = 0; i < labels.rows; ++i)
+                 for (int j = 0; j < labels.cols; ++j)
+                   if ((labels.ptr<uchar>(i, j)[0] & 1) == 0)
+                     for (int chanNum = 0; chanNum < 3; ++chanNum)
+                       dst.ptr(i, j)[chanNum] = 0;
+             }), mp);
+    printRow("mask kernels", size, "compare + copyTo",
+             timeIt(numIterations, [&]() {
+               bitwise_and(labels, Scalar(1), odd);
+               compare(odd, Scalar(0), fg, CMP_NE);
+               dst.create(bgr.size(), bgr.type());
+               dst.setTo(Scalar::all(0));
+               bgr.copyTo(dst, fg);
+             }), mp);
+    printRow("mask kernels", size, "grabCutForeground",
+             timeIt(numIterations, [&]() {
+               grabCutForeground(labels, fg);
+             }), mp);
+    printRow("mask kernels", size, "applyGrabCutLabels BGR",
+             timeIt(numIterations, [&]() {
+               applyGrabCutLabels(bgr, labels, dst);
+             }), mp);
+    printRow("mask kernels", size, "applyGrabCutLabels gray",
+             timeIt(numIterations, [&]() {
+               applyGrabCutLabels(gray, labels, dst);
+             }), mp);
+  }
+}
+
+// STAGES OF ONE IMAGE AT ONE SIZE
+/******************************************************************************/
+static void benchmarkStages(const string& name, const Mat& input,
+                            int numIterations)
+{
+  string size = to_string(input.cols) + "x" + to_string(input.rows);
+  double mp   = input.total() / 1e6;
+
+  DSOptions options;
+  options.headless = true;
+  // NO INTERNAL DOWNSCALING: THE STAGES RUN AT EXACTLY THIS SIZE
+  options.detectionSize = max(input.cols, input.rows);
+  try
+  {
+    DSOptions warmOptions = options;
+    warmOptions.grabCutWarmStart = true;
+    DocumentScanner ds(input, warmOptions);
+    printRow(name, size, "preprocess",
+             timeIt(numIterations, [&]() { ds.preprocess(); }), mp);
+    // RECTANGLE INIT (FIXED 2 ITERATIONS) FOR COMPARISON WITH THE WARM START
+    DocumentScanner dsRect(input, options);
+    printRow(name, size, "runGrabCut rect x2",
+             timeIt(numIterations, [&]() { dsRect.runGrabCut(2); }), mp);
+    vector<double> warmSamples =
+      timeIt(numIterations, [&]() { ds.runGrabCut(2); });
+    printRow(name, size,
+             "runGrabCut warm x" + to_string(ds.getGrabCutIterations()),
+             warmSamples, mp);
+    // SESSION MODEL: LEARNED BY THE FIRST CALL, FROZEN IN THE TIMED ONES
+    DSOptions modelOptions = options;
+    modelOptions.grabCutModel = make_shared<GrabCutModel>();
+    DocumentScanner dsModel(input, modelOptions);
+    dsModel.runGrabCut(2);
+    vector<double> modelSamples =
+      timeIt(numIterations, [&]() { dsModel.runGrabCut(2); });
+    printRow(name, size,
+             dsModel.isGrabCutModelReused() ? "runGrabCut model x1" :
+                                              "runGrabCut model relearn",
+             modelSamples, mp);
+    printRow(name, size, "runFindContours",
+             timeIt(numIterations, [&]() { ds.runFindContours(); }), mp);
+    printRow(name, size, "findCorners",
+             timeIt(numIterations, [&]() { ds.findCorners(); }), mp);
+    printRow(name, size, "performFindHomography",
+             timeIt(numIterations, [&]() { ds.performFindHomography(); }),
+             mp);
+  }
+  catch (const exception& exp)
+  {
+    cerr << name << " @ " << size << ": " << exp.what() << endl;
+  }
+}
+
+/******************************************************************************/
+int main(int argc, char* argv[])
+{
+  fs::path imagesDir = "../images";
+  int numIterations  = 3;
+  vector<int> longSides = {512, 1024, 2000, 0}; // 0 = native size
+  for (int i = 1; i < argc; ++i)
+  {
+    string arg(argv[i]);
+    if (arg == "-n" && i + 1 < argc)
+      numIterations = max(1, stoi(argv[++i]));
+    else if (arg == "-s" && i + 1 < argc)
+    {
+      longSides.clear();
+      stringstream ss(argv[++i]);
+      string item;
+      while (getline(ss, item, ','))
+        longSides.push_back(item == "full" ? 0 : stoi(item));
+    }
+    else if (arg[0] != '-')
+      imagesDir = arg;
+    else
+    {
+      cout << "USAGE:" << endl
+           << "./benchmarkScanner [imagesDir] [-n <iterations>] "
+              "[-s <longSide,...|full>]" << endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  vector<fs::path> images;
+  if (fs::is_directory(imagesDir))
+    for (const auto& entry : fs::directory_iterator(imagesDir))
+      if (entry.is_regular_file() && BatchScanner::isImageFile(entry.path()))
+        images.push_back(entry.path());
+  sort(images.begin(), images.end());
+  if (images.empty())
+  {
+    cerr << "No images found in " << imagesDir << endl;
+    return EXIT_FAILURE;
+  }
+
+  setNumThreads(1); // SINGLE-CORE NUMBERS ARE THE ONES THAT REGRESS
+  Mat::setDefaultAllocator(&matCounter);
+  printHeader();
+  benchmarkMaskKernels(numIterations);
+  for (const auto& path : images)
+  {
+    string name = path.filename().string();
+    Mat decoded;
+    vector<double> loadSamples = timeIt(numIterations, [&]() {
+      decoded = imread(path.string());
+    });
+    if (decoded.empty())
+    {
+      cerr << "Could not load " << path << endl;
+      continue;
+    }
+    printRow(name, to_string(decoded.cols) + "x" + to_string(decoded.rows),
+             "imread", loadSamples, decoded.total() / 1e6);
+    benchmarkTiledWarp(name, decoded, numIterations);
+    benchmarkInput(name, path, numIterations);
+    benchmarkBinarize(name, decoded, numIterations);
+    benchmarkEncode(name, decoded, numIterations);
+
+    int nativeLongSide = max(decoded.cols, decoded.rows);
+    for (int longSide : longSides)
+    {
+      if (longSide > nativeLongSide)
+        continue;
+      benchmarkPreprocess(name, decoded, longSide, numIterations);
+      Mat input = decoded;
+      if (longSide > 0 && longSide < nativeLongSide)
+      {
+        double scale = static_cast<double>(longSide) / nativeLongSide;
+        resize(decoded, input, cv::Size(), scale, scale, INTER_AREA);
+      }
+      benchmarkStages(name, input, numIterations);
+    }
+  }
+  return 0;
+}
@@ -1,35 +1,561 @@
 #include <iostream>
 #include <stdexcept>
 #include <filesystem>
+#include <fstream>
+#include <cstdio>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <future>
+#include <mutex>
+#include <thread>
 
 #include "DocumentScanner.h"
+#include "BatchScanner.h"
+#include "VideoScanner.h"
+#include "DSDaemon.h"
 
 using namespace std;
 using namespace cv;
 namespace fs = __fs::filesystem;
 
+static void printUsage()
+{
+  cout << "USAGE:" << endl
+       << "./documentScanner <filename> [-C <resultCacheDir>]" << endl
+       << "-OR-" << endl
+       << "./documentScanner" << endl
+       << "-OR- (headless)" << endl
+       << "./documentScanner --batch <outputDir> [-j <threads>] "
+          "[-e grabcut|contours|auto] [-s <detectionSize>] "
+          "[-t <trace.json>] [-l <trace.log>] [-c <remapCacheMB>] "
+          "[-p <decode>,<segment>,<warp>,<encode> threads] "
+          "[-q <queueCapacity>] [-m <maxInFlight>|-X <memoryCapMB>] "
+          "[-g <grabCutBudgetMs>|warm] [-M <outputPageBudgetMB>] "
+          "[-o <outputExt>] [-D <maxDocumentsPerImage>] "
+          "[-C <resultCacheDir>] [-T <latencyBudgetMs> [-F]] "
+          "[-G <grabCutModel.yml>] [-B] [-k <quality>] "
+          "[-b <targetBytes>] <file|directory>..." << endl
+       << "-OR- (video file, stream URL or camera index)" << endl
+       << "./documentScanner --video <source> <outputDir> "
+          "[-e grabcut|contours|auto] [-k <quality>] [-b <targetBytes>] "
+          "[-x <outputExt>]" << endl
+       << "-OR- (daemon on a Unix domain socket, and its client)" << endl
+       << "./documentScanner --serve <socketPath> [-j <scanners>] "
+          "[-e grabcut|contours|auto] [-s <detectionSize>] "
+          "[-C <resultCacheDir>] [-T <latencyBudgetMs> [-F]] "
+          "[-G <grabCutModel.yml>] [-B] [-k <quality>] "
+          "[-b <targetBytes>] [-Q] [-R <pathRoot>]" << endl
+       << "./documentScanner --client <socketPath> [--paths] [--corners-only] "
+          "[-P <connections>] [-r <repeat>] [-o <outputDir>] "
+          "[-x <outputExt>] <file>... | --shutdown" << endl;
+}
+
+// SESSION GRABCUT MODEL: LOADED IF THE FILE EXISTS, SAVED ON EXIT
+/******************************************************************************/
+static shared_ptr<GrabCutModel> loadGrabCutModel(const string& path)
+{
+  auto model = make_shared<GrabCutModel>();
+  if (model->load(path))
+    cout << "GrabCut model loaded from " << path << endl;
+  return model;
+}
+
+static void saveGrabCutModel(const shared_ptr<GrabCutModel>& model,
+                             const string& path)
+{
+  if (!model)
+    return;
+  cout << "GrabCut model: " << model->getReuses() << " documents reused it, "
+       << model->getRelearns() << " re-learned it" << endl;
+  if (model->isTrained() && !model->save(path))
+    cerr << "Could not save the GrabCut model to " << path << endl;
+}
+
+// -e grabcut|contours|auto; false for anything else
+static bool parseEngine(const string& name, DetectionEngine& engine)
+{
+  if (name == "grabcut")
+    engine = DetectionEngine::GRABCUT;
+  else if (name == "contours")
+    engine = DetectionEngine::CONTOURS;
+  else if (name == "auto")
+    engine = DetectionEngine::AUTO;
+  else
+    return false;
+  return true;
+}
+
+// HEADLESS BATCH MODE
+/******************************************************************************/
+static int runBatch(int argc, char* argv[])
+{
+  if (argc < 4)
+  {
+    printUsage();
+    return EXIT_FAILURE;
+  }
+  unsigned int numThreads = 0;
+  DSOptions options;
+  PipelineOptions pipeOptions;
+  bool stageThreadsGiven = false;
+  string traceJsonPath, traceLogPath, outputExt, grabCutModelPath;
+  vector<string> inputs;
+  for (int i = 3; i < argc; ++i)
+  {
+    string arg(argv[i]);
+    if (arg == "-j" && i + 1 < argc)
+      numThreads = static_cast<unsigned int>(stoul(argv[++i]));
+    else if (arg == "-e" && i + 1 < argc)
+    {
+      if (!parseEngine(argv[++i], options.engine))
+      {
+        printUsage();
+        return EXIT_FAILURE;
+      }
+    }
+    else if (arg == "-s" && i + 1 < argc)
+      options.detectionSize = stoi(argv[++i]);
+    else if (arg == "-t" && i + 1 < argc)
+      traceJsonPath = argv[++i];
+    else if (arg == "-l" && i + 1 < argc)
+      traceLogPath = argv[++i];
+    else if (arg == "-c" && i + 1 < argc)
+      options.warpCache = make_shared<WarpMapCache>(stoul(argv[++i]) << 20);
+    else if (arg == "-p" && i + 1 < argc)
+    {
+      unsigned int counts[4] = {};
+      if (sscanf(argv[++i], "%u,%u,%u,%u", &counts[0], &counts[1], &counts[2],
+                 &counts[3]) != 4)
+      {
+        printUsage();
+        return EXIT_FAILURE;
+      }
+      pipeOptions.decodeThreads  = counts[0];
+      pipeOptions.segmentThreads = counts[1];
+      pipeOptions.warpThreads    = counts[2];
+      pipeOptions.encodeThreads  = counts[3];
+      stageThreadsGiven = true;
+    }
+    else if (arg == "-g" && i + 1 < argc)
+    {
+      // WARM START, WITH A TIME BUDGET UNLESS "warm"
+      string budget(argv[++i]);
+      options.grabCutWarmStart = true;
+      if (budget != "warm")
+        options.grabCutBudgetMs = stod(budget);
+    }
+    else if (arg == "-q" && i + 1 < argc)
+      pipeOptions.queueCapacity = stoul(argv[++i]);
+    else if (arg == "-m" && i + 1 < argc)
+      pipeOptions.maxInFlight = stoul(argv[++i]);
+    else if (arg == "-X" && i + 1 < argc)
+      pipeOptions.memoryCapMB = stoul(argv[++i]);
+    else if (arg == "-M" && i + 1 < argc)
+      options.outputBudgetMB = stoul(argv[++i]);
+    else if (arg == "-o" && i + 1 < argc)
+      outputExt = argv[++i];
+    else if (arg == "-C" && i + 1 < argc)
+      options.resultCache = make_shared<ResultCache>(argv[++i]);
+    else if (arg == "-T" && i + 1 < argc)
+      options.latencyBudgetMs = stod(argv[++i]);
+    else if (arg == "-F")
+      options.reusePreviousQuad = true;
+    else if (arg == "-G" && i + 1 < argc)
+    {
+      grabCutModelPath = argv[++i];
+      options.grabCutModel = loadGrabCutModel(grabCutModelPath);
+    }
+    else if (arg == "-B")
+      options.binarize = true;
+    else if (arg == "-k" && i + 1 < argc)
+      options.encodeOptions.quality = stoi(argv[++i]);
+    else if (arg == "-b" && i + 1 < argc)
+      options.encodeOptions.targetBytes = stoul(argv[++i]);
+    else if (arg == "-D" && i + 1 < argc)
+    {
+      options.maxDocuments = stoi(argv[++i]);
+      pipeOptions.multiDocument = options.maxDocuments > 1;
+    }
+    else
+      inputs.push_back(arg);
+  }
+  // -j IS SHORTHAND FOR THE SEGMENT STAGE, UNLESS -p SET EVERY STAGE
+  if (!stageThreadsGiven)
+    pipeOptions.segmentThreads = numThreads;
+  // 1-BIT PAGES ARE WRITTEN AS PACKED PBM UNLESS -o SAYS OTHERWISE
+  if (options.binarize && outputExt.empty())
+    outputExt = ".pbm";
+
+  BatchScanner batch(argv[2], numThreads, options);
+  batch.setPipelineOptions(pipeOptions);
+  batch.setOutputExtension(outputExt);
+  for (const auto& input : inputs)
+    batch.addInput(input);
+  if (batch.numInputs() == 0)
+  {
+    cerr << "No input images found" << endl;
+    return EXIT_FAILURE;
+  }
+
+  int numFailed = 0;
+  vector<BatchResult> results = batch.run();
+  vector<StageTracer> traces;
+  for (const auto& result : results)
+  {
+    if (!result.succeeded)
+      ++numFailed;
+    traces.push_back(result.trace);
+  }
+
+  // EXPORT STAGE TRACES
+  if (!traceJsonPath.empty())
+  {
+    ofstream traceJson(traceJsonPath);
+    StageTracer::writeChromeTrace(traceJson, traces);
+  }
+  if (!traceLogPath.empty())
+  {
+    ofstream traceLog(traceLogPath);
+    for (const auto& trace : traces)
+      traceLog << trace.toLogLine() << endl;
+  }
+
+  cout << batch.numInputs() - numFailed << " of " << batch.numInputs()
+       << " documents extracted" << endl;
+  size_t totalBytes = 0;
+  double totalMs = 0.0;
+  int overBudget = 0;
+  for (const auto& result : results)
+  {
+    totalBytes += result.encode.bytes;
+    totalMs    += result.encode.encodeMs;
+    overBudget += result.encode.overBudget ? 1 : 0;
+  }
+  cout << totalBytes << " bytes written, " << totalMs << " ms encoding";
+  if (options.encodeOptions.targetBytes > 0)
+    cout << ", " << overBudget << " pages over the "
+         << options.encodeOptions.targetBytes << " byte budget";
+  cout << endl;
+  if (options.warpCache)
+    cout << "Remap cache: " << options.warpCache->getHits() << " hits, "
+         << options.warpCache->getMisses() << " misses" << endl;
+  if (options.resultCache)
+    cout << "Result cache: " << options.resultCache->getHits() << " hits, "
+         << options.resultCache->getMisses() << " misses" << endl;
+  saveGrabCutModel(options.grabCutModel, grabCutModelPath);
+  return numFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// HEADLESS VIDEO MODE: ONE IMAGE PER STABLE PAGE
+/******************************************************************************/
+static int runVideo(int argc, char* argv[])
+{
+  if (argc < 4)
+  {
+    printUsage();
+    return EXIT_FAILURE;
+  }
+  DSOptions options;
+  options.engine = DetectionEngine::AUTO;
+  string outputExt = ".jpg";
+  for (int i = 4; i < argc; ++i)
+  {
+    string arg(argv[i]);
+    if (arg == "-e" && i + 1 < argc)
+    {
+      if (!parseEngine(argv[++i], options.engine))
+      {
+        printUsage();
+        return EXIT_FAILURE;
+      }
+    }
+    else if (arg == "-k" && i + 1 < argc)
+      options.encodeOptions.quality = stoi(argv[++i]);
+    else if (arg == "-b" && i + 1 < argc)
+      options.encodeOptions.targetBytes = stoul(argv[++i]);
+    else if (arg == "-x" && i + 1 < argc)
+    {
+      outputExt = argv[++i];
+      if (outputExt[0] != '.')
+        outputExt = "." + outputExt;
+    }
+  }
+
+  VideoScanner video(options);
+  if (!video.open(argv[2]))
+  {
+    cerr << "Could not open " << argv[2] << endl;
+    return EXIT_FAILURE;
+  }
+  fs::path outDir(argv[3]);
+  fs::create_directories(outDir);
+  // PAGES ARE ENCODED WHILE THE NEXT FRAMES ARE TRACKED
+  EncoderPool encoder(1, options.encodeOptions);
+  vector<pair<string, future<EncodeReport>>> written;
+  video.setPageCallback([&](const Mat& page, const VideoPage& info)
+  {
+    char name[32];
+    snprintf(name, sizeof(name), "page_%06lld",
+             static_cast<long long>(info.frameIndex));
+    string path = (outDir / (name + outputExt)).string();
+    written.emplace_back(path, encoder.submit(page.clone(), path));
+    cout << "frame " << info.frameIndex << " -> " << path << endl;
+  });
+  video.run();
+  encoder.finish();
+
+  size_t totalBytes = 0;
+  double totalMs = 0.0;
+  int numFailed = 0;
+  for (auto& [path, done] : written)
+  {
+    try
+    {
+      EncodeReport report = done.get();
+      totalBytes += report.bytes;
+      totalMs    += report.encodeMs;
+    }
+    catch (const exception& exp)
+    {
+      cerr << exp.what() << endl;
+      ++numFailed;
+    }
+  }
+  cout << video.getNumPages() << " pages from " << video.getNumFrames()
+       << " frames (" << video.getNumDetections() << " full detections)"
+       << endl;
+  if (!written.empty())
+    cout << totalBytes << " bytes written, " << totalMs / written.size()
+         << " ms encode per page" << endl;
+  return numFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// DAEMON: WARM SCANNERS BEHIND A UNIX DOMAIN SOCKET
+/******************************************************************************/
+static ScannerDaemon* runningDaemon = nullptr;
+
+static int runServe(int argc, char* argv[])
+{
+  if (argc < 3)
+  {
+    printUsage();
+    return EXIT_FAILURE;
+  }
+  DSOptions options;
+  DaemonOptions daemonOptions;
+  string grabCutModelPath;
+  for (int i = 3; i < argc; ++i)
+  {
+    string arg(argv[i]);
+    if (arg == "-j" && i + 1 < argc)
+      daemonOptions.numScanners = stoul(argv[++i]);
+    else if (arg == "-e" && i + 1 < argc)
+    {
+      if (!parseEngine(argv[++i], options.engine))
+      {
+        printUsage();
+        return EXIT_FAILURE;
+      }
+    }
+    else if (arg == "-s" && i + 1 < argc)
+      options.detectionSize = stoi(argv[++i]);
+    else if (arg == "-C" && i + 1 < argc)
+      options.resultCache = make_shared<ResultCache>(argv[++i]);
+    else if (arg == "-T" && i + 1 < argc)
+      options.latencyBudgetMs = stod(argv[++i]);
+    else if (arg == "-F")
+      options.reusePreviousQuad = true;
+    else if (arg == "-G" && i + 1 < argc)
+    {
+      grabCutModelPath = argv[++i];
+      options.grabCutModel = loadGrabCutModel(grabCutModelPath);
+    }
+    else if (arg == "-B")
+      options.binarize = true;
+    else if (arg == "-k" && i + 1 < argc)
+      options.encodeOptions.quality = stoi(argv[++i]);
+    else if (arg == "-b" && i + 1 < argc)
+      options.encodeOptions.targetBytes = stoul(argv[++i]);
+    else if (arg == "-Q")
+      daemonOptions.logRequests = false;
+    else if (arg == "-R" && i + 1 < argc)
+      daemonOptions.pathRoot = argv[++i];
+  }
+
+  ScannerDaemon daemon(options, daemonOptions);
+  runningDaemon = &daemon;
+  signal(SIGINT,  [](int) { runningDaemon->stop(); });
+  signal(SIGTERM, [](int) { runningDaemon->stop(); });
+  cout << "Serving on " << argv[2] << endl;
+  bool served = daemon.serve(argv[2]);
+  runningDaemon = nullptr;
+  if (!served)
+  {
+    cerr << "Could not listen on " << argv[2] << endl;
+    return EXIT_FAILURE;
+  }
+  cout << daemon.getNumRequests() << " requests served" << endl;
+  saveGrabCutModel(options.grabCutModel, grabCutModelPath);
+  return EXIT_SUCCESS;
+}
+
+// CLIENT: SEND FILES OVER P CONNECTIONS, REPORT LATENCIES
+/******************************************************************************/
+static int runClient(int argc, char* argv[])
+{
+  if (argc < 4)
+  {
+    printUsage();
+    return EXIT_FAILURE;
+  }
+  string socketPath(argv[2]);
+  DaemonRequest proto;
+  unsigned int numConnections = 1;
+  int repeat = 1;
+  fs::path outDir;
+  vector<string> files;
+  for (int i = 3; i < argc; ++i)
+  {
+    string arg(argv[i]);
+    if (arg == "--shutdown")
+    {
+      ScannerClient client;
+      DaemonRequest request;
+      DaemonResponse response;
+      request.flags = REQ_SHUTDOWN;
+      return client.connect(socketPath) && client.send(request, response) ?
+             EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    else if (arg == "--paths")
+      proto.flags |= REQ_PATH;
+    else if (arg == "--corners-only")
+      proto.flags |= REQ_CORNERS_ONLY;
+    else if (arg == "-P" && i + 1 < argc)
+      numConnections = max(1ul, stoul(argv[++i]));
+    else if (arg == "-r" && i + 1 < argc)
+      repeat = max(1, stoi(argv[++i]));
+    else if (arg == "-o" && i + 1 < argc)
+      outDir = argv[++i];
+    else if (arg == "-x" && i + 1 < argc)
+      proto.ext = argv[++i];
+    else
+      files.push_back(fs::absolute(arg).string());
+  }
+  if (!outDir.empty())
+    fs::create_directories(outDir);
+
+  vector<string> jobs;
+  for (int r = 0; r < repeat; ++r)
+    jobs.insert(jobs.end(), files.begin(), files.end());
+  atomic<size_t> nextJob{0};
+  atomic<int> numFailed{0};
+  mutex outputMutex;
+  vector<double> roundTripMs;
+  auto worker = [&]()
+  {
+    ScannerClient client;
+    if (!client.connect(socketPath))
+    {
+      lock_guard<mutex> lock(outputMutex);
+      cerr << "Could not connect to " << socketPath << endl;
+      ++numFailed;
+      return;
+    }
+    for (size_t i = nextJob++; i < jobs.size(); i = nextJob++)
+    {
+      DaemonRequest request = proto;
+      if (request.flags & REQ_PATH)
+        request.payload.assign(jobs[i].begin(), jobs[i].end());
+      else
+      {
+        ifstream file(jobs[i], ios::binary);
+        request.payload.assign(istreambuf_iterator<char>(file),
+                               istreambuf_iterator<char>());
+      }
+      DaemonResponse response;
+      auto start = chrono::steady_clock::now();
+      bool sent = client.send(request, response);
+      double ms = chrono::duration<double, milli>(
+        chrono::steady_clock::now() - start).count();
+
+      lock_guard<mutex> lock(outputMutex);
+      if (!sent || response.status != 0)
+      {
+        ++numFailed;
+        cerr << jobs[i] << ": "
+             << (sent ? response.error : "connection lost") << endl;
+        if (!sent)
+          return;
+        continue;
+      }
+      roundTripMs.push_back(ms);
+      cout << jobs[i] << ": server " << response.latencyMs
+           << " ms, round trip " << ms << " ms"
+           << (response.degraded ? " (degraded)" : "") << ", corners";
+      for (const auto& corner : response.corners)
+        cout << " (" << corner.x << "," << corner.y << ")";
+      cout << endl;
+      if (!outDir.empty() && !response.image.empty())
+      {
+        fs::path out = outDir / (fs::path(jobs[i]).stem().string() +
+                                 "_scanned" + proto.ext);
+        ofstream(out, ios::binary).write(
+          reinterpret_cast<const char*>(response.image.data()),
+          static_cast<streamsize>(response.image.size()));
+      }
+    }
+  };
+  vector<thread> workers;
+  for (unsigned int i = 0; i < numConnections; ++i)
+    workers.emplace_back(worker);
+  for (auto& t : workers)
+    t.join();
+
+  if (!roundTripMs.empty())
+  {
+    sort(roundTripMs.begin(), roundTripMs.end());
+    size_t p95 = min(roundTripMs.size() - 1,
+                     static_cast<size_t>(0.95 * roundTripMs.size()));
+    cout << roundTripMs.size() << " requests over " << numConnections
+         << " connections: p50 " << roundTripMs[roundTripMs.size() / 2]
+         << " ms, p95 " << roundTripMs[p95] << " ms" << endl;
+  }
+  return numFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 /******************************************************************************/
 int main(int argc, char* argv[])
 {
   string filename;
-  if (argc == 2)
+  DSOptions options;
+  if (argc >= 2 && string(argv[1]) == "--batch")
+    return runBatch(argc, argv);
+  else if (argc >= 2 && string(argv[1]) == "--video")
+    return runVideo(argc, argv);
+  else if (argc >= 2 && string(argv[1]) == "--serve")
+    return runServe(argc, argv);
+  else if (argc >= 2 && string(argv[1]) == "--client")
+    return runClient(argc, argv);
+  else if (argc == 2 || (argc == 4 && string(argv[2]) == "-C"))
+  {
     filename = string(argv[1]);
+    if (argc == 4)
+      options.resultCache = make_shared<ResultCache>(argv[3]);
+  }
   else if (argc == 1)
     //filename = "../images/scanned-form.jpg";
     filename = "../images/scanned-form.jpg";
   else
   {
-    cout << "USAGE:" << endl
-         << "./documentScanner <filename>" << endl
-         << "-OR-" << endl
-         << "./documentScanner" << endl;
+    printUsage();
     return EXIT_FAILURE;
   }
 
-  DocumentScanner ds(filename, "Detection");
+  DocumentScanner ds(filename, "Detection", "Extracted Document", 2, options);
   ds.run();
 
 	return 0;
 }
 /******************************************************************************/
-
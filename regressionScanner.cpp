@@ -0,0 +1,315 @@
+//
+// Detection regression suite: corner error against golden corners, the
+// orientation found, and per-stage latency against a recorded baseline.
+//
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <filesystem>
+
+#include <opencv2/opencv.hpp>
+
+#include "DocumentScanner.h"
+
+using namespace std;
+using namespace cv;
+namespace fs = std::filesystem;
+
+// SET BY CMAKE; LATENCY BASELINES ARE ONLY COMPARED WITHIN ONE BUILD TYPE
+#ifndef DS_BUILD_TYPE
+#define DS_BUILD_TYPE "unknown"
+#endif
+
+struct GoldenImage
+{
+  string file;
+  Size size;
+  vector<Point2f> corners; // CW from the upper left
+  double maxError = 0.0;   // px; 0 = the suite's limit
+};
+
+struct CornerError
+{
+  double meanPx = 0.0;
+  double maxPx  = 0.0;
+  int shift     = 0; // found corner k matches golden corner (k + shift) % 4
+};
+
+static void printUsage()
+{
+  cout << "USAGE:" << endl
+       << "./regressionScanner <golden.yml> [-n <runs>] "
+          "[-e grabcut|contours|auto] [-s <detectionSize>] "
+          "[-E <maxCornerError, fraction of the diagonal>] "
+          "[-b <latencyBaseline.yml>] [-L <p95 tolerance>] "
+          "[-u (record the baseline)]" << endl;
+}
+
+// GOLDEN CORNERS
+/******************************************************************************/
+static bool loadGolden(const fs::path& path, vector<GoldenImage>& golden)
+{
+  FileStorage fsIn(path.string(), FileStorage::READ);
+  if (!fsIn.isOpened())
+    return false;
+  for (const auto& node : fsIn["images"])
+  {
+    GoldenImage g;
+    g.file = static_cast<string>(node["file"]);
+    vector<int> size;
+    vector<float> corners;
+    node["size"] >> size;
+    node["corners"] >> corners;
+    if (!node["maxError"].empty())
+      g.maxError = static_cast<double>(node["maxError"]);
+    if (g.file.empty() || size.size() != 2 || corners.size() != 8)
+    {
+      cerr << path << ": malformed entry " << g.file << endl;
+      return false;
+    }
+    g.size = Size(size[0], size[1]);
+    for (int k = 0; k < 4; ++k)
+      g.corners.emplace_back(corners[2 * k], corners[2 * k + 1]);
+    golden.push_back(g);
+  }
+  return !golden.empty();
+}
+
+// CORNER ERROR: BEST CYCLIC MATCH, SO A ROTATED LABELLING STILL COUNTS
+/******************************************************************************/
+// Which corner of a page near 45 degrees is "upper left" is a judgement
+// call; the shift is reported, the geometry is what is checked.
+static CornerError cornerError(const vector<Point2f>& found,
+                               const vector<Point2f>& golden)
+{
+  CornerError best;
+  best.meanPx = numeric_limits<double>::infinity();
+  if (found.size() != 4)
+  {
+    best.maxPx = best.meanPx;
+    return best;
+  }
+  for (int shift = 0; shift < 4; ++shift)
+  {
+    double sum = 0.0, worst = 0.0;
+    for (int k = 0; k < 4; ++k)
+    {
+      double d = norm(found[k] - golden[(k + shift) % 4]);
+      sum  += d;
+      worst = max(worst, d);
+    }
+    if (sum / 4 < best.meanPx)
+    {
+      best.meanPx = sum / 4;
+      best.maxPx  = worst;
+      best.shift  = shift;
+    }
+  }
+  return best;
+}
+
+// P50 / P95 OF ONE STAGE
+/******************************************************************************/
+static double percentile(vector<double> samples, double p)
+{
+  if (samples.empty())
+    return 0.0;
+  sort(samples.begin(), samples.end());
+  size_t idx = static_cast<size_t>(p * (samples.size() - 1) + 0.5);
+  return samples[min(idx, samples.size() - 1)];
+}
+
+/******************************************************************************/
+int main(int argc, char* argv[])
+{
+  if (argc < 2)
+  {
+    printUsage();
+    return EXIT_FAILURE;
+  }
+  fs::path goldenPath(argv[1]);
+  DSOptions options;
+  options.headless = true;
+  int numRuns = 5;
+  double maxErrorFraction = 0.015;
+  // A STAGE FAILS WHEN ITS P95 GROWS BY MORE THAN THE TOLERANCE AND BY MORE
+  // THAN MIN_SLACK_MS, SO SUB-MILLISECOND STAGES DON'T FAIL ON NOISE
+  double latencyTolerance = 0.25;
+  const double MIN_SLACK_MS = 2.0;
+  fs::path baselinePath;
+  bool updateBaseline = false;
+  for (int i = 2; i < argc; ++i)
+  {
+    string arg(argv[i]);
+    if (arg == "-n" && i + 1 < argc)
+      numRuns = max(1, stoi(argv[++i]));
+    else if (arg == "-e" && i + 1 < argc)
+    {
+      string engine(argv[++i]);
+      if (engine == "contours")
+        options.engine = DetectionEngine::CONTOURS;
+      else if (engine == "auto")
+        options.engine = DetectionEngine::AUTO;
+      else if (engine == "grabcut")
+        options.engine = DetectionEngine::GRABCUT;
+      else
+      {
+        printUsage();
+        return EXIT_FAILURE;
+      }
+    }
+    else if (arg == "-s" && i + 1 < argc)
+      options.detectionSize = stoi(argv[++i]);
+    else if (arg == "-E" && i + 1 < argc)
+      maxErrorFraction = stod(argv[++i]);
+    else if (arg == "-b" && i + 1 < argc)
+      baselinePath = argv[++i];
+    else if (arg == "-L" && i + 1 < argc)
+      latencyTolerance = stod(argv[++i]);
+    else if (arg == "-u")
+      updateBaseline = true;
+    else
+    {
+      printUsage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  vector<GoldenImage> golden;
+  if (!loadGolden(goldenPath, golden))
+  {
+    cerr << "Could not read golden corners from " << goldenPath << endl;
+    return EXIT_FAILURE;
+  }
+
+  // 1. ACCURACY: EVERY IMAGE numRuns TIMES, ONE WARM SCANNER
+  int numFailed = 0;
+  map<string, vector<double>> stageMs;
+  DocumentScanner ds(options);
+  cout << left << setw(20) << "image" << setw(11) << "size"
+       << setw(14) << "orientation" << setw(10) << "detector"
+       << right << setw(10) << "mean px" << setw(10) << "max px"
+       << setw(10) << "limit" << "  result" << endl;
+  for (const auto& g : golden)
+  {
+    fs::path imagePath = goldenPath.parent_path() / g.file;
+    double limit = g.maxError > 0.0 ? g.maxError :
+                   maxErrorFraction * hypot(g.size.width, g.size.height);
+    string failure;
+    vector<Point2f> corners;
+    try
+    {
+      // THE SIZE OPENCV DECODES TO, EXIF ORIENTATION INCLUDED
+      Size decoded = imread(imagePath.string()).size();
+      if (decoded == Size(g.size.height, g.size.width))
+        throw runtime_error("decoded transposed: EXIF orientation ignored?");
+      if (decoded != g.size)
+        throw runtime_error("decoded size differs from the golden size");
+      for (int run = 0; run < numRuns; ++run)
+      {
+        ds.reset(imagePath.string());
+        ds.runDetection();
+        ds.findCorners();
+        ds.performFindHomography();
+        for (const auto& span : ds.getTracer().getSpans())
+          stageMs[span.name].push_back(span.wallUs / 1000.0);
+        stageMs["total"].push_back(ds.getTracer().totalWallUs() / 1000.0);
+      }
+      corners = ds.fullResCorners();
+    }
+    catch (const exception& exp)
+    {
+      failure = exp.what();
+    }
+
+    CornerError err = cornerError(corners, g.corners);
+    if (failure.empty() && err.maxPx > limit)
+      failure = "corner error over the limit";
+    cout << left << setw(20) << g.file
+         << setw(11) << (to_string(g.size.width) + "x" +
+                         to_string(g.size.height))
+         << setw(14) << DocumentScanner::orientationToString(
+                          ds.getOrientation())
+         << setw(10) << DocumentScanner::detectionEngineToString(
+                          ds.getDetector())
+         << right << fixed << setprecision(1)
+         << setw(10) << err.meanPx << setw(10) << err.maxPx
+         << setw(10) << limit << "  "
+         << (failure.empty() ? "PASS" : "FAIL: " + failure);
+    if (failure.empty() && err.shift != 0)
+      cout << " (corners relabelled by " << err.shift << ")";
+    cout << endl;
+    if (!failure.empty())
+      ++numFailed;
+  }
+
+  // 2. LATENCY: P95 PER STAGE OVER EVERY RUN, AGAINST THE BASELINE
+  // (ONLY ONE RECORDED FROM THE SAME BUILD TYPE: DEBUG AND RELEASE TIMINGS
+  // ARE NOT COMPARABLE)
+  map<string, double> baseline;
+  bool haveBaseline = false;
+  string notChecked;
+  if (!baselinePath.empty() && !updateBaseline && !fs::exists(baselinePath))
+    notChecked = "no baseline at " + baselinePath.string() +
+                 " (record one with -u)";
+  else if (!baselinePath.empty() && !updateBaseline)
+  {
+    FileStorage fsIn(baselinePath.string(), FileStorage::READ);
+    string baseBuildType = static_cast<string>(fsIn["buildType"]);
+    if (baseBuildType != DS_BUILD_TYPE)
+      notChecked = "baseline recorded on a " + baseBuildType +
+                   " build, this is " + DS_BUILD_TYPE;
+    else
+      for (const auto& node : fsIn["p95Ms"])
+        baseline[node.name()] = static_cast<double>(node);
+    haveBaseline = !baseline.empty();
+  }
+  cout << endl << left << setw(24) << "stage" << right << setw(8) << "runs"
+       << setw(10) << "p50 ms" << setw(10) << "p95 ms" << setw(12)
+       << "base p95" << "  result" << endl;
+  int numSlower = 0;
+  for (const auto& [stage, samples] : stageMs)
+  {
+    double p95 = percentile(samples, 0.95);
+    cout << left << setw(24) << stage << right << setw(8) << samples.size()
+         << fixed << setprecision(2)
+         << setw(10) << percentile(samples, 0.5) << setw(10) << p95;
+    auto base = baseline.find(stage);
+    if (base == baseline.end())
+      cout << setw(12) << "-" << endl;
+    else
+    {
+      bool slower = p95 > base->second * (1.0 + latencyTolerance) &&
+                    p95 - base->second > MIN_SLACK_MS;
+      cout << setw(12) << base->second << "  "
+           << (slower ? "FAIL: p95 regressed" : "PASS") << endl;
+      numSlower += slower ? 1 : 0;
+    }
+  }
+
+  // ONLY -u RECORDS A BASELINE, AND ONLY FROM AN ACCURATE RUN
+  if (updateBaseline && !baselinePath.empty() && numFailed == 0)
+  {
+    FileStorage fsOut(baselinePath.string(), FileStorage::WRITE);
+    fsOut << "buildType" << DS_BUILD_TYPE;
+    fsOut << "p95Ms" << "{";
+    for (const auto& [stage, samples] : stageMs)
+      fsOut << stage << percentile(samples, 0.95);
+    fsOut << "}";
+    cout << "Latency baseline written to " << baselinePath << endl;
+  }
+
+  cout << golden.size() - numFailed << " of " << golden.size()
+       << " images within the corner error limit";
+  if (haveBaseline)
+    cout << ", " << numSlower << " stages slower than the baseline";
+  else if (!notChecked.empty())
+    cout << ", latency not checked: " << notChecked;
+  cout << endl;
+  return numFailed == 0 && numSlower == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -21,7 +21,7 @@ static void on_mouse(int event, int x, int y, int flags, void* data);
 int main()
 {
   // NOTE: CTOR WILL HANDLE POINTER DELETION
-  auto* cleanImg = new Mat(imread("../images/document1.jpg"));
+  auto* cleanImg = new Mat(imread("../images/document2.jpg"));
   auto* dirtyImg = new Mat(cleanImg->clone());
   auto* points  =  new vector<cv::Point> ({
     cv::Point(100,100), cv::Point(1000,100),
@@ -34,9 +34,8 @@ int main()
 
   CVPointMover cvpm2(points, cleanImg, dirtyImg, "Window");
 
-  imshow("Window", *dirtyImg);
   setMouseCallback("Window", on_mouse, &cvpm2);
-  waitKey();
+  cvpm2.runEventLoop('q');
 }
 /******************************************************************************/
 void on_mouse(int event, int x, int y, int flags, void* data)